@@ -25,32 +25,79 @@
  */
 
 
-/* UART Driver Header File */
+#include <errno.h>
+#include <sched.h>
+/* Drivers Header File */
 #include "driver.h"
 
-void (*callbackFxn)(void);
+static void (*callbackFxn)(void);
 
 /*
  *  ======== sigintHandler ========
  */
-/* Signal Handler for SIGINT */
-void sigintHandler(int sig_num) {
-    /* Reset handler to catch SIGINT next time.
-       Refer http://en.cppreference.com/w/c/program/signal */
-    signal(SIGINT, sigintHandler);
+/* Signal Handler for SIGINT and SIGTERM, sigaction() keeps it installed */
+static void sigintHandler(int sig_num) {
+    int saved = errno;
+
+    (void)sig_num;
     (*callbackFxn)();
+    errno = saved;
 }
 
 /*
  *  ======== drivers_init ========
  */
 uint8_t drivers_init(void (*fxn)(void)) {
+	struct sigaction action;
+
 	openlog("BBDL", LOG_PID | LOG_CONS | LOG_NDELAY | LOG_NOWAIT, LOG_LOCAL0);
-	syslog(LOG_INFO, "%s", "Starting BBDL");
+	/* Log records are formatted and sent to syslog by a background thread */
+	log_start();
+	atexit(log_stop);
+	log_info("Starting BBDL");
 	
 	callbackFxn = fxn;
-	
-	signal(SIGINT, sigintHandler);
-	
+	if (fxn == NULL) {
+		return 0;
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sigintHandler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	if (sigaction(SIGINT, &action, NULL) < 0 || sigaction(SIGTERM, &action, NULL) < 0) {
+		log_err("drivers_init(): sigaction: %m");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== drivers_thread_create ========
+ */
+uint8_t drivers_thread_create(pthread_t *thread, int priority, void *(*fxn)(void *),
+		void *arg) {
+	pthread_attr_t attr;
+	struct sched_param param;
+	int status;
+
+	pthread_attr_init(&attr);
+	if (priority > 0) {
+		param.sched_priority = priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	status = pthread_create(thread, &attr, fxn, arg);
+	if (status != 0 && priority > 0) {
+		log_err("drivers_thread_create(): SCHED_FIFO refused, using the default policy");
+		status = pthread_create(thread, NULL, fxn, arg);
+	}
+	pthread_attr_destroy(&attr);
+	if (status != 0) {
+		log_err("drivers_thread_create(): could not create thread: %s", strerror(status));
+		errno = status;
+		return -1;
+	}
 	return 0;
-}
\ No newline at end of file
+}
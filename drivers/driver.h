@@ -40,12 +40,40 @@
 #include <dirent.h>
 #include <syslog.h>
 #include <signal.h>
+#include <pthread.h>
+/* Drivers Log Header File */
+#include "log.h"
 
 /*!
  *  @brief  Function to initialize drivers library
  *
+ *  Starts the logger and, when \a fxn is given, calls it on SIGINT and
+ *  SIGTERM. \a fxn runs inside the signal handler, so it may only set a
+ *  flag or call async-signal-safe functions such as loop_stop(). An
+ *  application with an event loop passes NULL and receives the signals
+ *  with loop_add_signal() instead.
+ *
+ *  @param  fxn     Signal callback, NULL installs no handler
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t drivers_init(void (*fxn)(void));
+
+/*!
+ *  @brief  Function to start a thread with real-time scheduling
+ *
+ *  A non zero \a priority runs the thread under SCHED_FIFO. Real-time
+ *  scheduling needs privileges, when it is refused the refusal is logged
+ *  and the thread is started with the default policy instead.
+ *
+ *  @param  thread      Receives the thread
+ *  @param  priority    SCHED_FIFO priority, 0 keeps the policy
+ *  @param  fxn         Thread function
+ *  @param  arg         Passed to fxn
+ *
  *  @return Returns if an error ocurred, 0 means no error ocurred
  */
-extern uint8_t drivers_init();
+extern uint8_t drivers_thread_create(pthread_t *thread, int priority, void *(*fxn)(void *),
+		void *arg);
 
 #endif /* __DRIVER_H */
\ No newline at end of file
@@ -25,128 +25,469 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
+#include <poll.h>
 /* GPIO Driver Header File */
 #include "driver.h"
 #include "gpio.h"
+#include "gpio_mmap.h"
+#include "gpio_cdev.h"
+
+/* Root of the sysfs GPIO tree, see gpio_set_root(). Half of MAX_BUF leaves
+   room for the attribute names appended to it. */
+static char gpio_root[MAX_BUF / 2] = SYSFS_GPIO_DIR;
+
+/*
+ *  ======== gpio_set_root ========
+ */
+void gpio_set_root(const char *root) {
+	if (root == NULL) {
+		root = SYSFS_GPIO_DIR;
+	}
+	snprintf(gpio_root, sizeof(gpio_root), "%s", root);
+}
+
+/*
+ *  ======== gpio_open_cdev ========
+ */
+static uint8_t gpio_open_cdev(gpio_properties *gpio) {
+	gpio_cdev_lines lines;
+
+	lines.chip = gpio->nr / GPIO_BANK_PINS;
+	lines.count = 1;
+	lines.offsets[0] = gpio->nr % GPIO_BANK_PINS;
+	lines.direction = gpio->direction;
+	if (gpio_cdev_request(&lines, NULL) != 0) {
+		return -1;
+	}
+	gpio->fd = lines.fd;
+	return 0;
+}
+
+/*
+ *  ======== gpio_now ========
+ */
+static int64_t gpio_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ *  ======== gpio_is_exported ========
+ */
+static int gpio_is_exported(int nr) {
+	char buf[MAX_BUF];
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d", gpio_root, nr);
+	return access(buf, F_OK) == 0;
+}
+
+/*
+ *  ======== gpio_open_retry ========
+ */
+/* udev fixes the permissions of a freshly exported pin a little after the
+   files appear, so EACCES and ENOENT are retried until the deadline. */
+static int gpio_open_retry(const char *path, int flags, int64_t deadline) {
+	const struct timespec pause = { 0, 1000000 };
+	int fd;
+
+	while ((fd = open(path, flags | O_CLOEXEC)) < 0) {
+		if ((errno != EACCES && errno != ENOENT) || gpio_now() > deadline) {
+			return -1;
+		}
+		nanosleep(&pause, NULL);
+	}
+	return fd;
+}
+
+/*
+ *  ======== gpio_setup ========
+ */
+/* Sets the direction unless it already matches and opens the value file */
+static void gpio_setup(gpio_properties *gpio, gpio_open_status *status, int64_t deadline) {
+	const char *direction = (gpio->direction == OUTPUT_PIN) ? "out" : "in";
+	char buf[MAX_BUF];
+	char current[8];
+	ssize_t size;
+	int fd;
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/direction", gpio_root, gpio->nr);
+	fd = gpio_open_retry(buf, O_RDWR, deadline);
+	if (fd < 0) {
+		status->error = errno;
+		log_err("gpio_open(): direction: %m");
+		return;
+	}
+	size = read(fd, current, sizeof(current) - 1);
+	current[size > 0 ? size : 0] = '\0';
+	if (strncmp(current, direction, strlen(direction)) != 0 ||
+			(current[strlen(direction)] != '\n' && current[strlen(direction)] != '\0')) {
+		log_info("gpio_open(): set direction %d, %d", gpio->nr, gpio->direction);
+		if (pwrite(fd, direction, strlen(direction), 0) < 0) {
+			status->error = errno;
+			log_err("gpio_open(): direction: %m");
+			close(fd);
+			return;
+		}
+		status->configured = 1;
+	}
+	close(fd);
+	
+	/* Keep the value file open, reads and writes reuse this descriptor */
+	snprintf(buf, sizeof(buf), "%s/gpio%d/value", gpio_root, gpio->nr);
+	gpio->fd = gpio_open_retry(buf, O_RDWR, deadline);
+	if (gpio->fd < 0) {
+		status->error = errno;
+		log_err("gpio_open(): value: %m");
+		return;
+	}
+	
+	if (gpio->backend == GPIO_MMAP) {
+		gpio->regs = gpio_mmap_bank(gpio->nr / 32);
+		gpio->mask = 1u << (gpio->nr % 32);
+		if (gpio->regs == NULL) {
+			log_err("gpio_open(): GPIO %d falls back to sysfs", gpio->nr);
+			gpio->backend = GPIO_SYSFS;
+		}
+	}
+}
 
 /*
  *  ======== gpio_open ========
  */
 uint8_t gpio_open(gpio_properties *gpio) {
-    syslog (LOG_INFO, "gpio_open(): export GPIO %d", gpio->nr);
-    FILE *export;
-    
-    export = fopen(SYSFS_GPIO_DIR "/export", "w");
-    if (export < 0) {
-    	perror("gpio_open(): export");
-    	return -1;
-    }
-    char str[15];
-    sprintf(str, "%d", gpio->nr);
-    fputs(str, export);
-    fclose(export);
-    
-    syslog (LOG_INFO, "gpio_open(): set direction %d, %d", gpio->nr, gpio->direction);
-    FILE *fd;
-    char buf[MAX_BUF];
-    snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/direction", gpio->nr);
-    fd = fopen(buf, "w");
-    if (fd < 0) {
-    	perror("gpio_open(): direction");
-    	return -1;
-    }
-    if (gpio->direction == OUTPUT_PIN) {
-    	fputs("out", fd);
-    } else {
-    	fputs("in", fd);
-    }
-    fclose(fd);
-    return 0;
+	return gpio_open_bulk(gpio, 1, NULL, NULL);
 }
 
 /*
- *  ======== gpio_write ========
+ *  ======== gpio_open_bulk ========
  */
-uint8_t gpio_write(gpio_properties *gpio, int value) {
-	syslog (LOG_INFO, "gpio_write(): GPIO %d set value %d", gpio->nr, value);
-	FILE *fd;
+uint8_t gpio_open_bulk(gpio_properties *gpios, int count, gpio_open_status *status,
+		struct timespec *elapsed) {
+	const struct timespec pause = { 0, 1000000 };
+	gpio_open_status *owned = NULL;
+	int64_t start = gpio_now();
+	int64_t deadline = start + (int64_t)GPIO_EXPORT_TIMEOUT * 1000000;
 	char buf[MAX_BUF];
+	int export = -1;
+	int pending = 0;
+	uint8_t result = 0;
+	int i;
 
-	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio->nr);
+	if (status == NULL) {
+		status = owned = calloc(count, sizeof(gpio_open_status));
+		if (status == NULL) {
+			return -1;
+		}
+	}
 
-	fd = fopen(buf, "w");
-	if (fd < 0) {
-		perror("gpio_write(): set value");
-		return -1;
+	/* Export every missing pin back to back */
+	for (i = 0; i < count; i++) {
+		gpio_properties *gpio = &gpios[i];
+		char str[15];
+		int length;
+
+		memset(&status[i], 0, sizeof(status[i]));
+		gpio->fd = -1;
+		gpio->regs = NULL;
+		gpio->edge = GPIO_EDGE_NONE;
+		if (gpio->backend == GPIO_CDEV) {
+			log_info("gpio_open(): request GPIO %d", gpio->nr);
+			if (gpio_open_cdev(gpio) == 0) {
+				continue;
+			}
+			log_err("gpio_open(): GPIO %d falls back to sysfs", gpio->nr);
+			gpio->backend = GPIO_SYSFS;
+		}
+		if (gpio_is_exported(gpio->nr)) {
+			continue;
+		}
+
+		log_info("gpio_open(): export GPIO %d", gpio->nr);
+		if (export < 0) {
+			snprintf(buf, sizeof(buf), "%s/export", gpio_root);
+			export = open(buf, O_WRONLY | O_CLOEXEC);
+			if (export < 0) {
+				log_err("gpio_open(): export: %m");
+				status[i].error = errno;
+				continue;
+			}
+		}
+		length = sprintf(str, "%d", gpio->nr);
+		/* EBUSY means another process exported the pin in the meantime */
+		if (write(export, str, length) < 0 && errno != EBUSY) {
+			log_err("gpio_open(): export: %m");
+			status[i].error = errno;
+			continue;
+		}
+		status[i].exported = 1;
+		pending++;
+	}
+	if (export >= 0) {
+		close(export);
 	}
 
-	char str[2];
-	sprintf(str, "%d", value);
-	fputs(str, fd);
+	/* A single wait for all the gpioN directories */
+	while (pending > 0) {
+		pending = 0;
+		for (i = 0; i < count; i++) {
+			if (status[i].exported && !gpio_is_exported(gpios[i].nr)) {
+				pending++;
+			}
+		}
+		if (pending == 0) {
+			break;
+		}
+		if (gpio_now() > deadline) {
+			for (i = 0; i < count; i++) {
+				if (status[i].exported && !gpio_is_exported(gpios[i].nr)) {
+					log_err("gpio_open(): GPIO %d was not exported", gpios[i].nr);
+					status[i].error = ETIMEDOUT;
+				}
+			}
+			break;
+		}
+		nanosleep(&pause, NULL);
+	}
 
-	fclose(fd);
+	for (i = 0; i < count; i++) {
+		if (status[i].error == 0 && gpios[i].fd < 0) {
+			gpio_setup(&gpios[i], &status[i], deadline);
+		}
+		if (status[i].error != 0) {
+			result = -1;
+		}
+	}
+
+	if (elapsed != NULL) {
+		int64_t total = gpio_now() - start;
+
+		elapsed->tv_sec = total / 1000000000;
+		elapsed->tv_nsec = total % 1000000000;
+	}
+	free(owned);
+	return result;
+}
+
+/*
+ *  ======== gpio_write ========
+ */
+uint8_t gpio_write(gpio_properties *gpio, int value) {
+	int64_t start;
+	uint8_t status;
+
+	if (gpio->regs != NULL) {
+		if (value) {
+			gpio_mmap_set(gpio->regs, gpio->mask);
+		} else {
+			gpio_mmap_clear(gpio->regs, gpio->mask);
+		}
+		stats_record(&gpio->write_stats, 0, 1, 1);
+		return 0;
+	}
+
+	log_debug("gpio_write(): GPIO %d set value %d", gpio->nr, value);
+
+	start = stats_now();
+	if (gpio->backend == GPIO_CDEV) {
+		status = gpio_cdev_set_values(gpio->fd, value ? 1 : 0, 1);
+		stats_record(&gpio->write_stats, start, status ? -1 : 1, 1);
+		return status;
+	}
+
+	if (pwrite(gpio->fd, value ? "1" : "0", 1, 0) != 1) {
+		log_err("gpio_write(): set value: %m");
+		stats_record(&gpio->write_stats, start, -1, 1);
+		return -1;
+	}
+	stats_record(&gpio->write_stats, start, 1, 1);
 	return 0;
 }
 
+/*
+ *  ======== gpio_uring_write ========
+ */
+uint8_t gpio_uring_write(uring *u, gpio_properties *gpio, int value,
+		uring_fxn fxn, void *arg) {
+	if (gpio->backend == GPIO_SYSFS) {
+		/* Static, the buffer must outlive the call */
+		return uring_write(u, gpio->fd, value ? "1" : "0", 1, 0, &gpio->write_stats, fxn, arg);
+	}
+	if (gpio_write(gpio, value) != 0) {
+		return uring_complete(u, -EIO, fxn, arg);
+	}
+	return uring_complete(u, 1, fxn, arg);
+}
+
 /*
  *  ======== gpio_read ========
  */
 uint8_t gpio_read(gpio_properties *gpio) {
-	syslog (LOG_INFO, "gpio_read(): GPIO %d get value", gpio->nr);
-	uint8_t value;
-	FILE *fd;
-	char buf[MAX_BUF];
+	int64_t start;
 
-	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/value", gpio->nr);
-	fd = fopen(buf, "r");
-	if (fd < 0) {
-		perror("gpio_read(): get value");
-		return -1;
+	if (gpio->regs != NULL) {
+		stats_record(&gpio->read_stats, 0, 1, 1);
+		return (gpio_mmap_read(gpio->regs) & gpio->mask) ? 1 : 0;
 	}
 
-	char str[2];
-	fgets(str, 2, fd);
+	log_debug("gpio_read(): GPIO %d get value", gpio->nr);
+	char str;
 
-	if (strcmp(str, "1") == 0) {
-		value = 1;
-	} else {
-		value = 0;
+	start = stats_now();
+	if (gpio->backend == GPIO_CDEV) {
+		uint64_t bits;
+
+		if (gpio_cdev_get_values(gpio->fd, 1, &bits) != 0) {
+			stats_record(&gpio->read_stats, start, -1, 1);
+			return -1;
+		}
+		stats_record(&gpio->read_stats, start, 1, 1);
+		return bits & 1;
 	}
 
-	fclose(fd);
-	return value;
+	if (pread(gpio->fd, &str, 1, 0) != 1) {
+		log_err("gpio_read(): get value: %m");
+		stats_record(&gpio->read_stats, start, -1, 1);
+		return -1;
+	}
+	stats_record(&gpio->read_stats, start, 1, 1);
+	return (str == '1') ? 1 : 0;
 }
 
 /*
  *  ======== gpio_edge ========
  */
 uint8_t gpio_edge(gpio_properties *gpio, char *edge) {
-	syslog (LOG_INFO, "gpio_edge(): GPIO %d set edge %s", gpio->nr, edge);
+	log_info("gpio_edge(): GPIO %d set edge %s", gpio->nr, edge);
 	FILE *fd;
 	char buf[MAX_BUF];
 
-	snprintf(buf, sizeof(buf), SYSFS_GPIO_DIR "/gpio%d/edge", gpio->nr);
+	if (strcmp(edge, "rising") == 0) {
+		gpio->edge = GPIO_EDGE_RISING;
+	} else if (strcmp(edge, "falling") == 0) {
+		gpio->edge = GPIO_EDGE_FALLING;
+	} else if (strcmp(edge, "both") == 0) {
+		gpio->edge = GPIO_EDGE_BOTH;
+	} else {
+		gpio->edge = GPIO_EDGE_NONE;
+	}
+
+	if (gpio->backend == GPIO_CDEV) {
+		return gpio_cdev_config(gpio->fd, gpio->direction, edge) ? 1 : 0;
+	}
+
+	snprintf(buf, sizeof(buf), "%s/gpio%d/edge", gpio_root, gpio->nr);
 
 	fd = fopen(buf, "w");
-	if (fd < 0) {
-		perror("gpio_edge(): set edge");
+	if (fd == NULL) {
+		log_err("gpio_edge(): set edge: %m");
 		return 1;
 	}
 
 	fputs(edge, fd);
 	fclose(fd);
+
+	/* Reading the value clears the event raised when the file was opened */
+	char str;
+	if (gpio->fd >= 0 && pread(gpio->fd, &str, 1, 0) != 1) {
+		log_err("gpio_edge(): clear event: %m");
+		return 1;
+	}
 	return 0;
 }
 
+/*
+ *  ======== gpio_read_event ========
+ */
+int gpio_read_event(gpio_properties *gpio, const struct timespec *now, gpio_event *event) {
+	return gpio_read_events(gpio, now, event, 1);
+}
+
+/*
+ *  ======== gpio_read_events ========
+ */
+int gpio_read_events(gpio_properties *gpio, const struct timespec *now, gpio_event *events,
+		int max) {
+	gpio_event *event = events;
+	char str;
+
+	if (gpio->backend == GPIO_CDEV) {
+		/* The kernel reports the offset of the line in its chip */
+		return gpio_cdev_read_events(gpio->fd, gpio->nr - gpio->nr % GPIO_BANK_PINS,
+				events, max);
+	}
+
+	if (pread(gpio->fd, &str, 1, 0) != 1) {
+		log_err("gpio_read_event(): get value: %m");
+		return -1;
+	}
+	event->nr = gpio->nr;
+	event->level = (str == '1') ? 1 : 0;
+	/* The level may already have changed back, a single edge is what fired */
+	if (gpio->edge == GPIO_EDGE_RISING || gpio->edge == GPIO_EDGE_FALLING) {
+		event->edge = gpio->edge;
+	} else {
+		event->edge = event->level ? GPIO_EDGE_RISING : GPIO_EDGE_FALLING;
+	}
+	event->timestamp = *now;
+	return 1;
+}
+
+/*
+ *  ======== gpio_wait_edge ========
+ */
+int gpio_wait_edge(gpio_properties *gpio, int timeout, gpio_event *event) {
+	struct pollfd pfd = { .fd = gpio->fd, .events = POLLPRI | POLLERR };
+	struct timespec now;
+	int ready;
+
+	if (gpio->backend == GPIO_CDEV) {
+		pfd.events = POLLIN;
+	}
+	ready = poll(&pfd, 1, timeout);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ready < 0) {
+		log_err("gpio_wait_edge(): poll: %m");
+		return -1;
+	}
+	if (ready == 0) {
+		return 0;
+	}
+	return gpio_read_event(gpio, &now, event);
+}
+
+/*
+ *  ======== gpio_poll_edge ========
+ */
+int gpio_poll_edge(gpio_properties *gpio, gpio_event *event) {
+	return gpio_wait_edge(gpio, 0, event);
+}
+
 /*
  *  ======== gpio_close ========
  */
 uint8_t gpio_close(gpio_properties *gpio) {
-	syslog (LOG_INFO, "gpio_close(): unexport GPIO %d", gpio->nr);
+	log_info("gpio_close(): unexport GPIO %d", gpio->nr);
 	FILE *fd;
-	fd = fopen(SYSFS_GPIO_DIR "/unexport", "w");
-	if (fd < 0) {
-		perror("gpio_close(): unexport");
+	char buf[MAX_BUF];
+
+	if (gpio->fd >= 0) {
+		close(gpio->fd);
+		gpio->fd = -1;
+	}
+	gpio->regs = NULL;
+
+	/* Lines requested through the character device need no unexport */
+	if (gpio->backend == GPIO_CDEV) {
+		return 0;
+	}
+
+	snprintf(buf, sizeof(buf), "%s/unexport", gpio_root);
+	fd = fopen(buf, "w");
+	if (fd == NULL) {
+		log_err("gpio_close(): unexport: %m");
 		return -1;
 	}
 	char str[15];
@@ -155,4 +496,249 @@ uint8_t gpio_close(gpio_properties *gpio) {
 	fclose(fd);
 
 	return 0;
-}
\ No newline at end of file
+}
+
+/*
+ *  ======== gpio_group_open_cdev ========
+ */
+static uint8_t gpio_group_open_cdev(gpio_group *group) {
+	gpio_cdev_lines lines;
+	int b;
+	int i;
+
+	for (b = 0; b < GPIO_BANKS; b++) {
+		if (group->banks[b].count == 0) {
+			continue;
+		}
+		lines.chip = b;
+		lines.count = group->banks[b].count;
+		lines.direction = group->direction;
+		for (i = 0; i < lines.count; i++) {
+			lines.offsets[i] = group->banks[b].bit[i];
+		}
+		if (gpio_cdev_request(&lines, NULL) != 0) {
+			while (b-- > 0) {
+				if (group->banks[b].fd >= 0) {
+					close(group->banks[b].fd);
+					group->banks[b].fd = -1;
+				}
+			}
+			return -1;
+		}
+		group->banks[b].fd = lines.fd;
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_group_open ========
+ */
+uint8_t gpio_group_open(gpio_group *group) {
+	int i;
+	int b;
+
+	if (group->count < 0 || group->count > GPIO_GROUP_MAX) {
+		log_err("gpio_group_open(): invalid count %d", group->count);
+		return -1;
+	}
+	memset(group->banks, 0, sizeof(group->banks));
+	for (b = 0; b < GPIO_BANKS; b++) {
+		group->banks[b].fd = -1;
+	}
+
+	for (i = 0; i < group->count; i++) {
+		gpio_properties *pin = &group->pins[i];
+		int j;
+
+		b = group->nr[i] / GPIO_BANK_PINS;
+		if (group->nr[i] < 0 || b >= GPIO_BANKS) {
+			log_err("gpio_group_open(): invalid GPIO %d", group->nr[i]);
+			errno = EINVAL;
+			return -1;
+		}
+		/* A pin listed twice would be opened and unexported twice */
+		for (j = 0; j < group->banks[b].count; j++) {
+			if (group->banks[b].bit[j] == group->nr[i] % GPIO_BANK_PINS) {
+				log_err("gpio_group_open(): GPIO %d listed twice", group->nr[i]);
+				errno = EINVAL;
+				return -1;
+			}
+		}
+		memset(pin, 0, sizeof(*pin));
+		pin->nr = group->nr[i];
+		pin->direction = group->direction;
+		pin->backend = group->backend;
+		pin->fd = -1;
+		group->banks[b].bit[group->banks[b].count] = pin->nr % GPIO_BANK_PINS;
+		group->banks[b].index[group->banks[b].count] = i;
+		group->banks[b].count++;
+	}
+
+	/* One line request per bank, the pins themselves are not opened */
+	if (group->backend == GPIO_CDEV) {
+		if (gpio_group_open_cdev(group) == 0) {
+			return 0;
+		}
+		log_err("gpio_group_open(): group falls back to sysfs");
+		group->backend = GPIO_SYSFS;
+		for (i = 0; i < group->count; i++) {
+			group->pins[i].backend = GPIO_SYSFS;
+		}
+	}
+
+	if (gpio_open_bulk(group->pins, group->count, NULL, NULL) != 0) {
+		for (i = 0; i < group->count; i++) {
+			if (group->pins[i].fd >= 0) {
+				gpio_close(&group->pins[i]);
+			}
+		}
+		return -1;
+	}
+
+	/* A bank is updated through its registers only if every pin has them */
+	for (b = 0; b < GPIO_BANKS; b++) {
+		if (group->banks[b].count == 0) {
+			continue;
+		}
+		group->banks[b].regs = group->pins[group->banks[b].index[0]].regs;
+		for (i = 0; i < group->banks[b].count; i++) {
+			if (group->pins[group->banks[b].index[i]].regs == NULL) {
+				group->banks[b].regs = NULL;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_group_write ========
+ */
+uint8_t gpio_group_write(gpio_group *group, uint64_t value, uint64_t mask) {
+	/* Mapped banks are not timed, like single pins */
+	int64_t start = group->backend == GPIO_MMAP ? 0 : stats_now();
+	int b;
+	int i;
+	uint8_t status = 0;
+
+	for (b = 0; b < GPIO_BANKS; b++) {
+		volatile uint32_t *regs = group->banks[b].regs;
+		uint32_t change = 0;
+		uint32_t set = 0;
+
+		for (i = 0; i < group->banks[b].count; i++) {
+			uint64_t sel = (uint64_t)1 << group->banks[b].index[i];
+
+			if ((mask & sel) == 0) {
+				continue;
+			}
+			/* Line requests number the pins in bank order, registers by bit */
+			if (group->banks[b].fd >= 0) {
+				change |= 1u << i;
+				if (value & sel) {
+					set |= 1u << i;
+				}
+				continue;
+			}
+			if (regs == NULL) {
+				status |= gpio_write(&group->pins[group->banks[b].index[i]],
+						(value & sel) != 0);
+				continue;
+			}
+			change |= 1u << group->banks[b].bit[i];
+			if (value & sel) {
+				set |= 1u << group->banks[b].bit[i];
+			}
+		}
+		if (change == 0) {
+			continue;
+		}
+		if (group->banks[b].fd >= 0) {
+			status |= gpio_cdev_set_values(group->banks[b].fd, set, change);
+		} else {
+			regs[GPIO_DATAOUT / 4] = (regs[GPIO_DATAOUT / 4] & ~change) | set;
+		}
+	}
+	stats_record(&group->write_stats, start, status ? -1 : group->count, group->count);
+	return status ? -1 : 0;
+}
+
+/*
+ *  ======== gpio_group_read ========
+ */
+uint8_t gpio_group_read(gpio_group *group, uint64_t *value) {
+	/* Mapped banks are not timed, like single pins */
+	int64_t start = group->backend == GPIO_MMAP ? 0 : stats_now();
+	int b;
+	int i;
+	uint64_t result = 0;
+
+	for (b = 0; b < GPIO_BANKS; b++) {
+		uint32_t level = 0;
+
+		if (group->banks[b].count == 0) {
+			continue;
+		}
+		if (group->banks[b].fd >= 0) {
+			uint64_t bits;
+
+			if (gpio_cdev_get_values(group->banks[b].fd,
+					((uint64_t)1 << group->banks[b].count) - 1, &bits) != 0) {
+				stats_record(&group->read_stats, start, -1, group->count);
+				return -1;
+			}
+			for (i = 0; i < group->banks[b].count; i++) {
+				if (bits & ((uint64_t)1 << i)) {
+					result |= (uint64_t)1 << group->banks[b].index[i];
+				}
+			}
+			continue;
+		}
+		if (group->banks[b].regs != NULL) {
+			level = gpio_mmap_read(group->banks[b].regs);
+		} else {
+			for (i = 0; i < group->banks[b].count; i++) {
+				uint8_t pin = gpio_read(&group->pins[group->banks[b].index[i]]);
+
+				if (pin > 1) {
+					stats_record(&group->read_stats, start, -1, group->count);
+					return -1;
+				}
+				level |= (uint32_t)pin << group->banks[b].bit[i];
+			}
+		}
+		for (i = 0; i < group->banks[b].count; i++) {
+			if (level & (1u << group->banks[b].bit[i])) {
+				result |= (uint64_t)1 << group->banks[b].index[i];
+			}
+		}
+	}
+	*value = result;
+	stats_record(&group->read_stats, start, group->count, group->count);
+	return 0;
+}
+
+/*
+ *  ======== gpio_group_close ========
+ */
+uint8_t gpio_group_close(gpio_group *group) {
+	int i;
+	int b;
+	uint8_t status = 0;
+
+	if (group->backend == GPIO_CDEV) {
+		for (b = 0; b < GPIO_BANKS; b++) {
+			if (group->banks[b].fd >= 0) {
+				close(group->banks[b].fd);
+			}
+		}
+	} else {
+		for (i = 0; i < group->count; i++) {
+			status |= gpio_close(&group->pins[i]);
+		}
+	}
+	memset(group->banks, 0, sizeof(group->banks));
+	for (b = 0; b < GPIO_BANKS; b++) {
+		group->banks[b].fd = -1;
+	}
+	return status ? -1 : 0;
+}
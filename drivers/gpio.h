@@ -44,9 +44,10 @@
  *
  *  main()
  *  {
- *      gpio_properties *gpio = malloc(sizeof(gpio_properties));
+ *      gpio_properties *gpio = calloc(1, sizeof(gpio_properties));
  *	    gpio->nr = LEDGPIO;
  *	    gpio->direction = OUTPUT_PIN;
+ *	    gpio->backend = GPIO_MMAP;
  *
  *	    int isOpen = gpio_open(gpio);
  *
@@ -71,11 +72,21 @@
 #ifndef __GPIO_H_
 #define __GPIO_H_
 
+#include <stdint.h>
+#include <time.h>
+#include "stats.h"
+#include "uring.h"
+
 /*!
  *  @brief      GPIO file location 
  */
 #define SYSFS_GPIO_DIR "/sys/class/gpio"
-#define MAX_BUF 64
+#define MAX_BUF 256
+
+/*!
+ *  @brief      Milliseconds to wait for exported pins to become usable
+ */
+#define GPIO_EXPORT_TIMEOUT 2000
 
 /*!
  *  @brief      PIN direction
@@ -85,19 +96,125 @@ typedef enum {
 	OUTPUT_PIN=1
 } PIN_DIRECTION;
 
+/*!
+ *  @brief      GPIO access method
+ *
+ *  GPIO_MMAP drives the pin through the memory mapped bank registers, see
+ *  gpio_mmap.h. GPIO_CDEV uses the GPIO character device, see gpio_cdev.h.
+ *  If the selected backend is not available gpio_open() falls back to
+ *  GPIO_SYSFS.
+ */
+typedef enum {
+	GPIO_SYSFS=0,
+	GPIO_MMAP=1,
+	GPIO_CDEV=2
+} GPIO_BACKEND;
+
+/*!
+ *  @brief      Edge reported by an event, or configured with gpio_edge()
+ */
+typedef enum {
+	GPIO_EDGE_NONE=0,
+	GPIO_EDGE_RISING=1,
+	GPIO_EDGE_FALLING=2,
+	GPIO_EDGE_BOTH=3		/*!< @brief configuration only, never reported */
+} GPIO_EDGE;
+
+/*!
+ *  @brief      GPIO event structure type definition
+ */
+typedef struct {
+	int nr;						/*!< @brief GPIO that produced the event */
+	uint8_t level;				/*!< @brief level read after the edge */
+	GPIO_EDGE edge;
+	struct timespec timestamp;	/*!< @brief CLOCK_MONOTONIC time of the wakeup */
+} gpio_event;
+
 /*!
  *  @brief      GPIO properties structure type definition
  */
 typedef struct {
 	int nr;
 	PIN_DIRECTION direction;
+	GPIO_BACKEND backend;	/*!< @brief access method, GPIO_SYSFS if unsure */
+	int fd;					/*!< @brief value file or line request, kept open by gpio_open() */
+	volatile uint32_t *regs;	/*!< @brief bank registers, GPIO_MMAP only */
+	uint32_t mask;			/*!< @brief bit of the pin inside its bank */
+	GPIO_EDGE edge;			/*!< @brief set by gpio_edge(), kept by the driver */
+	uint32_t stable_us;		/*!< @brief debounce time, see gpio_filter.h */
+	uint32_t min_pulse_us;	/*!< @brief shortest valid pulse, see gpio_filter.h */
+	stats_op write_stats;	/*!< @brief gpio_write() calls, see stats.h */
+	stats_op read_stats;	/*!< @brief gpio_read() calls */
 } gpio_properties;
 
+/*!
+ *  @brief      Result of opening one pin with gpio_open_bulk()
+ */
+typedef struct {
+	uint8_t exported;		/*!< @brief the pin was exported by this call */
+	uint8_t configured;		/*!< @brief the direction was written by this call */
+	int error;				/*!< @brief errno of the failed step, 0 on success */
+} gpio_open_status;
+
+/*!
+ *  @brief      GPIO banks of the AM335x and the pins in each one
+ */
+#define GPIO_BANKS 4
+#define GPIO_BANK_PINS 32
+
+/*!
+ *  @brief      Maximum number of pins in a GPIO group
+ */
+#define GPIO_GROUP_MAX 64
+
+/*!
+ *  @brief      GPIO group structure type definition
+ *
+ *  A group drives several pins as one value. Bit i of the values passed to
+ *  gpio_group_write() and returned by gpio_group_read() belongs to pin
+ *  nr[i]. The caller fills in count, nr, direction and backend, the rest
+ *  is set up by gpio_group_open().
+ */
+typedef struct {
+	int count;						/*!< @brief number of pins in nr */
+	int nr[GPIO_GROUP_MAX];			/*!< @brief pin numbers */
+	PIN_DIRECTION direction;
+	GPIO_BACKEND backend;
+	gpio_properties pins[GPIO_GROUP_MAX];
+	struct {
+		volatile uint32_t *regs;	/*!< @brief bank registers, GPIO_MMAP only */
+		int fd;						/*!< @brief line request, GPIO_CDEV only */
+		int count;					/*!< @brief group pins in this bank */
+		uint8_t bit[GPIO_BANK_PINS];	/*!< @brief bank bit of each pin */
+		uint8_t index[GPIO_BANK_PINS];	/*!< @brief group bit of each pin */
+	} banks[GPIO_BANKS];
+	stats_op write_stats;			/*!< @brief gpio_group_write() calls */
+	stats_op read_stats;			/*!< @brief gpio_group_read() calls */
+} gpio_group;
+
+/*!
+ *  @brief  Sets the root of the sysfs GPIO tree
+ *
+ *  By default the driver works on SYSFS_GPIO_DIR. Any other directory with
+ *  the same layout (export, unexport and gpioN/{direction,value,edge}) can be
+ *  used instead, which allows running the driver against a fake tree.
+ *
+ *  @param  root    Directory to use, NULL restores SYSFS_GPIO_DIR
+ */
+extern void gpio_set_root(const char *root);
+
 /*!
  *  @brief  Function to initialize a given GPIO peripheral
  *
  *  Function to initialize a given GPIO peripheral specified by the
- *  gpio_properties structure.
+ *  gpio_properties structure. The value file of the GPIO is opened once
+ *  and kept in gpio_properties.fd until gpio_close() is called.
+ *
+ *  When gpio_properties.backend is GPIO_MMAP the bank registers are mapped
+ *  as well. If that fails the backend is changed to GPIO_SYSFS.
+ *
+ *  A pin that is already exported is reused, and the direction is only
+ *  written when it differs, see gpio_open_bulk().
  *
  *  @param  gpio    A gpio_properties structure 
  *
@@ -105,6 +222,26 @@ typedef struct {
  */
 extern uint8_t gpio_open(gpio_properties *gpio);
 
+/*!
+ *  @brief  Function to initialize a table of GPIOs
+ *
+ *  Pins that are already exported are reused. The missing ones are
+ *  exported back to back, followed by a single wait of up to
+ *  GPIO_EXPORT_TIMEOUT for all their directories to appear. Files that udev
+ *  has not made accessible yet are retried within the same time. The
+ *  direction is only written when it differs from the requested one, so an
+ *  output keeps its level across restarts.
+ *
+ *  @param  gpios   Table of gpio_properties structures
+ *  @param  count   Number of entries in \a gpios
+ *  @param  status  Receives the result of every pin, may be NULL
+ *  @param  elapsed Receives the total bring-up time, may be NULL
+ *
+ *  @return Returns if an error ocurred, 0 means every pin was opened
+ */
+extern uint8_t gpio_open_bulk(gpio_properties *gpios, int count, gpio_open_status *status,
+		struct timespec *elapsed);
+
 /*!
  *  @brief  Writes the value to a GPIO
  *
@@ -117,6 +254,27 @@ extern uint8_t gpio_open(gpio_properties *gpio);
  */
 extern uint8_t gpio_write(gpio_properties *gpio, int value);
 
+/*!
+ *  @brief  Queues a write of the value of a GPIO on a uring
+ *
+ *  With GPIO_SYSFS the value file is written at the next uring_submit(),
+ *  batched with the other queued operations. The other backends have no
+ *  file to write, the pin is written right away and only the completion
+ *  goes through the uring.
+ *
+ *  @pre    gpio_open()
+ *
+ *  @param  u       A uring structure
+ *  @param  gpio    A gpio_properties structure
+ *  @param  value   must be either 0 or 1
+ *  @param  fxn     Completion callback, can be NULL
+ *  @param  arg     Passed to fxn
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_uring_write(uring *u, gpio_properties *gpio, int value,
+		uring_fxn fxn, void *arg);
+
 /*!
  *  @brief  Reads the value of a GPIO
  *
@@ -140,6 +298,72 @@ extern uint8_t gpio_read(gpio_properties *gpio);
  */
 extern uint8_t gpio_edge(gpio_properties *gpio, char *edge);
 
+/*!
+ *  @brief  Waits for the edge configured with gpio_edge()
+ *
+ *  Blocks in poll() on the value file until the kernel reports an edge, so
+ *  no CPU is used while waiting. The timestamp is taken right after poll()
+ *  returns, or by the kernel with GPIO_CDEV. A pin set to "rising" or
+ *  "falling" always reports that edge. With "both" the edge is derived from
+ *  the level read after the wakeup, so a pulse shorter than the wakeup
+ *  latency is reported as the edge that ended it.
+ *
+ *  @pre    gpio_edge()
+ *
+ *  @param  gpio    A gpio_properties structure
+ *  @param  timeout Milliseconds to wait, -1 waits forever
+ *  @param  event   Receives the event
+ *
+ *  @return Returns 1 if an edge was received, 0 on timeout and -1 if an
+ *          error ocurred
+ */
+extern int gpio_wait_edge(gpio_properties *gpio, int timeout, gpio_event *event);
+
+/*!
+ *  @brief  Reads the edge that made a GPIO descriptor ready
+ *
+ *  Used after the descriptor was reported ready by poll() or epoll, for
+ *  POLLPRI with GPIO_SYSFS and POLLIN with GPIO_CDEV. With GPIO_CDEV the
+ *  timestamp is the one taken by the kernel, otherwise it is \a now.
+ *
+ *  @param  gpio    A gpio_properties structure
+ *  @param  now     Time of the wakeup
+ *  @param  event   Receives the event
+ *
+ *  @return Returns 1 if an edge was read, -1 if an error ocurred
+ */
+extern int gpio_read_event(gpio_properties *gpio, const struct timespec *now, gpio_event *event);
+
+/*!
+ *  @brief  Reads the edges that made a GPIO descriptor ready
+ *
+ *  Same as gpio_read_event(), but with GPIO_CDEV drains up to \a max
+ *  queued edges in one read(), at most GPIO_CDEV_EVENTS. GPIO_SYSFS only
+ *  has the current level and always returns one edge.
+ *
+ *  @param  gpio    A gpio_properties structure
+ *  @param  now     Time of the wakeup
+ *  @param  events  Receives the edges, oldest first
+ *  @param  max     Size of \a events
+ *
+ *  @return Returns the number of edges read, -1 if an error ocurred
+ */
+extern int gpio_read_events(gpio_properties *gpio, const struct timespec *now, gpio_event *events,
+		int max);
+
+/*!
+ *  @brief  Checks for a pending edge without blocking
+ *
+ *  @pre    gpio_edge()
+ *
+ *  @param  gpio    A gpio_properties structure
+ *  @param  event   Receives the event
+ *
+ *  @return Returns 1 if an edge was pending, 0 if not and -1 if an error
+ *          ocurred
+ */
+extern int gpio_poll_edge(gpio_properties *gpio, gpio_event *event);
+
 /*!
  *  @brief  Function to close a given GPIO peripheral
  *
@@ -151,4 +375,60 @@ extern uint8_t gpio_edge(gpio_properties *gpio, char *edge);
  */
 extern uint8_t gpio_close(gpio_properties *gpio);
 
+/*!
+ *  @brief  Function to initialize a group of GPIOs
+ *
+ *  The pins are sorted by bank so that each bank is updated with a single
+ *  operation. With GPIO_CDEV every bank is requested as one set of lines,
+ *  otherwise every pin is opened with gpio_open().
+ *
+ *  @param  group   A gpio_group structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_group_open(gpio_group *group);
+
+/*!
+ *  @brief  Writes a value to the pins of a group
+ *
+ *  Only the pins whose bit is set in \a mask are changed. With the
+ *  GPIO_MMAP backend all the selected pins of a bank change in the same
+ *  store to the DATAOUT register. That store is a read-modify-write, so
+ *  other pins of the same bank must not be written from another thread at
+ *  the same time. With GPIO_CDEV each bank is written with one ioctl.
+ *  With GPIO_SYSFS the pins are written one by one.
+ *
+ *  @pre    gpio_group_open()
+ *
+ *  @param  group   A gpio_group structure
+ *  @param  value   Bit i is the level of pin nr[i]
+ *  @param  mask    Bit i selects pin nr[i]
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_group_write(gpio_group *group, uint64_t value, uint64_t mask);
+
+/*!
+ *  @brief  Reads the pins of a group
+ *
+ *  @pre    gpio_group_open()
+ *
+ *  @param  group   A gpio_group structure
+ *  @param  value   Bit i receives the level of pin nr[i]
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_group_read(gpio_group *group, uint64_t *value);
+
+/*!
+ *  @brief  Function to close a group of GPIOs
+ *
+ *  @pre    gpio_group_open()
+ *
+ *  @param  group   A gpio_group structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_group_close(gpio_group *group);
+
 #endif /* GPIO_H_ */
\ No newline at end of file
@@ -0,0 +1,202 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       gpio_cdev.c 
+ *	@brief      GPIO character device backend
+ *	@author     Maximiliano Valencia
+ *	@date       4/11/2018
+ */
+
+#include <sys/ioctl.h>
+/* GPIO Driver Header File */
+#include "driver.h"
+#include "gpio_cdev.h"
+
+static char cdev_root[MAX_BUF / 2] = GPIO_CDEV_DIR;
+
+/*
+ *  ======== cdev_ioctl_default ========
+ */
+static int cdev_ioctl_default(int fd, unsigned long request, void *arg) {
+	return ioctl(fd, request, arg);
+}
+
+static gpio_cdev_ioctl_fxn cdev_ioctl = cdev_ioctl_default;
+
+/*
+ *  ======== cdev_flags ========
+ */
+static uint64_t cdev_flags(PIN_DIRECTION direction, const char *edge) {
+	if (direction == OUTPUT_PIN) {
+		return GPIO_V2_LINE_FLAG_OUTPUT;
+	}
+	if (edge == NULL) {
+		return GPIO_V2_LINE_FLAG_INPUT;
+	}
+	if (strcmp(edge, "rising") == 0) {
+		return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+	}
+	if (strcmp(edge, "falling") == 0) {
+		return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	}
+	if (strcmp(edge, "both") == 0) {
+		return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+				GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	}
+	return GPIO_V2_LINE_FLAG_INPUT;
+}
+
+/*
+ *  ======== gpio_cdev_set_root ========
+ */
+void gpio_cdev_set_root(const char *root) {
+	if (root == NULL) {
+		root = GPIO_CDEV_DIR;
+	}
+	snprintf(cdev_root, sizeof(cdev_root), "%s", root);
+}
+
+/*
+ *  ======== gpio_cdev_set_ioctl ========
+ */
+void gpio_cdev_set_ioctl(gpio_cdev_ioctl_fxn fxn) {
+	cdev_ioctl = (fxn != NULL) ? fxn : cdev_ioctl_default;
+}
+
+/*
+ *  ======== gpio_cdev_request ========
+ */
+uint8_t gpio_cdev_request(gpio_cdev_lines *lines, const char *edge) {
+	struct gpio_v2_line_request req;
+	char buf[MAX_BUF];
+	int chip;
+
+	lines->fd = -1;
+	if (lines->count <= 0 || lines->count > GPIO_V2_LINES_MAX) {
+		log_err("gpio_cdev_request(): invalid count %d", lines->count);
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	memcpy(req.offsets, lines->offsets, lines->count * sizeof(uint32_t));
+	snprintf(req.consumer, sizeof(req.consumer), "%s", GPIO_CDEV_CONSUMER);
+	req.config.flags = cdev_flags(lines->direction, edge);
+	req.num_lines = lines->count;
+
+	snprintf(buf, sizeof(buf), "%s/gpiochip%d", cdev_root, lines->chip);
+	chip = open(buf, O_RDWR | O_CLOEXEC);
+	if (chip < 0) {
+		log_err("gpio_cdev_request(): could not open %s: %m", buf);
+		return -1;
+	}
+	/* The request descriptor stays valid after the chip is closed */
+	if (cdev_ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+		log_err("gpio_cdev_request(): could not request %d lines of %s: %m",
+				lines->count, buf);
+		close(chip);
+		return -1;
+	}
+	close(chip);
+	lines->fd = req.fd;
+	return 0;
+}
+
+/*
+ *  ======== gpio_cdev_config ========
+ */
+uint8_t gpio_cdev_config(int fd, PIN_DIRECTION direction, const char *edge) {
+	struct gpio_v2_line_config config;
+
+	memset(&config, 0, sizeof(config));
+	config.flags = cdev_flags(direction, edge);
+	if (cdev_ioctl(fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) {
+		log_err("gpio_cdev_config(): GPIO_V2_LINE_SET_CONFIG_IOCTL: %m");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_cdev_set_values ========
+ */
+uint8_t gpio_cdev_set_values(int fd, uint64_t bits, uint64_t mask) {
+	struct gpio_v2_line_values values = { .bits = bits, .mask = mask };
+
+	if (cdev_ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+		log_err("gpio_cdev_set_values(): GPIO_V2_LINE_SET_VALUES_IOCTL: %m");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_cdev_get_values ========
+ */
+uint8_t gpio_cdev_get_values(int fd, uint64_t mask, uint64_t *bits) {
+	struct gpio_v2_line_values values = { .bits = 0, .mask = mask };
+
+	if (cdev_ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+		log_err("gpio_cdev_get_values(): GPIO_V2_LINE_GET_VALUES_IOCTL: %m");
+		return -1;
+	}
+	*bits = values.bits & mask;
+	return 0;
+}
+
+/*
+ *  ======== gpio_cdev_read_events ========
+ */
+int gpio_cdev_read_events(int fd, int base, gpio_event *events, int max) {
+	struct gpio_v2_line_event raw[GPIO_CDEV_EVENTS];
+	ssize_t size;
+	int count;
+	int i;
+
+	if (max > GPIO_CDEV_EVENTS) {
+		max = GPIO_CDEV_EVENTS;
+	}
+	size = read(fd, raw, max * sizeof(raw[0]));
+	if (size < 0) {
+		log_err("gpio_cdev_read_events(): read: %m");
+		return -1;
+	}
+
+	count = size / sizeof(raw[0]);
+	for (i = 0; i < count; i++) {
+		events[i].nr = base + raw[i].offset;
+		events[i].edge = (raw[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ?
+				GPIO_EDGE_RISING : GPIO_EDGE_FALLING;
+		events[i].level = (events[i].edge == GPIO_EDGE_RISING) ? 1 : 0;
+		events[i].timestamp.tv_sec = raw[i].timestamp_ns / 1000000000ull;
+		events[i].timestamp.tv_nsec = raw[i].timestamp_ns % 1000000000ull;
+	}
+	return count;
+}
+
+/*
+ *  ======== gpio_cdev_release ========
+ */
+uint8_t gpio_cdev_release(gpio_cdev_lines *lines) {
+	if (lines->fd >= 0) {
+		close(lines->fd);
+		lines->fd = -1;
+	}
+	return 0;
+}
@@ -0,0 +1,185 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       gpio_cdev.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/11/2018
+ *  @brief      GPIO character device backend
+ *
+ *  # Overview #
+ *  The GPIO character device (/dev/gpiochipN) replaces the deprecated sysfs
+ *  interface. Many lines of a chip are requested with a single
+ *  GPIO_V2_GET_LINE_IOCTL and the kernel returns one file descriptor for
+ *  all of them. The lines are read and written together with
+ *  GPIO_V2_LINE_GET_VALUES_IOCTL and GPIO_V2_LINE_SET_VALUES_IOCTL, and edge
+ *  events carrying a kernel timestamp are read from the same descriptor.
+ *
+ *  Pin number nr is line nr % 32 of gpiochip(nr / 32), which matches the
+ *  AM335x banks on the BeagleBone kernels.
+ *
+ *  The GPIO driver uses this module when gpio_properties.backend is
+ *  GPIO_CDEV. Bit i of the values handled here belongs to offsets[i].
+ *
+ *  ### Testing without a gpiochip #
+ *
+ *  gpio_cdev_set_root() changes the directory of the gpiochipN files and
+ *  gpio_cdev_set_ioctl() replaces the ioctl() used on them. A replacement
+ *  that hands out one end of a pipe as the request descriptor lets edges be
+ *  injected by writing gpio_v2_line_event records to the other end:
+ *
+ *  @code
+ *  static int edges[2];
+ *
+ *  static int fake_ioctl(int fd, unsigned long request, void *arg) {
+ *      if (request == GPIO_V2_GET_LINE_IOCTL) {
+ *          ((struct gpio_v2_line_request *)arg)->fd = edges[0];
+ *      }
+ *      return 0;	// line configuration and values are accepted as is
+ *  }
+ *
+ *  struct gpio_v2_line_event event = { .timestamp_ns = 1000,
+ *          .id = GPIO_V2_LINE_EVENT_RISING_EDGE, .offset = 17 };
+ *  gpio_properties button = { .nr = 49, .direction = INPUT_PIN,
+ *          .backend = GPIO_CDEV };
+ *
+ *  pipe(edges);
+ *  gpio_cdev_set_root("/tmp/chips");		// holds an empty gpiochip1 file
+ *  gpio_cdev_set_ioctl(fake_ioctl);
+ *  gpio_open(&button);
+ *  gpio_edge(&button, "both");
+ *  write(edges[1], &event, sizeof(event));	// GPIO 49 rises
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __GPIO_CDEV_H_
+#define __GPIO_CDEV_H_
+
+#include <linux/gpio.h>
+#include "gpio.h"
+
+/*!
+ *  @brief      GPIO character devices location
+ */
+#define GPIO_CDEV_DIR "/dev"
+
+/*!
+ *  @brief      Consumer label shown by the kernel for the requested lines
+ */
+#define GPIO_CDEV_CONSUMER "bbdl"
+
+/*!
+ *  @brief      Events read from the kernel in one call by gpio_cdev_read_events()
+ */
+#define GPIO_CDEV_EVENTS 16
+
+/*!
+ *  @brief      ioctl() replacement, see gpio_cdev_set_ioctl()
+ */
+typedef int (*gpio_cdev_ioctl_fxn)(int fd, unsigned long request, void *arg);
+
+/*!
+ *  @brief      Line request structure type definition
+ *
+ *  The caller fills in chip, count, offsets and direction before calling
+ *  gpio_cdev_request().
+ */
+typedef struct {
+	int chip;							/*!< @brief gpiochip number */
+	int count;							/*!< @brief number of lines */
+	uint32_t offsets[GPIO_V2_LINES_MAX];	/*!< @brief lines inside the chip */
+	PIN_DIRECTION direction;
+	int fd;								/*!< @brief request descriptor */
+} gpio_cdev_lines;
+
+/*!
+ *  @brief  Sets the directory of the gpiochipN files
+ *
+ *  @param  root    Directory to use, NULL restores GPIO_CDEV_DIR
+ */
+extern void gpio_cdev_set_root(const char *root);
+
+/*!
+ *  @brief  Replaces the ioctl() issued on the character devices
+ *
+ *  @param  fxn     Replacement, NULL restores ioctl()
+ */
+extern void gpio_cdev_set_ioctl(gpio_cdev_ioctl_fxn fxn);
+
+/*!
+ *  @brief  Requests all the lines in a single call
+ *
+ *  @param  lines   A gpio_cdev_lines structure
+ *  @param  edge    "rising", "falling", "both", or NULL for no events
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_cdev_request(gpio_cdev_lines *lines, const char *edge);
+
+/*!
+ *  @brief  Changes the edge that produces events on requested lines
+ *
+ *  @param  fd          Request descriptor
+ *  @param  direction   Direction of the lines
+ *  @param  edge        "rising", "falling", "both", "none" or NULL
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_cdev_config(int fd, PIN_DIRECTION direction, const char *edge);
+
+/*!
+ *  @brief  Writes the lines selected by \a mask with one ioctl
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_cdev_set_values(int fd, uint64_t bits, uint64_t mask);
+
+/*!
+ *  @brief  Reads the lines selected by \a mask with one ioctl
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_cdev_get_values(int fd, uint64_t mask, uint64_t *bits);
+
+/*!
+ *  @brief  Reads the pending edge events in one batch
+ *
+ *  Blocks if no event is pending, so the descriptor is normally polled for
+ *  POLLIN first. The timestamps are taken by the kernel when the edge was
+ *  detected.
+ *
+ *  @param  fd      Request descriptor
+ *  @param  base    Pin number of line 0 of the chip, that is chip * 32
+ *  @param  events  Receives the events
+ *  @param  max     Size of \a events, at most GPIO_CDEV_EVENTS are read
+ *
+ *  @return Returns the number of events read, -1 if an error ocurred
+ */
+extern int gpio_cdev_read_events(int fd, int base, gpio_event *events, int max);
+
+/*!
+ *  @brief  Releases requested lines
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_cdev_release(gpio_cdev_lines *lines);
+
+#endif /* __GPIO_CDEV_H_ */
@@ -0,0 +1,329 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       gpio_dispatch.c 
+ *	@brief      GPIO interrupt dispatcher
+ *	@author     Maximiliano Valencia
+ *	@date       4/11/2018
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+/* GPIO Driver Header File */
+#include "driver.h"
+#include "gpio_dispatch.h"
+#include "gpio_cdev.h"
+
+/*
+ *  ======== gpio_dispatch_open ========
+ */
+uint8_t gpio_dispatch_open(gpio_dispatcher *dispatcher, int capacity, int budget) {
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+	memset(dispatcher, 0, sizeof(*dispatcher));
+	dispatcher->capacity = capacity;
+	dispatcher->budget = (budget > 0 && budget < capacity) ? budget : capacity;
+	dispatcher->epfd = -1;
+	dispatcher->stopfd = -1;
+
+	dispatcher->pins = calloc(capacity, sizeof(gpio_dispatch_pin));
+	dispatcher->ready = calloc(dispatcher->budget, sizeof(struct epoll_event));
+	/* Room for the filter output of every read edge plus every pending level */
+	dispatcher->batch = calloc(dispatcher->budget * GPIO_CDEV_EVENTS * GPIO_FILTER_OUT + capacity,
+			sizeof(gpio_event));
+	dispatcher->owner = calloc(dispatcher->budget * GPIO_CDEV_EVENTS * GPIO_FILTER_OUT + capacity,
+			sizeof(gpio_dispatch_pin *));
+	if (dispatcher->pins == NULL || dispatcher->ready == NULL ||
+			dispatcher->batch == NULL || dispatcher->owner == NULL) {
+		log_err("gpio_dispatch_open(): out of memory");
+		gpio_dispatch_close(dispatcher);
+		return -1;
+	}
+
+	dispatcher->epfd = epoll_create1(EPOLL_CLOEXEC);
+	dispatcher->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (dispatcher->epfd < 0 || dispatcher->stopfd < 0 ||
+			epoll_ctl(dispatcher->epfd, EPOLL_CTL_ADD, dispatcher->stopfd, &ev) < 0) {
+		log_err("gpio_dispatch_open(): epoll: %m");
+		gpio_dispatch_close(dispatcher);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_dispatch_add ========
+ */
+uint8_t gpio_dispatch_add(gpio_dispatcher *dispatcher, gpio_properties *gpio,
+		char *edge, gpio_dispatch_fxn fxn, void *arg) {
+	struct epoll_event ev;
+	gpio_dispatch_pin *pin = NULL;
+	int i;
+
+	for (i = 0; i < dispatcher->capacity; i++) {
+		if (dispatcher->pins[i].gpio == NULL) {
+			pin = &dispatcher->pins[i];
+			break;
+		}
+	}
+	if (pin == NULL) {
+		log_err("gpio_dispatch_add(): no room for GPIO %d", gpio->nr);
+		return -1;
+	}
+	if (gpio_edge(gpio, edge) != 0) {
+		return -1;
+	}
+
+	memset(pin, 0, sizeof(*pin));
+	pin->fxn = fxn;
+	pin->arg = arg;
+	if (gpio->stable_us != 0 || gpio->min_pulse_us != 0) {
+		uint8_t level = gpio_read(gpio);
+
+		gpio_filter_init(&pin->filter, gpio, level == 1 ? 1 : 0);
+		pin->filtered = 1;
+	}
+	ev.events = (gpio->backend == GPIO_CDEV) ? EPOLLIN : EPOLLPRI;
+	ev.data.ptr = pin;
+	if (epoll_ctl(dispatcher->epfd, EPOLL_CTL_ADD, gpio->fd, &ev) < 0) {
+		log_err("gpio_dispatch_add(): epoll_ctl: %m");
+		return -1;
+	}
+	pin->gpio = gpio;
+	dispatcher->count++;
+	dispatcher->filtered += pin->filtered;
+	return 0;
+}
+
+/*
+ *  ======== gpio_dispatch_remove ========
+ */
+uint8_t gpio_dispatch_remove(gpio_dispatcher *dispatcher, gpio_properties *gpio) {
+	int i;
+
+	for (i = 0; i < dispatcher->capacity; i++) {
+		if (dispatcher->pins[i].gpio == gpio) {
+			epoll_ctl(dispatcher->epfd, EPOLL_CTL_DEL, gpio->fd, NULL);
+			dispatcher->pins[i].gpio = NULL;
+			dispatcher->count--;
+			dispatcher->filtered -= dispatcher->pins[i].filtered;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ *  ======== gpio_dispatch_set_ring ========
+ */
+void gpio_dispatch_set_ring(gpio_dispatcher *dispatcher, ring *events) {
+	dispatcher->events = events;
+}
+
+/*
+ *  ======== gpio_dispatch_pin_stats ========
+ */
+const gpio_dispatch_pin *gpio_dispatch_pin_stats(gpio_dispatcher *dispatcher,
+		gpio_properties *gpio) {
+	int i;
+
+	for (i = 0; i < dispatcher->capacity; i++) {
+		if (dispatcher->pins[i].gpio == gpio) {
+			return &dispatcher->pins[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ *  ======== dispatch_timeout ========
+ */
+/* Shortens the wait to the first filtered level that becomes stable */
+static int dispatch_timeout(gpio_dispatcher *dispatcher, int timeout) {
+	struct timespec now;
+	int64_t first = -1;
+	int64_t wait;
+	int i;
+
+	if (dispatcher->filtered == 0) {
+		return timeout;
+	}
+	for (i = 0; i < dispatcher->capacity; i++) {
+		gpio_dispatch_pin *pin = &dispatcher->pins[i];
+		int64_t deadline;
+
+		if (pin->gpio == NULL || !pin->filtered) {
+			continue;
+		}
+		deadline = gpio_filter_deadline(&pin->filter);
+		if (deadline >= 0 && (first < 0 || deadline < first)) {
+			first = deadline;
+		}
+	}
+	if (first < 0) {
+		return timeout;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wait = first - ((int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+	wait = (wait > 0) ? (wait + 999999) / 1000000 : 0;
+	if (timeout < 0 || wait < timeout) {
+		return (int)wait;
+	}
+	return timeout;
+}
+
+/*
+ *  ======== gpio_dispatch_once ========
+ */
+int gpio_dispatch_once(gpio_dispatcher *dispatcher, int timeout) {
+	struct epoll_event *ready = dispatcher->ready;
+	gpio_event *batch = dispatcher->batch;
+	gpio_dispatch_pin **owner = dispatcher->owner;
+	struct timespec now;
+	gpio_event raw[GPIO_CDEV_EVENTS];
+	uint64_t stop;
+	int count = 0;
+	int n;
+	int i;
+
+	n = epoll_wait(dispatcher->epfd, ready, dispatcher->budget,
+			dispatch_timeout(dispatcher, timeout));
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		log_err("gpio_dispatch_once(): epoll_wait: %m");
+		return -1;
+	}
+	if (n > 0) {
+		dispatcher->wakeups++;
+	}
+
+	/* Read every pin first so that the whole batch carries one timestamp */
+	for (i = 0; i < n; i++) {
+		gpio_dispatch_pin *pin = ready[i].data.ptr;
+		int accepted;
+		int edges;
+		int j;
+
+		if (pin == NULL) {
+			if (read(dispatcher->stopfd, &stop, sizeof(stop)) < 0) {
+				/* Already drained by a previous wakeup */
+			}
+			continue;
+		}
+		/* Every edge queued by the kernel, not one per wakeup */
+		edges = gpio_read_events(pin->gpio, &now, raw, GPIO_CDEV_EVENTS);
+		if (edges <= 0) {
+			log_err("gpio_dispatch_once(): could not read GPIO %d", pin->gpio->nr);
+			continue;
+		}
+		pin->raw += edges;
+		for (j = 0; j < edges; j++) {
+			if (!pin->filtered) {
+				batch[count] = raw[j];
+				owner[count++] = pin;
+				continue;
+			}
+			accepted = gpio_filter_feed(&pin->filter, &raw[j], &batch[count]);
+			while (accepted-- > 0) {
+				owner[count++] = pin;
+			}
+		}
+	}
+
+	/* Levels that became stable while waiting */
+	for (i = 0; dispatcher->filtered > 0 && i < dispatcher->capacity; i++) {
+		gpio_dispatch_pin *pin = &dispatcher->pins[i];
+
+		if (pin->gpio != NULL && pin->filtered &&
+				gpio_filter_update(&pin->filter,
+				(int64_t)now.tv_sec * 1000000000 + now.tv_nsec, &batch[count])) {
+			owner[count++] = pin;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		gpio_dispatch_pin *pin = owner[i];
+
+		/* A previous callback may have removed the pin */
+		if (pin->gpio == NULL) {
+			continue;
+		}
+		pin->events++;
+		pin->last = batch[i].timestamp;
+		if (dispatcher->events != NULL) {
+			ring_push(dispatcher->events, &batch[i], 1);
+		}
+		if (pin->fxn != NULL) {
+			pin->fxn(pin->gpio, &batch[i], pin->arg);
+		}
+	}
+	return count;
+}
+
+/*
+ *  ======== gpio_dispatch_run ========
+ */
+uint8_t gpio_dispatch_run(gpio_dispatcher *dispatcher) {
+	dispatcher->running = 1;
+	while (dispatcher->running) {
+		if (gpio_dispatch_once(dispatcher, -1) < 0) {
+			dispatcher->running = 0;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_dispatch_stop ========
+ */
+void gpio_dispatch_stop(gpio_dispatcher *dispatcher) {
+	uint64_t one = 1;
+
+	dispatcher->running = 0;
+	if (write(dispatcher->stopfd, &one, sizeof(one)) < 0) {
+		/* The counter is already non zero, the loop will wake up anyway */
+	}
+}
+
+/*
+ *  ======== gpio_dispatch_close ========
+ */
+uint8_t gpio_dispatch_close(gpio_dispatcher *dispatcher) {
+	if (dispatcher->epfd >= 0) {
+		close(dispatcher->epfd);
+	}
+	if (dispatcher->stopfd >= 0) {
+		close(dispatcher->stopfd);
+	}
+	free(dispatcher->pins);
+	free(dispatcher->ready);
+	free(dispatcher->batch);
+	free(dispatcher->owner);
+	memset(dispatcher, 0, sizeof(*dispatcher));
+	dispatcher->epfd = -1;
+	dispatcher->stopfd = -1;
+	return 0;
+}
@@ -0,0 +1,212 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       gpio_dispatch.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/11/2018
+ *  @brief      GPIO interrupt dispatcher
+ *
+ *  The GPIO dispatcher header file should be included in an application as
+ *  follows:
+ *  @code
+ *  #include "drivers/gpio_dispatch.h"
+ *  @endcode
+ *
+ *  # Overview #
+ *  The dispatcher watches the edges of many GPIOs from a single thread. All
+ *  the value files are registered in one epoll instance and every pin has
+ *  its own callback.
+ *
+ *  Pins with a non zero stable_us or min_pulse_us go through a gpio_filter,
+ *  and their callbacks only see the accepted transitions. Every delivered
+ *  event can also be copied to a ring of gpio_event records, see
+ *  gpio_dispatch_set_ring(), so another thread can drain them in batches.
+ *
+ *  Each wakeup handles at most budget pins, and reads up to GPIO_CDEV_EVENTS
+ *  edges queued for each of them with gpio_read_events(). The kernel keeps
+ *  the pins that were not handled at the head of its ready list and moves
+ *  the handled ones to the tail, so a pin that keeps firing cannot starve
+ *  the others.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  gpio_dispatcher dispatcher;
+ *
+ *  gpio_dispatch_open(&dispatcher, 64, 16);
+ *  gpio_dispatch_add(&dispatcher, door, "both", doorFxn, NULL);
+ *  gpio_dispatch_add(&dispatcher, limit, "rising", limitFxn, NULL);
+ *
+ *  // Returns after gpio_dispatch_stop()
+ *  gpio_dispatch_run(&dispatcher);
+ *  gpio_dispatch_close(&dispatcher);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __GPIO_DISPATCH_H_
+#define __GPIO_DISPATCH_H_
+
+#include "gpio.h"
+#include "gpio_filter.h"
+#include "ring.h"
+
+/*!
+ *  @brief      Callback invoked for every edge of a pin
+ *
+ *  All the events delivered in the same wakeup share the same timestamp,
+ *  except with GPIO_CDEV where every event carries the kernel timestamp.
+ */
+typedef void (*gpio_dispatch_fxn)(gpio_properties *gpio, const gpio_event *event, void *arg);
+
+/*!
+ *  @brief      Registered pin
+ */
+typedef struct {
+	gpio_properties *gpio;		/*!< @brief NULL for a free slot */
+	gpio_dispatch_fxn fxn;
+	void *arg;
+	uint64_t raw;				/*!< @brief edges read from the pin */
+	uint64_t events;			/*!< @brief edges delivered to fxn */
+	struct timespec last;		/*!< @brief timestamp of the last edge */
+	uint8_t filtered;			/*!< @brief edges go through filter */
+	gpio_filter filter;
+} gpio_dispatch_pin;
+
+/*!
+ *  @brief      GPIO dispatcher structure type definition
+ */
+typedef struct {
+	int epfd;
+	int stopfd;
+	int capacity;				/*!< @brief maximum number of pins */
+	int count;					/*!< @brief registered pins */
+	int budget;					/*!< @brief maximum pins read per wakeup */
+	int filtered;				/*!< @brief registered pins with a filter */
+	volatile int running;
+	uint64_t wakeups;
+	gpio_dispatch_pin *pins;
+	void *ready;				/*!< @brief epoll events of a wakeup */
+	gpio_event *batch;			/*!< @brief gpio events of a wakeup */
+	gpio_dispatch_pin **owner;	/*!< @brief pin of each batch entry */
+	ring *events;				/*!< @brief optional copy of every event */
+} gpio_dispatcher;
+
+/*!
+ *  @brief  Creates a dispatcher
+ *
+ *  @param  dispatcher  A gpio_dispatcher structure
+ *  @param  capacity    Maximum number of pins
+ *  @param  budget      Maximum pins read per wakeup, 0 means capacity
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_dispatch_open(gpio_dispatcher *dispatcher, int capacity, int budget);
+
+/*!
+ *  @brief  Registers a pin
+ *
+ *  The edge is configured with gpio_edge() before the pin is registered.
+ *  If stable_us or min_pulse_us of \a gpio are set, the filter starts from
+ *  the current level of the pin.
+ *
+ *  @pre    gpio_open() has been called on \a gpio
+ *
+ *  @param  dispatcher  A gpio_dispatcher structure
+ *  @param  gpio        A gpio_properties structure
+ *  @param  edge        "rising", "falling" or "both"
+ *  @param  fxn         Callback for the edges of the pin
+ *  @param  arg         Passed to fxn
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_dispatch_add(gpio_dispatcher *dispatcher, gpio_properties *gpio,
+		char *edge, gpio_dispatch_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Unregisters a pin
+ *
+ *  The edge of the pin is left as configured.
+ *
+ *  @param  dispatcher  A gpio_dispatcher structure
+ *  @param  gpio        A gpio_properties structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_dispatch_remove(gpio_dispatcher *dispatcher, gpio_properties *gpio);
+
+/*!
+ *  @brief  Copies every delivered event to a ring
+ *
+ *  The dispatcher is the producer of the ring. Events that do not fit are
+ *  counted in the overflows of the ring.
+ *
+ *  @param  dispatcher  A gpio_dispatcher structure
+ *  @param  events      A ring of gpio_event records, NULL stops the copy
+ */
+extern void gpio_dispatch_set_ring(gpio_dispatcher *dispatcher, ring *events);
+
+/*!
+ *  @brief  Returns the counters of a registered pin
+ *
+ *  @return Returns the pin, NULL if \a gpio is not registered
+ */
+extern const gpio_dispatch_pin *gpio_dispatch_pin_stats(gpio_dispatcher *dispatcher,
+		gpio_properties *gpio);
+
+/*!
+ *  @brief  Waits for one batch of edges and dispatches it
+ *
+ *  The wait is shortened so that a filtered level is accepted as soon as
+ *  it has been stable for long enough.
+ *
+ *  @param  dispatcher  A gpio_dispatcher structure
+ *  @param  timeout     Milliseconds to wait, -1 waits forever
+ *
+ *  @return Returns the number of callbacks invoked, -1 if an error ocurred
+ */
+extern int gpio_dispatch_once(gpio_dispatcher *dispatcher, int timeout);
+
+/*!
+ *  @brief  Dispatches edges until gpio_dispatch_stop() is called
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_dispatch_run(gpio_dispatcher *dispatcher);
+
+/*!
+ *  @brief  Makes gpio_dispatch_run() return
+ *
+ *  Can be called from a callback, from another thread or from a signal
+ *  handler.
+ */
+extern void gpio_dispatch_stop(gpio_dispatcher *dispatcher);
+
+/*!
+ *  @brief  Releases a dispatcher
+ *
+ *  The registered pins are not closed.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_dispatch_close(gpio_dispatcher *dispatcher);
+
+#endif /* __GPIO_DISPATCH_H_ */
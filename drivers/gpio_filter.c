@@ -0,0 +1,104 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       gpio_filter.c 
+ *	@brief      GPIO debounce and glitch filter
+ *	@author     Maximiliano Valencia
+ *	@date       4/12/2018
+ */
+
+#include "driver.h"
+#include "gpio_filter.h"
+
+/*
+ *  ======== filter_ns ========
+ */
+static int64_t filter_ns(const struct timespec *t) {
+	return (int64_t)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+/*
+ *  ======== gpio_filter_init ========
+ */
+void gpio_filter_init(gpio_filter *filter, const gpio_properties *gpio, uint8_t level) {
+	memset(filter, 0, sizeof(*filter));
+	filter->nr = gpio->nr;
+	filter->stable_ns = (int64_t)gpio->stable_us * 1000;
+	filter->min_pulse_ns = (int64_t)gpio->min_pulse_us * 1000;
+	/* A level shorter than a valid pulse is never accepted */
+	filter->hold_ns = filter->stable_ns > filter->min_pulse_ns ?
+			filter->stable_ns : filter->min_pulse_ns;
+	filter->level = level;
+	filter->raw = level;
+}
+
+/*
+ *  ======== gpio_filter_update ========
+ */
+int gpio_filter_update(gpio_filter *filter, int64_t now, gpio_event *out) {
+	if (filter->raw == filter->level || now - filter->raw_since < filter->hold_ns) {
+		return 0;
+	}
+	filter->level = filter->raw;
+	out->nr = filter->nr;
+	out->level = filter->level;
+	out->edge = filter->level ? GPIO_EDGE_RISING : GPIO_EDGE_FALLING;
+	out->timestamp.tv_sec = filter->raw_since / 1000000000;
+	out->timestamp.tv_nsec = filter->raw_since % 1000000000;
+	return 1;
+}
+
+/*
+ *  ======== gpio_filter_feed ========
+ */
+int gpio_filter_feed(gpio_filter *filter, const gpio_event *raw, gpio_event *out) {
+	int64_t now = filter_ns(&raw->timestamp);
+	int count;
+
+	/* A level that became stable before this edge is accepted first */
+	count = gpio_filter_update(filter, now, out);
+
+	if (raw->level == filter->raw) {
+		return count;
+	}
+	filter->raw = raw->level;
+	if (filter->raw == filter->level) {
+		/* The pending level reverted before it was accepted */
+		if (now - filter->raw_since < filter->min_pulse_ns) {
+			filter->glitches++;
+		} else {
+			filter->bounces++;
+		}
+		return count;
+	}
+	filter->raw_since = now;
+
+	return count + gpio_filter_update(filter, now, out + count);
+}
+
+/*
+ *  ======== gpio_filter_deadline ========
+ */
+int64_t gpio_filter_deadline(const gpio_filter *filter) {
+	if (filter->raw == filter->level) {
+		return -1;
+	}
+	return filter->raw_since + filter->hold_ns;
+}
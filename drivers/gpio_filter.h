@@ -0,0 +1,112 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       gpio_filter.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/12/2018
+ *  @brief      GPIO debounce and glitch filter
+ *
+ *  # Overview #
+ *  The filter turns the raw edges of a pin into clean transitions. It is
+ *  configured by two fields of gpio_properties:
+ *
+ *  - min_pulse_us: a raw pulse shorter than this is a glitch.
+ *  - stable_us: a new level is accepted once the raw input has stayed at
+ *    it for this long. Edges that revert before that are bounces.
+ *
+ *  A new level is accepted after the longer of the two, so a glitch never
+ *  produces a transition; it is only counted. A glitch during a pending
+ *  level cancels it, and the level is timed again from the next edge.
+ *  An accepted transition carries the timestamp of the raw edge that
+ *  started it. gpio_filter_deadline() tells when a pending level becomes
+ *  stable, and gpio_filter_update() must be called at that time because no
+ *  further edge will arrive to trigger it.
+ *
+ *  The dispatcher in gpio_dispatch.h runs the filter for every pin with a
+ *  non zero stable_us or min_pulse_us.
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __GPIO_FILTER_H_
+#define __GPIO_FILTER_H_
+
+#include "gpio.h"
+
+/*!
+ *  @brief      Maximum transitions produced by one gpio_filter_feed()
+ */
+#define GPIO_FILTER_OUT 2
+
+/*!
+ *  @brief      GPIO filter structure type definition
+ */
+typedef struct {
+	int nr;
+	int64_t stable_ns;
+	int64_t min_pulse_ns;
+	uint8_t level;			/*!< @brief filtered level */
+	uint8_t raw;			/*!< @brief last raw level */
+	int64_t hold_ns;		/*!< @brief the longer of stable_ns and min_pulse_ns */
+	int64_t raw_since;		/*!< @brief time of the raw edge of the pending level */
+	uint64_t glitches;		/*!< @brief pulses dropped as glitches */
+	uint64_t bounces;		/*!< @brief edges dropped by the debounce */
+} gpio_filter;
+
+/*!
+ *  @brief  Initializes a filter from the settings of a GPIO
+ *
+ *  @param  filter  A gpio_filter structure
+ *  @param  gpio    A gpio_properties structure
+ *  @param  level   Current level of the pin
+ */
+extern void gpio_filter_init(gpio_filter *filter, const gpio_properties *gpio, uint8_t level);
+
+/*!
+ *  @brief  Feeds a raw edge to the filter
+ *
+ *  @param  filter  A gpio_filter structure
+ *  @param  raw     Raw edge
+ *  @param  out     Receives up to GPIO_FILTER_OUT accepted transitions
+ *
+ *  @return Returns the number of transitions stored in \a out
+ */
+extern int gpio_filter_feed(gpio_filter *filter, const gpio_event *raw, gpio_event *out);
+
+/*!
+ *  @brief  Accepts the pending level if it has been stable long enough
+ *
+ *  @param  filter  A gpio_filter structure
+ *  @param  now     CLOCK_MONOTONIC time in nanoseconds
+ *  @param  out     Receives the accepted transition
+ *
+ *  @return Returns 1 if a transition was stored in \a out, 0 otherwise
+ */
+extern int gpio_filter_update(gpio_filter *filter, int64_t now, gpio_event *out);
+
+/*!
+ *  @brief  Returns when gpio_filter_update() has to be called
+ *
+ *  @return Returns a CLOCK_MONOTONIC time in nanoseconds, -1 if no level
+ *          is pending
+ */
+extern int64_t gpio_filter_deadline(const gpio_filter *filter);
+
+#endif /* __GPIO_FILTER_H_ */
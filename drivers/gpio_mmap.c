@@ -0,0 +1,97 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       gpio_mmap.c 
+ *	@brief      Memory mapped AM335x GPIO registers
+ *	@author     Maximiliano Valencia
+ *	@date       4/11/2018
+ */
+
+#include <sys/mman.h>
+/* GPIO Driver Header File */
+#include "driver.h"
+#include "gpio_mmap.h"
+
+static const off_t bank_base[GPIO_MMAP_BANKS] = {
+	GPIO0_BASE, GPIO1_BASE, GPIO2_BASE, GPIO3_BASE
+};
+
+/* Register window of each bank and whether it came from /dev/mem */
+static volatile uint32_t *bank_regs[GPIO_MMAP_BANKS];
+static uint8_t bank_mapped[GPIO_MMAP_BANKS];
+
+/*
+ *  ======== gpio_mmap_bank ========
+ */
+volatile uint32_t *gpio_mmap_bank(int bank) {
+	int fd;
+	void *window;
+
+	if (bank < 0 || bank >= GPIO_MMAP_BANKS) {
+		return NULL;
+	}
+	if (bank_regs[bank] != NULL) {
+		return bank_regs[bank];
+	}
+
+	fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
+	if (fd < 0) {
+		log_err("gpio_mmap_bank(): could not open /dev/mem: %m");
+		return NULL;
+	}
+	window = mmap(NULL, GPIO_MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, bank_base[bank]);
+	/* The mapping stays valid after the descriptor is closed */
+	close(fd);
+	if (window == MAP_FAILED) {
+		log_err("gpio_mmap_bank(): could not map bank %d: %m", bank);
+		return NULL;
+	}
+	log_info("gpio_mmap_bank(): bank %d mapped", bank);
+	bank_regs[bank] = window;
+	bank_mapped[bank] = 1;
+	return bank_regs[bank];
+}
+
+/*
+ *  ======== gpio_mmap_attach ========
+ */
+uint8_t gpio_mmap_attach(int bank, void *window) {
+	if (bank < 0 || bank >= GPIO_MMAP_BANKS) {
+		return -1;
+	}
+	if (bank_mapped[bank]) {
+		munmap((void *)bank_regs[bank], GPIO_MMAP_SIZE);
+		bank_mapped[bank] = 0;
+	}
+	bank_regs[bank] = window;
+	return 0;
+}
+
+/*
+ *  ======== gpio_mmap_release ========
+ */
+void gpio_mmap_release(void) {
+	int bank;
+
+	for (bank = 0; bank < GPIO_MMAP_BANKS; bank++) {
+		gpio_mmap_attach(bank, NULL);
+	}
+}
@@ -0,0 +1,124 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       gpio_mmap.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/11/2018
+ *  @brief      Memory mapped AM335x GPIO registers
+ *
+ *  # Overview #
+ *  The AM335x has four GPIO banks of 32 pins each. Every bank is controlled
+ *  by a 4 KB register window that can be mapped into the process through
+ *  /dev/mem. Pin number nr belongs to bank nr / 32 and bit nr % 32.
+ *
+ *  Outputs are driven through SETDATAOUT and CLEARDATAOUT, which only touch
+ *  the bits written as 1, so no read-modify-write is needed. Inputs are
+ *  read from DATAIN.
+ *
+ *  The GPIO driver uses this module when gpio_properties.backend is
+ *  GPIO_MMAP. Pins are still exported and configured through sysfs, so the
+ *  kernel keeps the bank clocked and the pin direction set.
+ *
+ *  ### Testing without hardware #
+ *
+ *  gpio_mmap_attach() installs any 4 KB mapping as a bank window, for
+ *  example a memfd mapped with MAP_SHARED.
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __GPIO_MMAP_H_
+#define __GPIO_MMAP_H_
+
+#include <stdint.h>
+
+/*!
+ *  @brief      Number of GPIO banks and size of each register window
+ */
+#define GPIO_MMAP_BANKS 4
+#define GPIO_MMAP_SIZE 0x1000
+
+/*!
+ *  @brief      Physical base address of each GPIO bank
+ */
+#define GPIO0_BASE 0x44E07000
+#define GPIO1_BASE 0x4804C000
+#define GPIO2_BASE 0x481AC000
+#define GPIO3_BASE 0x481AE000
+
+/*!
+ *  @brief      GPIO register offsets inside a bank window
+ */
+#define GPIO_OE 0x134
+#define GPIO_DATAIN 0x138
+#define GPIO_DATAOUT 0x13C
+#define GPIO_CLEARDATAOUT 0x190
+#define GPIO_SETDATAOUT 0x194
+
+/*!
+ *  @brief  Returns the register window of a GPIO bank
+ *
+ *  The bank is mapped through /dev/mem the first time it is requested.
+ *
+ *  @param  bank    Bank number, 0 to GPIO_MMAP_BANKS - 1
+ *
+ *  @return Returns the bank registers, NULL if the bank could not be mapped
+ */
+extern volatile uint32_t *gpio_mmap_bank(int bank);
+
+/*!
+ *  @brief  Installs a register window for a GPIO bank
+ *
+ *  @param  bank    Bank number, 0 to GPIO_MMAP_BANKS - 1
+ *  @param  window  GPIO_MMAP_SIZE bytes of memory, NULL detaches the bank
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_mmap_attach(int bank, void *window);
+
+/*!
+ *  @brief  Unmaps every bank mapped from /dev/mem and forgets attached ones
+ *
+ *  @pre    No GPIO is using the GPIO_MMAP backend
+ */
+extern void gpio_mmap_release(void);
+
+/*!
+ *  @brief  Drives the bits in \a mask high
+ */
+static inline void gpio_mmap_set(volatile uint32_t *regs, uint32_t mask) {
+	regs[GPIO_SETDATAOUT / 4] = mask;
+}
+
+/*!
+ *  @brief  Drives the bits in \a mask low
+ */
+static inline void gpio_mmap_clear(volatile uint32_t *regs, uint32_t mask) {
+	regs[GPIO_CLEARDATAOUT / 4] = mask;
+}
+
+/*!
+ *  @brief  Returns the input level of every pin in the bank
+ */
+static inline uint32_t gpio_mmap_read(volatile uint32_t *regs) {
+	return regs[GPIO_DATAIN / 4];
+}
+
+#endif /* __GPIO_MMAP_H_ */
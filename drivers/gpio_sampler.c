@@ -0,0 +1,181 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       gpio_sampler.c 
+ *	@brief      Fixed rate GPIO sampling
+ *	@author     Maximiliano Valencia
+ *	@date       4/12/2018
+ */
+
+#include <errno.h>
+/* GPIO Driver Header File */
+#include "driver.h"
+#include "gpio_sampler.h"
+
+/* Words pushed to the ring at once */
+#define GPIO_SAMPLER_BATCH 64
+
+/*
+ *  ======== sampler_push ========
+ *  Pushes \a count periods of \a word. The last free slot of the ring is
+ *  kept for a GPIO_SAMPLER_OVERRUN word, so periods that do not fit are
+ *  counted and reported in the stream, before the next word that fits.
+ */
+static void sampler_push(gpio_sampler *sampler, uint64_t word, int64_t count) {
+	uint64_t words[GPIO_SAMPLER_BATCH];
+	uint64_t marker;
+	size_t room;
+	int64_t n;
+	int i;
+
+	for (i = 0; i < GPIO_SAMPLER_BATCH && i < count; i++) {
+		words[i] = word;
+	}
+	while (count > 0) {
+		room = sampler->words.capacity - ring_count(&sampler->words);
+		if (sampler->dropped > 0 && room > 0) {
+			marker = GPIO_SAMPLER_OVERRUN | sampler->dropped;
+			ring_push(&sampler->words, &marker, 1);
+			sampler->dropped = 0;
+			room--;
+		}
+		if (sampler->dropped > 0 || room <= 1) {
+			sampler->dropped += count;
+			sampler->overruns += count;
+			return;
+		}
+		n = count < GPIO_SAMPLER_BATCH ? count : GPIO_SAMPLER_BATCH;
+		if ((size_t)n > room - 1) {
+			n = room - 1;
+		}
+		ring_push(&sampler->words, words, n);
+		count -= n;
+	}
+}
+
+/*
+ *  ======== sampler_thread ========
+ */
+static void *sampler_thread(void *arg) {
+	gpio_sampler *sampler = arg;
+	int64_t period = 1000000000 / sampler->rate;
+	int64_t spin_ns = sampler->spin_ns ? sampler->spin_ns : GPIO_SAMPLER_SPIN_NS;
+	int64_t deadline = stats_now() + period;
+	uint64_t word;
+
+	while (sampler->running) {
+		int64_t now = stats_now();
+
+		if (deadline - now > spin_ns) {
+			struct timespec wake;
+
+			wake.tv_sec = (deadline - spin_ns) / 1000000000;
+			wake.tv_nsec = (deadline - spin_ns) % 1000000000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+			now = stats_now();
+		}
+		while (now < deadline) {
+			now = stats_now();
+		}
+
+		/* More than a period behind, skip the lost periods */
+		if (now - deadline >= period) {
+			int64_t lost = (now - deadline) / period;
+
+			sampler->missed += lost;
+			sampler_push(sampler, GPIO_SAMPLER_MISSED, lost);
+			deadline += lost * period;
+		}
+		if (now - deadline > sampler->max_late_ns) {
+			sampler->max_late_ns = now - deadline;
+		}
+
+		if (gpio_group_read(sampler->group, &word) != 0) {
+			sampler->errors++;
+			sampler_push(sampler, GPIO_SAMPLER_FAILED, 1);
+		} else {
+			sampler_push(sampler, word, 1);
+			sampler->samples++;
+		}
+		deadline += period;
+	}
+	return NULL;
+}
+
+/*
+ *  ======== gpio_sampler_start ========
+ */
+uint8_t gpio_sampler_start(gpio_sampler *sampler) {
+	if (sampler->rate == 0 || sampler->rate > 1000000000) {
+		log_err("gpio_sampler_start(): invalid rate %u", sampler->rate);
+		return -1;
+	}
+	/* The top bit of a word marks a gap */
+	if (sampler->group->count > GPIO_SAMPLER_PINS) {
+		log_err("gpio_sampler_start(): more than %d pins", GPIO_SAMPLER_PINS);
+		errno = EINVAL;
+		return -1;
+	}
+	if (ring_init(&sampler->words, sizeof(uint64_t),
+			sampler->capacity ? sampler->capacity : GPIO_SAMPLER_RING) != 0) {
+		return -1;
+	}
+	sampler->samples = 0;
+	sampler->missed = 0;
+	sampler->max_late_ns = 0;
+	sampler->errors = 0;
+	sampler->overruns = 0;
+	sampler->dropped = 0;
+	sampler->running = 1;
+
+	if (drivers_thread_create(&sampler->thread, sampler->priority, sampler_thread,
+			sampler) != 0) {
+		sampler->running = 0;
+		ring_free(&sampler->words);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_sampler_read ========
+ */
+size_t gpio_sampler_read(gpio_sampler *sampler, uint64_t *words, size_t max) {
+	return ring_pop(&sampler->words, words, max);
+}
+
+/*
+ *  ======== gpio_sampler_overruns ========
+ */
+uint64_t gpio_sampler_overruns(gpio_sampler *sampler) {
+	return sampler->overruns;
+}
+
+/*
+ *  ======== gpio_sampler_stop ========
+ */
+uint8_t gpio_sampler_stop(gpio_sampler *sampler) {
+	sampler->running = 0;
+	if (pthread_join(sampler->thread, NULL) != 0) {
+		return -1;
+	}
+	ring_free(&sampler->words);
+	return 0;
+}
@@ -0,0 +1,176 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       gpio_sampler.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/12/2018
+ *  @brief      Fixed rate GPIO sampling
+ *
+ *  The GPIO sampler header file should be included in an application as
+ *  follows:
+ *  @code
+ *  #include "drivers/gpio_sampler.h"
+ *  @endcode
+ *
+ *  # Overview #
+ *  The sampler reads a gpio_group at a fixed rate from a dedicated thread
+ *  and stores every reading as one uint64_t word, bit i being pin nr[i].
+ *  The words go into a single producer, single consumer ring that another
+ *  thread drains in blocks with gpio_sampler_read().
+ *
+ *  The thread works on absolute deadlines: it sleeps until spin_ns before
+ *  each one and busy-waits the rest. When it falls more than one period
+ *  behind, the lost periods are skipped and counted in missed instead of
+ *  being sampled late in a burst.
+ *
+ *  Every period is accounted for in the stream, so the time of a word is
+ *  known from its position. A period without a sample, skipped or with a
+ *  failed read, gets a word with GPIO_SAMPLER_GAP set: GPIO_SAMPLER_MISSED
+ *  or GPIO_SAMPLER_FAILED. Periods that did not fit in the ring are
+ *  counted as overruns and replaced by one GPIO_SAMPLER_OVERRUN word
+ *  holding their number, see GPIO_SAMPLER_PERIODS(); the last slot of the
+ *  ring is kept for it. Groups are limited to GPIO_SAMPLER_PINS pins so
+ *  the bit is free.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  gpio_sampler sampler = { .group = group, .rate = 10000 };
+ *  uint64_t block[256];
+ *
+ *  gpio_sampler_start(&sampler);
+ *  while (running) {
+ *      size_t count = gpio_sampler_read(&sampler, block, 256);
+ *      decode(block, count);	// see GPIO_SAMPLER_GAP and GPIO_SAMPLER_PERIODS()
+ *      usleep(10000);
+ *  }
+ *  gpio_sampler_stop(&sampler);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __GPIO_SAMPLER_H_
+#define __GPIO_SAMPLER_H_
+
+#include <pthread.h>
+#include "gpio.h"
+#include "ring.h"
+
+/*!
+ *  @brief      Default ring size, in samples
+ */
+#define GPIO_SAMPLER_RING 65536
+
+/*!
+ *  @brief      Default busy-wait before every deadline, in nanoseconds
+ */
+#define GPIO_SAMPLER_SPIN_NS 20000
+
+/*!
+ *  @brief      Pins a sampled group can have
+ */
+#define GPIO_SAMPLER_PINS 63
+
+/*!
+ *  @brief      Set in the words that are not samples
+ */
+#define GPIO_SAMPLER_GAP ((uint64_t)1 << 63)
+
+/*!
+ *  @brief      Word of a period skipped because the thread was late
+ */
+#define GPIO_SAMPLER_MISSED (GPIO_SAMPLER_GAP | 1)
+
+/*!
+ *  @brief      Word of a period whose read failed
+ */
+#define GPIO_SAMPLER_FAILED (GPIO_SAMPLER_GAP | 2)
+
+/*!
+ *  @brief      Word standing for periods dropped because the ring was full
+ */
+#define GPIO_SAMPLER_OVERRUN (GPIO_SAMPLER_GAP | ((uint64_t)1 << 62))
+
+/*!
+ *  @brief      Periods a word stands for
+ */
+#define GPIO_SAMPLER_PERIODS(word) (((word) & GPIO_SAMPLER_OVERRUN) == GPIO_SAMPLER_OVERRUN ? \
+		(word) & (((uint64_t)1 << 62) - 1) : 1)
+
+/*!
+ *  @brief      Sampler structure type definition
+ *
+ *  The caller fills in the fields up to priority.
+ */
+typedef struct {
+	gpio_group *group;
+	uint32_t rate;			/*!< @brief samples per second */
+	size_t capacity;		/*!< @brief ring size, 0 means GPIO_SAMPLER_RING */
+	uint32_t spin_ns;		/*!< @brief busy-wait, 0 means GPIO_SAMPLER_SPIN_NS */
+	int priority;			/*!< @brief SCHED_FIFO priority, 0 keeps the policy */
+	uint64_t samples;		/*!< @brief samples taken */
+	uint64_t missed;		/*!< @brief periods skipped because the thread was late */
+	int64_t max_late_ns;	/*!< @brief worst lateness of a sample */
+	uint64_t errors;		/*!< @brief failed reads */
+	uint64_t overruns;		/*!< @brief periods dropped because the ring was full */
+	uint64_t dropped;		/*!< @brief dropped periods not reported in the ring yet */
+	ring words;
+	volatile int running;
+	pthread_t thread;
+} gpio_sampler;
+
+/*!
+ *  @brief  Starts sampling on a dedicated thread
+ *
+ *  @pre    gpio_group_open() has been called on the group
+ *
+ *  @param  sampler A gpio_sampler structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_sampler_start(gpio_sampler *sampler);
+
+/*!
+ *  @brief  Takes the samples waiting in the ring, without blocking
+ *
+ *  Must always be called from the same thread.
+ *
+ *  @param  sampler A gpio_sampler structure
+ *  @param  words   Receives the samples, oldest first
+ *  @param  max     Size of \a words
+ *
+ *  @return Returns the number of samples copied
+ */
+extern size_t gpio_sampler_read(gpio_sampler *sampler, uint64_t *words, size_t max);
+
+/*!
+ *  @brief  Returns the number of periods dropped because the ring was full
+ */
+extern uint64_t gpio_sampler_overruns(gpio_sampler *sampler);
+
+/*!
+ *  @brief  Stops the sampling thread and releases the ring
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_sampler_stop(gpio_sampler *sampler);
+
+#endif /* __GPIO_SAMPLER_H_ */
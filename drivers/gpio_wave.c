@@ -0,0 +1,125 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       gpio_wave.c 
+ *	@brief      GPIO waveform playback
+ *	@author     Maximiliano Valencia
+ *	@date       4/12/2018
+ */
+
+#include <errno.h>
+/* GPIO Driver Header File */
+#include "driver.h"
+#include "gpio_wave.h"
+
+/*
+ *  ======== wave_wait_until ========
+ */
+/* Sleeps until spin_ns before the deadline and busy-waits the rest */
+static int64_t wave_wait_until(int64_t deadline, int64_t spin_ns) {
+	int64_t now = stats_now();
+
+	if (deadline - now > spin_ns) {
+		struct timespec wake;
+		int64_t sleep_until = deadline - spin_ns;
+
+		wake.tv_sec = sleep_until / 1000000000;
+		wake.tv_nsec = sleep_until % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+			/* Interrupted by a signal, go back to sleep */
+		}
+		now = stats_now();
+	}
+	while (now < deadline) {
+		now = stats_now();
+	}
+	return now;
+}
+
+/*
+ *  ======== wave_thread ========
+ */
+static void *wave_thread(void *arg) {
+	gpio_wave *wave = arg;
+	int64_t spin_ns = wave->spin_ns ? wave->spin_ns : GPIO_WAVE_SPIN_NS;
+	int64_t deadline = stats_now() + GPIO_WAVE_LEAD_NS;
+	int pass;
+	int i;
+
+	for (pass = 0; wave->running && (wave->repeat == 0 || pass < wave->repeat); pass++) {
+		for (i = 0; i < wave->count && wave->running; i++) {
+			const gpio_wave_step *step = &wave->steps[i];
+			int64_t late = wave_wait_until(deadline, spin_ns) - deadline;
+
+			if (gpio_group_write(wave->group, step->level, step->mask) != 0) {
+				wave->errors++;
+			}
+			wave->played++;
+			wave->total_deviation_ns += late;
+			if (late > wave->max_deviation_ns) {
+				wave->max_deviation_ns = late;
+			}
+			deadline += step->delay_ns;
+		}
+	}
+	wave->running = 0;
+	return NULL;
+}
+
+/*
+ *  ======== gpio_wave_start ========
+ */
+uint8_t gpio_wave_start(gpio_wave *wave) {
+	/* An empty waveform would spin without ever sleeping */
+	if (wave->steps == NULL || wave->count <= 0) {
+		log_err("gpio_wave_start(): no steps");
+		errno = EINVAL;
+		return -1;
+	}
+
+	wave->played = 0;
+	wave->max_deviation_ns = 0;
+	wave->total_deviation_ns = 0;
+	wave->errors = 0;
+	wave->running = 1;
+
+	if (drivers_thread_create(&wave->thread, wave->priority, wave_thread, wave) != 0) {
+		wave->running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== gpio_wave_stop ========
+ */
+void gpio_wave_stop(gpio_wave *wave) {
+	wave->running = 0;
+}
+
+/*
+ *  ======== gpio_wave_wait ========
+ */
+uint8_t gpio_wave_wait(gpio_wave *wave) {
+	if (pthread_join(wave->thread, NULL) != 0) {
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       gpio_wave.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/12/2018
+ *  @brief      GPIO waveform playback
+ *
+ *  The GPIO waveform header file should be included in an application as
+ *  follows:
+ *  @code
+ *  #include "drivers/gpio_wave.h"
+ *  @endcode
+ *
+ *  # Overview #
+ *  A waveform is a list of steps. Each step writes some pins of a
+ *  gpio_group and then waits a number of nanoseconds before the next one.
+ *  The waveform is played by a dedicated thread that sleeps with
+ *  clock_nanosleep() until spin_ns before every deadline and busy-waits the
+ *  rest, so the steps are issued on absolute deadlines and the errors do
+ *  not add up. The worst and mean deviation from the deadlines are kept.
+ *
+ *  Any backend of the group can be used. The deviation measures when the
+ *  write is issued, so slower backends show up as a longer step rather than
+ *  a larger deviation.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  // Two clock pulses on bit 0 with data on bit 1
+ *  gpio_wave_step steps[] = {
+ *      { 0x3, 0x2, 500 },
+ *      { 0x1, 0x1, 500 },
+ *      { 0x3, 0x0, 500 },
+ *      { 0x1, 0x1, 500 },
+ *      { 0x1, 0x0, 0 },
+ *  };
+ *  gpio_wave wave = { .group = group, .steps = steps, .count = 5, .repeat = 1 };
+ *
+ *  gpio_wave_start(&wave);
+ *  gpio_wave_wait(&wave);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __GPIO_WAVE_H_
+#define __GPIO_WAVE_H_
+
+#include <pthread.h>
+#include "gpio.h"
+
+/*!
+ *  @brief      Default busy-wait before every deadline, in nanoseconds
+ */
+#define GPIO_WAVE_SPIN_NS 50000
+
+/*!
+ *  @brief      Delay between gpio_wave_start() and the first step
+ */
+#define GPIO_WAVE_LEAD_NS 1000000
+
+/*!
+ *  @brief      Waveform step structure type definition
+ */
+typedef struct {
+	uint64_t mask;			/*!< @brief group pins written by the step */
+	uint64_t level;			/*!< @brief levels of those pins */
+	uint32_t delay_ns;		/*!< @brief time until the next step */
+} gpio_wave_step;
+
+/*!
+ *  @brief      Waveform engine structure type definition
+ *
+ *  The caller fills in the fields up to priority. The statistics are
+ *  updated while the waveform plays and are final once gpio_wave_wait()
+ *  returns.
+ */
+typedef struct {
+	gpio_group *group;
+	const gpio_wave_step *steps;
+	int count;				/*!< @brief number of steps */
+	int repeat;				/*!< @brief times to play, 0 until stopped */
+	uint32_t spin_ns;		/*!< @brief busy-wait, 0 means GPIO_WAVE_SPIN_NS */
+	int priority;			/*!< @brief SCHED_FIFO priority, 0 keeps the policy */
+	uint64_t played;		/*!< @brief steps issued */
+	int64_t max_deviation_ns;	/*!< @brief worst lateness of a step */
+	int64_t total_deviation_ns;	/*!< @brief sum of the lateness of all steps */
+	uint64_t errors;		/*!< @brief steps whose write failed */
+	volatile int running;
+	pthread_t thread;
+} gpio_wave;
+
+/*!
+ *  @brief  Starts playing a waveform on its own thread
+ *
+ *  Fails with EINVAL when steps is NULL or count is not positive.
+ *
+ *  @pre    gpio_group_open() has been called on the group
+ *
+ *  @param  wave    A gpio_wave structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_wave_start(gpio_wave *wave);
+
+/*!
+ *  @brief  Makes a playing waveform stop after the current step
+ *
+ *  @param  wave    A gpio_wave structure
+ */
+extern void gpio_wave_stop(gpio_wave *wave);
+
+/*!
+ *  @brief  Waits until the waveform has finished playing
+ *
+ *  @param  wave    A gpio_wave structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t gpio_wave_wait(gpio_wave *wave);
+
+#endif /* __GPIO_WAVE_H_ */
@@ -0,0 +1,505 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       log.c 
+ *	@brief      Deferred, leveled logging for the drivers
+ *	@author     Maximiliano Valencia
+ *	@date       4/14/2018
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "log.h"
+#include "ring.h"
+
+/*!
+ *  @brief      Records formatted per thread and wakeup
+ */
+#define LOG_BATCH 32
+
+/*!
+ *  @brief      Longest time a record waits for the flusher, in milliseconds
+ */
+#define LOG_FLUSH_MS 100
+
+/*
+ *  One log call. args holds the integers, pointers and doubles in the
+ *  order of the format, and the offsets of the %s copies in strings.
+ */
+typedef struct {
+	const char *format;
+	uint8_t level;
+	uint8_t count;
+	int error;
+	int64_t args[LOG_ARGS];
+	char strings[LOG_STRINGS];
+} log_record;
+
+/*
+ *  Ring of one thread. closed is set when the thread exits, the flusher
+ *  then frees it once it is empty.
+ */
+typedef struct log_thread {
+	ring records;
+	int closed;
+	struct log_thread *next;
+} log_thread;
+
+/* Conversion classes */
+enum {
+	LOG_INT,
+	LOG_LONG,
+	LOG_LLONG,
+	LOG_SIZE,
+	LOG_INTMAX,
+	LOG_PTRDIFF,
+	LOG_DOUBLE,
+	LOG_LDOUBLE,
+	LOG_STRING,
+	LOG_POINTER,
+	LOG_ERRNO,
+	LOG_PERCENT,
+	LOG_UNKNOWN
+};
+
+int log_level = BBDL_LOG_COMPILED;
+
+static __thread log_thread *log_self;
+static pthread_key_t log_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wake;
+static log_thread *log_threads;
+static uint64_t log_lost;			/* drops of rings already freed */
+static int log_running;
+static int log_stopping;
+static pthread_t log_flusher;
+
+/*
+ *  ======== log_spec ========
+ *  Parses the conversion after a '%'. Copies it, '%' included, into spec
+ *  and returns the character following it.
+ */
+static const char *log_spec(const char *p, char *spec, size_t size, int *type) {
+	size_t n = 0;
+	int length = 0;
+
+	spec[n++] = '%';
+	while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL) {
+		if (n < size - 3) {
+			spec[n++] = *p;
+		}
+		p++;
+	}
+	while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+		switch (*p) {
+		case 'l':
+			length = length == 'l' ? 'q' : 'l';
+			break;
+		case 'h':
+			length = length ? length : 'h';
+			break;
+		default:
+			length = *p;
+		}
+		if (n < size - 2) {
+			spec[n++] = *p;
+		}
+		p++;
+	}
+	spec[n++] = *p;
+	spec[n] = '\0';
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		*type = length == 'l' ? LOG_LONG : length == 'q' || length == 'L' ? LOG_LLONG :
+				length == 'z' ? LOG_SIZE : length == 'j' ? LOG_INTMAX :
+				length == 't' ? LOG_PTRDIFF : LOG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		*type = length == 'L' ? LOG_LDOUBLE : LOG_DOUBLE;
+		break;
+	case 's':
+		*type = LOG_STRING;
+		break;
+	case 'p':
+		*type = LOG_POINTER;
+		break;
+	case 'm':
+		*type = LOG_ERRNO;
+		break;
+	case '%':
+		*type = LOG_PERCENT;
+		break;
+	default:
+		*type = LOG_UNKNOWN;
+		return *p != '\0' ? p + 1 : p;
+	}
+	return p + 1;
+}
+
+/*
+ *  ======== log_format ========
+ */
+static void log_format(const log_record *record, char *out, size_t size) {
+	const char *p = record->format;
+	char spec[16];
+	size_t o = 0;
+	int arg = 0, type, n;
+	double d;
+
+	while (*p != '\0' && o < size - 1) {
+		if (*p != '%') {
+			out[o++] = *p++;
+			continue;
+		}
+		p = log_spec(p + 1, spec, sizeof(spec), &type);
+		if (type == LOG_PERCENT) {
+			out[o++] = '%';
+			continue;
+		}
+		if (type == LOG_ERRNO) {
+			n = snprintf(out + o, size - o, "%s", strerror(record->error));
+		} else if (type == LOG_UNKNOWN || arg >= record->count) {
+			n = snprintf(out + o, size - o, "?");
+		} else {
+			int64_t v = record->args[arg++];
+
+			switch (type) {
+			case LOG_LONG:
+				n = snprintf(out + o, size - o, spec, (long)v);
+				break;
+			case LOG_LLONG:
+				n = snprintf(out + o, size - o, spec, (long long)v);
+				break;
+			case LOG_SIZE:
+				n = snprintf(out + o, size - o, spec, (size_t)v);
+				break;
+			case LOG_INTMAX:
+				n = snprintf(out + o, size - o, spec, (intmax_t)v);
+				break;
+			case LOG_PTRDIFF:
+				n = snprintf(out + o, size - o, spec, (ptrdiff_t)v);
+				break;
+			case LOG_DOUBLE:
+			case LOG_LDOUBLE:
+				memcpy(&d, &v, sizeof(d));
+				if (type == LOG_LDOUBLE) {
+					spec[strlen(spec) - 2] = spec[strlen(spec) - 1];
+					spec[strlen(spec) - 1] = '\0';
+				}
+				n = snprintf(out + o, size - o, spec, d);
+				break;
+			case LOG_STRING:
+				n = snprintf(out + o, size - o, spec, record->strings + v);
+				break;
+			case LOG_POINTER:
+				n = snprintf(out + o, size - o, spec, (void *)(intptr_t)v);
+				break;
+			default:
+				n = snprintf(out + o, size - o, spec, (int)v);
+			}
+		}
+		if (n < 0) {
+			break;
+		}
+		o += (size_t)n < size - o ? (size_t)n : size - o - 1;
+	}
+	out[o] = '\0';
+}
+
+/*
+ *  ======== log_forward ========
+ */
+static void log_forward(const log_record *record) {
+	char text[256];
+
+	log_format(record, text, sizeof(text));
+	syslog(record->level, "%s", text);
+}
+
+/*
+ *  ======== log_exit ========
+ *  Thread destructor, hands the ring over to the flusher.
+ */
+static void log_exit(void *arg) {
+	log_thread *thread = arg;
+
+	/* A later destructor that logs gets a new ring */
+	log_self = NULL;
+	__atomic_store_n(&thread->closed, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ *  ======== log_init ========
+ */
+static void log_init(void) {
+	pthread_condattr_t attr;
+
+	pthread_key_create(&log_key, log_exit);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&log_wake, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/*
+ *  ======== log_thread_ring ========
+ *  Returns the ring of the calling thread, creating it on first use.
+ */
+static log_thread *log_thread_ring(void) {
+	log_thread *thread;
+
+	if (log_self != NULL) {
+		return log_self;
+	}
+	pthread_once(&log_once, log_init);
+	thread = calloc(1, sizeof(log_thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+	if (ring_init(&thread->records, sizeof(log_record), LOG_RING) != 0) {
+		free(thread);
+		return NULL;
+	}
+	pthread_mutex_lock(&log_lock);
+	thread->next = log_threads;
+	log_threads = thread;
+	pthread_mutex_unlock(&log_lock);
+	pthread_setspecific(log_key, thread);
+	log_self = thread;
+	return thread;
+}
+
+/*
+ *  ======== log_write ========
+ */
+void log_write(int level, const char *format, ...) {
+	log_record record;
+	log_thread *thread;
+	const char *p = format;
+	const char *s;
+	char spec[16];
+	size_t used = 0, n;
+	int error = errno;
+	int type;
+	double d;
+	va_list args;
+
+	record.format = format;
+	record.level = level;
+	record.count = 0;
+	record.error = error;
+
+	va_start(args, format);
+	while ((p = strchr(p, '%')) != NULL && record.count < LOG_ARGS) {
+		int64_t *arg = &record.args[record.count];
+
+		p = log_spec(p + 1, spec, sizeof(spec), &type);
+		switch (type) {
+		case LOG_INT:
+			*arg = va_arg(args, int);
+			break;
+		case LOG_LONG:
+			*arg = va_arg(args, long);
+			break;
+		case LOG_LLONG:
+			*arg = va_arg(args, long long);
+			break;
+		case LOG_SIZE:
+			*arg = va_arg(args, size_t);
+			break;
+		case LOG_INTMAX:
+			*arg = va_arg(args, intmax_t);
+			break;
+		case LOG_PTRDIFF:
+			*arg = va_arg(args, ptrdiff_t);
+			break;
+		case LOG_DOUBLE:
+		case LOG_LDOUBLE:
+			d = type == LOG_DOUBLE ? va_arg(args, double) : (double)va_arg(args, long double);
+			memcpy(arg, &d, sizeof(d));
+			break;
+		case LOG_STRING:
+			/* Copy the string, the caller's buffer may be gone when it is formatted */
+			s = va_arg(args, const char *);
+			if (s == NULL) {
+				s = "(null)";
+			}
+			n = used < LOG_STRINGS ? strnlen(s, LOG_STRINGS - used - 1) : 0;
+			if (used >= LOG_STRINGS) {
+				*arg = LOG_STRINGS - 1;
+			} else {
+				memcpy(record.strings + used, s, n);
+				record.strings[used + n] = '\0';
+				*arg = used;
+				used += n + 1;
+			}
+			break;
+		case LOG_POINTER:
+			*arg = (intptr_t)va_arg(args, void *);
+			break;
+		default:
+			/* %m, %% and unknown conversions take no argument */
+			continue;
+		}
+		record.count++;
+	}
+	va_end(args);
+	record.strings[LOG_STRINGS - 1] = '\0';
+
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE) || (thread = log_thread_ring()) == NULL) {
+		log_forward(&record);
+	} else if (ring_push(&thread->records, &record, 1) == 1 && level <= BBDL_LOG_ERR) {
+		/* Errors are forwarded right away */
+		pthread_cond_signal(&log_wake);
+	}
+	errno = error;
+}
+
+/*
+ *  ======== log_set_level ========
+ */
+void log_set_level(int level) {
+	__atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+/*
+ *  ======== log_drain ========
+ *  Forwards what the rings hold and frees the rings of exited threads.
+ */
+static void log_drain(void) {
+	log_record batch[LOG_BATCH];
+	log_thread **link, *thread;
+	size_t count, i;
+
+	pthread_mutex_lock(&log_lock);
+	link = &log_threads;
+	while ((thread = *link) != NULL) {
+		int closed = __atomic_load_n(&thread->closed, __ATOMIC_ACQUIRE);
+
+		while ((count = ring_pop(&thread->records, batch, LOG_BATCH)) > 0) {
+			for (i = 0; i < count; i++) {
+				log_forward(&batch[i]);
+			}
+		}
+		if (closed) {
+			*link = thread->next;
+			log_lost += ring_overflows(&thread->records);
+			ring_free(&thread->records);
+			free(thread);
+		} else {
+			link = &thread->next;
+		}
+	}
+	pthread_mutex_unlock(&log_lock);
+}
+
+/*
+ *  ======== log_thread_main ========
+ */
+static void *log_thread_main(void *arg) {
+	struct timespec deadline;
+	int stopping;
+
+	(void)arg;
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&log_lock);
+		if (!log_stopping) {
+			pthread_cond_timedwait(&log_wake, &log_lock, &deadline);
+		}
+		stopping = log_stopping;
+		pthread_mutex_unlock(&log_lock);
+		log_drain();
+	} while (!stopping);
+	return NULL;
+}
+
+/*
+ *  ======== log_start ========
+ */
+uint8_t log_start(void) {
+	sigset_t all, old;
+	int status;
+
+	pthread_once(&log_once, log_init);
+	if (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	log_stopping = 0;
+	/* The flusher inherits a full mask, process signals go to the application threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	status = pthread_create(&log_flusher, NULL, log_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (status != 0) {
+		syslog(LOG_ERR, "log_start(): could not create thread: %s", strerror(status));
+		return -1;
+	}
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ *  ======== log_stop ========
+ */
+void log_stop(void) {
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	__atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&log_lock);
+	log_stopping = 1;
+	pthread_cond_signal(&log_wake);
+	pthread_mutex_unlock(&log_lock);
+	pthread_join(log_flusher, NULL);
+	/* Records pushed while the flag was changing */
+	log_drain();
+}
+
+/*
+ *  ======== log_dropped ========
+ */
+uint64_t log_dropped(void) {
+	log_thread *thread;
+	uint64_t dropped;
+
+	pthread_mutex_lock(&log_lock);
+	dropped = log_lost;
+	for (thread = log_threads; thread != NULL; thread = thread->next) {
+		dropped += ring_overflows(&thread->records);
+	}
+	pthread_mutex_unlock(&log_lock);
+	return dropped;
+}
@@ -0,0 +1,153 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       log.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/14/2018
+ *  @brief      Deferred, leveled logging for the drivers
+ *
+ *  # Overview #
+ *  Logging from the drivers must cost far less than the I/O it describes.
+ *  A log call stores the format pointer and the raw arguments as a binary
+ *  record in a lock-free ring owned by the calling thread, and returns. A
+ *  background thread started by drivers_init() formats the records and
+ *  forwards them to syslog in batches.
+ *
+ *  Records are filtered twice:
+ *  - at compile time, calls above BBDL_LOG_COMPILED are removed entirely.
+ *    It defaults to BBDL_LOG_INFO, build with -DBBDL_LOG_COMPILED=7 to keep
+ *    the debug calls of the hot paths, or 5 to drop the info ones as well.
+ *  - at run time, calls above log_set_level() return right away.
+ *
+ *  The format is the one of printf and syslog, with at most LOG_ARGS
+ *  conversions. %s strings are copied into the record, up to a total of
+ *  LOG_STRINGS bytes. %m prints errno as it was when the call was made.
+ *  The * width and precision are not supported.
+ *
+ *  Records that do not fit in the ring of their thread are dropped and
+ *  counted, see log_dropped(). Until log_start() is called, and after
+ *  log_stop(), records are written to syslog directly.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  log_err("gpio_write(): GPIO %d: %m", gpio->nr);
+ *  log_debug("Wrote %zd bytes to UART %i", total, uart->uart_id);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __LOG_H_
+#define __LOG_H_
+
+#include <stdint.h>
+
+/*!
+ *  @brief      Levels, with the values of the syslog priorities
+ */
+#define BBDL_LOG_ERR		3
+#define BBDL_LOG_WARNING	4
+#define BBDL_LOG_NOTICE		5
+#define BBDL_LOG_INFO		6
+#define BBDL_LOG_DEBUG		7
+
+/*!
+ *  @brief      Most verbose level compiled in
+ */
+#ifndef BBDL_LOG_COMPILED
+#define BBDL_LOG_COMPILED BBDL_LOG_INFO
+#endif
+
+/*!
+ *  @brief      Conversions kept per record
+ */
+#define LOG_ARGS 6
+
+/*!
+ *  @brief      Bytes of %s strings kept per record
+ */
+#define LOG_STRINGS 72
+
+/*!
+ *  @brief      Records in the ring of each thread
+ */
+#define LOG_RING 256
+
+/*!
+ *  @brief      Most verbose level logged at run time, see log_set_level()
+ */
+extern int log_level;
+
+#define LOG_EMIT(level, ...) do { \
+		if ((level) <= log_level) { \
+			log_write((level), __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define log_err(...) LOG_EMIT(BBDL_LOG_ERR, __VA_ARGS__)
+#define log_warning(...) LOG_EMIT(BBDL_LOG_WARNING, __VA_ARGS__)
+#if BBDL_LOG_COMPILED >= BBDL_LOG_NOTICE
+#define log_notice(...) LOG_EMIT(BBDL_LOG_NOTICE, __VA_ARGS__)
+#else
+#define log_notice(...) do { } while (0)
+#endif
+#if BBDL_LOG_COMPILED >= BBDL_LOG_INFO
+#define log_info(...) LOG_EMIT(BBDL_LOG_INFO, __VA_ARGS__)
+#else
+#define log_info(...) do { } while (0)
+#endif
+#if BBDL_LOG_COMPILED >= BBDL_LOG_DEBUG
+#define log_debug(...) LOG_EMIT(BBDL_LOG_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) do { } while (0)
+#endif
+
+/*!
+ *  @brief  Stores a record, use the log_err() ... log_debug() macros instead
+ *
+ *  errno is preserved.
+ */
+extern void log_write(int level, const char *format, ...)
+		__attribute__((format(printf, 2, 3)));
+
+/*!
+ *  @brief  Sets the most verbose level logged at run time
+ */
+extern void log_set_level(int level);
+
+/*!
+ *  @brief  Starts the thread forwarding records to syslog
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t log_start(void);
+
+/*!
+ *  @brief  Forwards the pending records and stops the thread
+ */
+extern void log_stop(void);
+
+/*!
+ *  @brief  Returns the number of records dropped because a ring was full
+ */
+extern uint64_t log_dropped(void);
+
+#endif /* __LOG_H_ */
@@ -0,0 +1,463 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       loop.c 
+ *	@brief      Single threaded event loop
+ *	@author     Maximiliano Valencia
+ *	@date       4/15/2018
+ */
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+/* Event Loop Header File */
+#include "driver.h"
+#include "loop.h"
+
+/*
+ *  ======== loop_open ========
+ */
+uint8_t loop_open(loop *l, int capacity) {
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+	memset(l, 0, sizeof(*l));
+	l->capacity = capacity;
+	l->epfd = -1;
+	l->postfd = -1;
+	sigemptyset(&l->blocked);
+	pthread_mutex_init(&l->lock, NULL);
+
+	l->sources = calloc(capacity, sizeof(loop_source));
+	l->ready = calloc(capacity + 1, sizeof(struct epoll_event));
+	if (l->sources == NULL || l->ready == NULL) {
+		log_err("loop_open(): out of memory");
+		loop_close(l);
+		return -1;
+	}
+
+	l->epfd = epoll_create1(EPOLL_CLOEXEC);
+	l->postfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (l->epfd < 0 || l->postfd < 0 ||
+			epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->postfd, &ev) < 0) {
+		log_err("loop_open(): epoll: %m");
+		loop_close(l);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== loop_add ========
+ *  Registers a descriptor in the first free slot. Slots freed during the
+ *  current wakeup are not reused, as events for them may still follow.
+ */
+static loop_source *loop_add(loop *l, LOOP_SOURCE type, int fd, uint32_t events,
+		loop_fxn fxn, void *arg) {
+	struct epoll_event ev;
+	loop_source *source = NULL;
+	int i;
+
+	for (i = 0; i < l->capacity; i++) {
+		if (l->sources[i].type == LOOP_FREE && !l->sources[i].retired) {
+			source = &l->sources[i];
+			break;
+		}
+	}
+	if (source == NULL) {
+		log_err("loop_add(): no room for descriptor %d", fd);
+		errno = ENOSPC;
+		return NULL;
+	}
+
+	memset(source, 0, sizeof(*source));
+	source->fd = fd;
+	source->events = events;
+	source->fxn = fxn;
+	source->arg = arg;
+	ev.events = events;
+	ev.data.ptr = source;
+	if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		log_err("loop_add(): epoll_ctl: %m");
+		return NULL;
+	}
+	source->type = type;
+	l->count++;
+	return source;
+}
+
+/*
+ *  ======== loop_add_fd ========
+ */
+loop_source *loop_add_fd(loop *l, int fd, uint32_t events, loop_fxn fxn, void *arg) {
+	return loop_add(l, LOOP_FD, fd, events, fxn, arg);
+}
+
+/*
+ *  ======== loop_add_uart ========
+ */
+loop_source *loop_add_uart(loop *l, uart_properties *uart, uint32_t events,
+		loop_fxn fxn, void *arg) {
+	loop_source *source;
+
+	if (uart->rx != NULL && (events & EPOLLIN)) {
+		/* The reader thread already consumes everything the port receives */
+		log_err("loop_add_uart(): UART %i has a reader thread", uart->uart_id);
+		errno = EBUSY;
+		return NULL;
+	}
+	source = loop_add(l, LOOP_UART, uart->fd, events, fxn, arg);
+	if (source != NULL) {
+		source->uart = uart;
+	}
+	return source;
+}
+
+/*
+ *  ======== loop_add_gpio ========
+ */
+loop_source *loop_add_gpio(loop *l, gpio_properties *gpio, char *edge,
+		loop_fxn fxn, void *arg) {
+	loop_source *source;
+
+	if (gpio_edge(gpio, edge) != 0) {
+		return NULL;
+	}
+	source = loop_add(l, LOOP_GPIO, gpio->fd,
+			(gpio->backend == GPIO_CDEV) ? EPOLLIN : EPOLLPRI, fxn, arg);
+	if (source != NULL) {
+		source->gpio = gpio;
+	}
+	return source;
+}
+
+/*
+ *  ======== loop_add_timer ========
+ */
+loop_source *loop_add_timer(loop *l, uint32_t period_us, loop_fxn fxn, void *arg) {
+	struct itimerspec spec;
+	loop_source *source;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		log_err("loop_add_timer(): timerfd_create: %m");
+		return NULL;
+	}
+	spec.it_interval.tv_sec = period_us / 1000000;
+	spec.it_interval.tv_nsec = (long)(period_us % 1000000) * 1000;
+	spec.it_value = spec.it_interval;
+	if (period_us == 0 || timerfd_settime(fd, 0, &spec, NULL) < 0) {
+		log_err("loop_add_timer(): invalid period %u us", period_us);
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	source = loop_add(l, LOOP_TIMER, fd, EPOLLIN, fxn, arg);
+	if (source == NULL) {
+		close(fd);
+	}
+	return source;
+}
+
+/*
+ *  ======== loop_add_signal ========
+ */
+loop_source *loop_add_signal(loop *l, int signo, loop_fxn fxn, void *arg) {
+	loop_source *source;
+	sigset_t set;
+	int fd;
+
+	sigemptyset(&set);
+	if (sigaddset(&set, signo) < 0) {
+		log_err("loop_add_signal(): invalid signal %d", signo);
+		return NULL;
+	}
+	/* Blocked first, so that the signal stays pending until it is read */
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		log_err("loop_add_signal(): signalfd: %m");
+		return NULL;
+	}
+	source = loop_add(l, LOOP_SIGNAL, fd, EPOLLIN, fxn, arg);
+	if (source == NULL) {
+		close(fd);
+		return NULL;
+	}
+	source->signo = signo;
+	sigaddset(&l->blocked, signo);
+	return source;
+}
+
+/*
+ *  ======== loop_modify ========
+ */
+uint8_t loop_modify(loop *l, loop_source *source, uint32_t events) {
+	struct epoll_event ev = { .events = events, .data.ptr = source };
+
+	if (source->type == LOOP_FREE) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (source->type == LOOP_UART && source->uart->rx != NULL && (events & EPOLLIN)) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (epoll_ctl(l->epfd, EPOLL_CTL_MOD, source->fd, &ev) < 0) {
+		log_err("loop_modify(): epoll_ctl: %m");
+		return -1;
+	}
+	source->events = events;
+	return 0;
+}
+
+/*
+ *  ======== loop_drain ========
+ *  Consumes the pending expirations of a timer or the pending signals.
+ */
+static uint64_t loop_drain(loop_source *source) {
+	struct signalfd_siginfo info;
+	uint64_t count = 0;
+
+	if (source->type == LOOP_TIMER) {
+		if (read(source->fd, &count, sizeof(count)) != sizeof(count)) {
+			/* Spurious wakeup, the timer was not due */
+			count = 0;
+		}
+		return count;
+	}
+	while (read(source->fd, &info, sizeof(info)) == sizeof(info)) {
+		count++;
+	}
+	return count;
+}
+
+/*
+ *  ======== loop_remove ========
+ */
+uint8_t loop_remove(loop *l, loop_source *source) {
+	if (source->type == LOOP_FREE) {
+		errno = EINVAL;
+		return -1;
+	}
+	epoll_ctl(l->epfd, EPOLL_CTL_DEL, source->fd, NULL);
+	if (source->type == LOOP_SIGNAL) {
+		/* Only read here, the signal stays blocked until loop_close() */
+		loop_drain(source);
+	}
+	if (source->type == LOOP_TIMER || source->type == LOOP_SIGNAL) {
+		close(source->fd);
+	}
+	source->type = LOOP_FREE;
+	source->fd = -1;
+	source->retired = 1;
+	l->retired++;
+	l->count--;
+	return 0;
+}
+
+/*
+ *  ======== loop_post ========
+ */
+uint8_t loop_post(loop *l, loop_post_fxn fxn, void *arg) {
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&l->lock);
+	if (l->head - l->tail == LOOP_POST_MAX) {
+		pthread_mutex_unlock(&l->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+	l->posted[l->head % LOOP_POST_MAX].fxn = fxn;
+	l->posted[l->head % LOOP_POST_MAX].arg = arg;
+	l->head++;
+	pthread_mutex_unlock(&l->lock);
+	if (write(l->postfd, &one, sizeof(one)) < 0) {
+		/* The counter is already non zero, the loop will wake up anyway */
+	}
+	return 0;
+}
+
+/*
+ *  ======== loop_run_posted ========
+ *  Runs the callbacks queued before the wakeup. The ones they post run in
+ *  the next wakeup, so a callback that posts itself cannot starve the loop.
+ */
+static int loop_run_posted(loop *l) {
+	loop_post_fxn fxn;
+	uint64_t wakeups;
+	void *arg;
+	int count = 0;
+	unsigned int last;
+
+	if (read(l->postfd, &wakeups, sizeof(wakeups)) < 0) {
+		/* Already drained by a previous wakeup */
+	}
+	pthread_mutex_lock(&l->lock);
+	last = l->head;
+	while (l->tail != last) {
+		fxn = l->posted[l->tail % LOOP_POST_MAX].fxn;
+		arg = l->posted[l->tail % LOOP_POST_MAX].arg;
+		l->tail++;
+		pthread_mutex_unlock(&l->lock);
+		fxn(l, arg);
+		count++;
+		pthread_mutex_lock(&l->lock);
+	}
+	pthread_mutex_unlock(&l->lock);
+	return count;
+}
+
+/*
+ *  ======== loop_once ========
+ */
+int loop_once(loop *l, int timeout) {
+	struct epoll_event *ready = l->ready;
+	struct timespec now;
+	int count = 0;
+	int edges;
+	int n;
+	int i;
+	int j;
+
+	n = epoll_wait(l->epfd, ready, l->capacity + 1, timeout);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		log_err("loop_once(): epoll_wait: %m");
+		return -1;
+	}
+	if (n > 0) {
+		l->wakeups++;
+	}
+
+	for (i = 0; i < n; i++) {
+		loop_source *source = ready[i].data.ptr;
+
+		if (source == NULL) {
+			count += loop_run_posted(l);
+			continue;
+		}
+		/* A previous callback may have removed the source */
+		if (source->type == LOOP_FREE) {
+			continue;
+		}
+		source->revents = ready[i].events;
+		switch (source->type) {
+		case LOOP_GPIO:
+			/* Every edge queued by the kernel, one callback each */
+			edges = gpio_read_events(source->gpio, &now, source->edges, GPIO_CDEV_EVENTS);
+			if (edges <= 0) {
+				log_err("loop_once(): could not read GPIO %d", source->gpio->nr);
+				continue;
+			}
+			source->count = edges;
+			for (j = 0; j < edges && source->type == LOOP_GPIO; j++) {
+				source->event = source->edges[j];
+				source->calls++;
+				count++;
+				if (source->fxn != NULL) {
+					source->fxn(l, source, source->arg);
+				}
+			}
+			continue;
+		case LOOP_TIMER:
+		case LOOP_SIGNAL:
+			source->count = loop_drain(source);
+			if (source->count == 0) {
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+		source->calls++;
+		count++;
+		if (source->fxn != NULL) {
+			source->fxn(l, source, source->arg);
+		}
+	}
+
+	if (l->retired > 0) {
+		for (i = 0; i < l->capacity; i++) {
+			l->sources[i].retired = 0;
+		}
+		l->retired = 0;
+	}
+	return count;
+}
+
+/*
+ *  ======== loop_run ========
+ */
+uint8_t loop_run(loop *l) {
+	l->running = 1;
+	while (l->running) {
+		if (loop_once(l, -1) < 0) {
+			l->running = 0;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ *  ======== loop_stop ========
+ */
+void loop_stop(loop *l) {
+	uint64_t one = 1;
+
+	l->running = 0;
+	if (write(l->postfd, &one, sizeof(one)) < 0) {
+		/* The counter is already non zero, the loop will wake up anyway */
+	}
+}
+
+/*
+ *  ======== loop_close ========
+ */
+uint8_t loop_close(loop *l) {
+	int i;
+
+	for (i = 0; l->sources != NULL && i < l->capacity; i++) {
+		if (l->sources[i].type != LOOP_FREE) {
+			loop_remove(l, &l->sources[i]);
+		}
+	}
+	/* Pending signals were read by loop_remove(), later ones get their usual action */
+	pthread_sigmask(SIG_UNBLOCK, &l->blocked, NULL);
+	if (l->epfd >= 0) {
+		close(l->epfd);
+	}
+	if (l->postfd >= 0) {
+		close(l->postfd);
+	}
+	pthread_mutex_destroy(&l->lock);
+	free(l->sources);
+	free(l->ready);
+	memset(l, 0, sizeof(*l));
+	l->epfd = -1;
+	l->postfd = -1;
+	return 0;
+}
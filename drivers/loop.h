@@ -0,0 +1,327 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       loop.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/15/2018
+ *  @brief      Single threaded event loop
+ *
+ *  The event loop header file should be included in an application as
+ *  follows:
+ *  @code
+ *  #include "drivers/loop.h"
+ *  @endcode
+ *
+ *  # Overview #
+ *  The loop runs every source of an application from one thread, blocked
+ *  in a single epoll instance while there is nothing to do. Each source has
+ *  its own callback:
+ *
+ *  - UART ports, when they become readable or writable
+ *  - GPIO edges, read with gpio_read_events() before the callback, which
+ *    runs once per edge
+ *  - periodic timers, backed by a timerfd
+ *  - signals such as SIGINT and SIGTERM, received through a signalfd
+ *  - posted callbacks, queued by other threads with loop_post()
+ *  - any other descriptor, for example the epoll instance of a
+ *    gpio_dispatcher
+ *
+ *  SPI transfers are synchronous ioctls and have no descriptor to wait on.
+ *  A thread doing long transfers reports their completion with loop_post().
+ *
+ *  Signals handled by the loop are blocked in the thread that adds them and
+ *  must stay blocked in every other thread, otherwise one of them would
+ *  take the signal instead of the signalfd. Threads inherit the mask of
+ *  their creator, so signal sources are added before opening the drivers
+ *  that start threads. The logger thread blocks every signal.
+ *
+ *  Callbacks run one at a time in the loop thread and must not block. A
+ *  callback may add and remove sources, including its own.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  loop events;
+ *
+ *  loop_open(&events, 16);
+ *  loop_add_signal(&events, SIGINT, stopFxn, NULL);
+ *  loop_add_timer(&events, 1000000, blinkFxn, NULL);
+ *  loop_add_uart(&events, uart, EPOLLIN, rxFxn, NULL);
+ *
+ *  // Returns after loop_stop()
+ *  loop_run(&events);
+ *  loop_close(&events);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __LOOP_H_
+#define __LOOP_H_
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "gpio.h"
+#include "gpio_cdev.h"
+#include "uart.h"
+
+/*!
+ *  @brief      Callbacks queued by loop_post() and not yet run
+ */
+#define LOOP_POST_MAX 64
+
+/*!
+ *  @brief      Kinds of source
+ */
+typedef enum {
+	LOOP_FREE = 0,
+	LOOP_FD = 1,
+	LOOP_UART = 2,
+	LOOP_GPIO = 3,
+	LOOP_TIMER = 4,
+	LOOP_SIGNAL = 5
+} LOOP_SOURCE;
+
+struct loop;
+struct loop_source;
+
+/*!
+ *  @brief      Callback of a source
+ *
+ *  The fields of \a source describe what happened: revents for descriptors
+ *  and UART ports, event for GPIO pins, count for timers and signals.
+ */
+typedef void (*loop_fxn)(struct loop *l, struct loop_source *source, void *arg);
+
+/*!
+ *  @brief      Posted callback
+ */
+typedef void (*loop_post_fxn)(struct loop *l, void *arg);
+
+/*!
+ *  @brief      Registered source
+ */
+typedef struct loop_source {
+	LOOP_SOURCE type;
+	int fd;						/*!< @brief watched descriptor */
+	uint32_t events;			/*!< @brief epoll events waited for */
+	uint32_t revents;			/*!< @brief epoll events of the last wakeup */
+	loop_fxn fxn;
+	void *arg;
+	uart_properties *uart;		/*!< @brief LOOP_UART only */
+	gpio_properties *gpio;		/*!< @brief LOOP_GPIO only */
+	gpio_event event;			/*!< @brief edge of the callback, LOOP_GPIO only */
+	gpio_event edges[GPIO_CDEV_EVENTS];	/*!< @brief edges of the last wakeup, LOOP_GPIO only */
+	int signo;					/*!< @brief LOOP_SIGNAL only */
+	uint64_t count;				/*!< @brief expirations, signals or edges of the last wakeup */
+	uint64_t calls;				/*!< @brief times fxn was called */
+	uint8_t retired;			/*!< @brief removed during the current wakeup */
+} loop_source;
+
+/*!
+ *  @brief      Event loop structure type definition
+ */
+typedef struct loop {
+	int epfd;
+	int postfd;					/*!< @brief eventfd of loop_post() and loop_stop() */
+	int capacity;				/*!< @brief maximum number of sources */
+	int count;					/*!< @brief registered sources */
+	volatile int running;
+	int retired;				/*!< @brief sources removed during the current wakeup */
+	uint64_t wakeups;
+	loop_source *sources;
+	void *ready;				/*!< @brief epoll events of a wakeup */
+	sigset_t blocked;			/*!< @brief signals blocked by loop_add_signal() */
+	pthread_mutex_t lock;		/*!< @brief protects the posted callbacks */
+	struct {
+		loop_post_fxn fxn;
+		void *arg;
+	} posted[LOOP_POST_MAX];
+	unsigned int head;			/*!< @brief callbacks posted */
+	unsigned int tail;			/*!< @brief callbacks run */
+} loop;
+
+/*!
+ *  @brief  Creates an event loop
+ *
+ *  @param  l           A loop structure
+ *  @param  capacity    Maximum number of sources
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t loop_open(loop *l, int capacity);
+
+/*!
+ *  @brief  Watches a descriptor
+ *
+ *  @param  l       A loop structure
+ *  @param  fd      The descriptor, owned by the caller
+ *  @param  events  epoll events, EPOLLIN and EPOLLOUT usually
+ *  @param  fxn     Callback, revents holds the events that were ready
+ *  @param  arg     Passed to fxn
+ *
+ *  @return Returns the source, NULL if an error ocurred
+ */
+extern loop_source *loop_add_fd(loop *l, int fd, uint32_t events, loop_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Watches a UART port
+ *
+ *  The callback reads with uart_read() and writes with uart_write(). Ports
+ *  with a reader thread (UART_RX_THREAD) cannot be read by the loop. Only
+ *  wait for EPOLLOUT while there is output pending, see loop_modify(), as
+ *  an idle port is always writable.
+ *
+ *  @pre    uart_open() has been called on \a uart
+ *
+ *  @param  l       A loop structure
+ *  @param  uart    A uart_properties structure
+ *  @param  events  EPOLLIN, EPOLLOUT or both
+ *  @param  fxn     Callback
+ *  @param  arg     Passed to fxn
+ *
+ *  @return Returns the source, NULL if an error ocurred
+ */
+extern loop_source *loop_add_uart(loop *l, uart_properties *uart, uint32_t events,
+		loop_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Watches the edges of a GPIO
+ *
+ *  The edge is configured with gpio_edge(). Pins that need the debounce
+ *  filter are better served by a gpio_dispatcher, whose epfd can be added
+ *  with loop_add_fd().
+ *
+ *  @pre    gpio_open() has been called on \a gpio
+ *
+ *  @param  l       A loop structure
+ *  @param  gpio    A gpio_properties structure
+ *  @param  edge    "rising", "falling" or "both"
+ *  @param  fxn     Callback, event holds the edge. Called once per edge,
+ *                  count holds the edges read in the wakeup
+ *  @param  arg     Passed to fxn
+ *
+ *  @return Returns the source, NULL if an error ocurred
+ */
+extern loop_source *loop_add_gpio(loop *l, gpio_properties *gpio, char *edge,
+		loop_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Adds a periodic timer
+ *
+ *  The first expiration is one period from now. If the loop falls behind,
+ *  count tells how many periods passed since the last callback.
+ *
+ *  @param  l           A loop structure
+ *  @param  period_us   Period in microseconds
+ *  @param  fxn         Callback
+ *  @param  arg         Passed to fxn
+ *
+ *  @return Returns the source, NULL if an error ocurred
+ */
+extern loop_source *loop_add_timer(loop *l, uint32_t period_us, loop_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Receives a signal in the loop
+ *
+ *  The signal is blocked in the calling thread until loop_close(). The
+ *  callback runs in the loop thread, so it may do anything a normal
+ *  callback does, unlike a signal handler.
+ *
+ *  @param  l       A loop structure
+ *  @param  signo   SIGINT, SIGTERM, ...
+ *  @param  fxn     Callback, count holds the signals received
+ *  @param  arg     Passed to fxn
+ *
+ *  @return Returns the source, NULL if an error ocurred
+ */
+extern loop_source *loop_add_signal(loop *l, int signo, loop_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Changes the events waited for on a descriptor or UART port
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t loop_modify(loop *l, loop_source *source, uint32_t events);
+
+/*!
+ *  @brief  Removes a source
+ *
+ *  Timer and signal descriptors are closed, the others belong to the
+ *  caller. Events of the source already read in the current wakeup are
+ *  discarded.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t loop_remove(loop *l, loop_source *source);
+
+/*!
+ *  @brief  Runs a callback in the loop thread
+ *
+ *  Can be called from any thread, but not from a signal handler.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred. Fails
+ *          with EAGAIN when LOOP_POST_MAX callbacks are already queued.
+ */
+extern uint8_t loop_post(loop *l, loop_post_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Waits for one batch of events and runs their callbacks
+ *
+ *  @param  l       A loop structure
+ *  @param  timeout Milliseconds to wait, -1 waits forever
+ *
+ *  @return Returns the number of callbacks invoked, -1 if an error ocurred
+ */
+extern int loop_once(loop *l, int timeout);
+
+/*!
+ *  @brief  Runs callbacks until loop_stop() is called
+ *
+ *  The batch being handled when loop_stop() is called is finished, along
+ *  with the callbacks posted before it.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t loop_run(loop *l);
+
+/*!
+ *  @brief  Makes loop_run() return
+ *
+ *  Can be called from a callback, from another thread or from a signal
+ *  handler.
+ */
+extern void loop_stop(loop *l);
+
+/*!
+ *  @brief  Destroys an event loop
+ *
+ *  Closes the timers and signal descriptors and unblocks the signals
+ *  blocked by loop_add_signal(). UART ports and GPIOs are left open.
+ *
+ *  @pre    loop_run() has returned
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t loop_close(loop *l);
+
+#endif /* __LOOP_H_ */
@@ -0,0 +1,535 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       modbus.c 
+ *	@brief      Modbus RTU master
+ *	@author     Maximiliano Valencia
+ *	@date       4/17/2018
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+/* UART Driver Header File */
+#include "driver.h"
+#include "uart_frame.h"
+#include "modbus.h"
+
+/*
+ *  ======== modbus_sleep_until ========
+ */
+static void modbus_sleep_until(int64_t ns) {
+	struct timespec deadline;
+
+	if (ns <= stats_now()) {
+		return;
+	}
+	deadline.tv_sec = ns / 1000000000;
+	deadline.tv_nsec = ns % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+		/* Interrupted by a signal, the deadline has not moved */
+	}
+}
+
+/*
+ *  ======== modbus_open ========
+ */
+uint8_t modbus_open(modbus_master *master) {
+	uint32_t bits;
+	int i;
+
+	if (master->uart == NULL || master->uart->rx != NULL
+			|| master->uart->vmin != 0 || master->uart->vtime != 0
+			|| master->uart->tx_mode != UART_TX_SYNC) {
+		/*
+		 * Responses are timed as they arrive, which needs non blocking reads,
+		 * and from the end of the request, which needs it written by the call
+		 */
+		log_err("modbus_open(): needs a non blocking UART in UART_RX_POLL and UART_TX_SYNC modes");
+		errno = EINVAL;
+		return -1;
+	}
+	if (master->timeout_ms == 0) {
+		master->timeout_ms = MODBUS_TIMEOUT_MS;
+	}
+	if (master->turnaround_ms == 0) {
+		master->turnaround_ms = MODBUS_TURNAROUND_MS;
+	}
+	master->char_ns = uart_char_ns(master->uart);
+	bits = 1 + (master->uart->data_bits ? master->uart->data_bits : 8) +
+			(master->uart->parity != UART_PARITY_NONE ? 1 : 0) +
+			(master->uart->stop_bits == 2 ? 2 : 1);
+	if ((uint64_t)master->char_ns * 19200 < (uint64_t)bits * 1000000000) {
+		/* Fixed above 19200 bit/s, MODBUS over Serial Line 2.5.1.1 */
+		master->t35_us = 1750;
+	} else {
+		master->t35_us = (master->char_ns * 7 / 2 + 999) / 1000;
+	}
+	if (master->gap_us == 0) {
+		/* The UART only hands over a partial FIFO after 4 silent characters */
+		master->gap_us = master->t35_us + (master->char_ns * 4 + 999) / 1000;
+	}
+	master->idle_ns = 0;
+	master->running = 0;
+	master->count = 0;
+	for (i = 0; i < MODBUS_POLLS; i++) {
+		master->polls[i] = NULL;
+	}
+	master->stats = calloc(MODBUS_SLAVES, sizeof(modbus_slave_stats));
+	if (master->stats == NULL) {
+		log_err("modbus_open(): out of memory");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== modbus_receive ========
+ *  Reads a response until \a expected bytes arrived, the line stays silent
+ *  for gap_us, or nothing arrives before \a deadline.
+ */
+static int modbus_receive(modbus_master *master, uint8_t *rsp, size_t expected,
+		int64_t deadline) {
+	struct pollfd pfd = { .fd = master->uart->fd, .events = POLLIN };
+	struct timespec wait;
+	int64_t now, limit;
+	size_t got = 0;
+	int n;
+
+	for (;;) {
+		now = stats_now();
+		limit = (got == 0) ? deadline : master->idle_ns + (int64_t)master->gap_us * 1000;
+		if (now >= limit) {
+			break;
+		}
+		wait.tv_sec = (limit - now) / 1000000000;
+		wait.tv_nsec = (limit - now) % 1000000000;
+		n = ppoll(&pfd, 1, &wait, NULL);
+		if (n < 0 && errno != EINTR) {
+			return -1;
+		}
+		if (n <= 0) {
+			continue;
+		}
+		n = uart_read(master->uart, rsp + got, MODBUS_FRAME_MAX - got);
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			continue;
+		}
+		got += n;
+		master->idle_ns = stats_now();
+		/* An exception response is shorter than the expected one */
+		if (got >= 2 && (rsp[1] & 0x80)) {
+			expected = 5;
+		}
+		if ((expected != 0 && got >= expected) || got == MODBUS_FRAME_MAX) {
+			break;
+		}
+	}
+	return got;
+}
+
+/*
+ *  ======== modbus_check ========
+ *  Returns 0 for a valid response to \a req, otherwise the errno to report.
+ */
+static int modbus_check(const uint8_t *req, const uint8_t *rsp, int got, size_t expected,
+		modbus_slave_stats *stats) {
+	if (got == 0) {
+		stats->timeouts++;
+		return ETIMEDOUT;
+	}
+	if (got < 5 || rsp[0] != req[0] ||
+			uart_crc16(UART_CRC16_INIT, rsp, got - 2) != (rsp[got - 2] | rsp[got - 1] << 8)) {
+		stats->crc_errors++;
+		return EBADMSG;
+	}
+	if (rsp[1] == (req[1] | 0x80)) {
+		stats->exceptions++;
+		stats->last_exception = rsp[2];
+		return EPROTO;
+	}
+	if (rsp[1] != req[1] || (size_t)got != expected) {
+		stats->crc_errors++;
+		return EBADMSG;
+	}
+	return 0;
+}
+
+/*
+ *  ======== modbus_transact ========
+ *  Sends a request, CRC appended here, and waits for its response.
+ */
+static int modbus_transact(modbus_master *master, uint8_t *req, size_t length,
+		uint8_t *rsp, size_t expected) {
+	modbus_slave_stats *stats = &master->stats[req[0]];
+	uint16_t crc = uart_crc16(UART_CRC16_INIT, req, length);
+	int64_t sent, now;
+	int status = 0;
+	int attempt;
+	int got;
+
+	/* Low byte first, unlike the rest of the frame */
+	req[length++] = crc & 0xFF;
+	req[length++] = crc >> 8;
+	for (attempt = 0; attempt <= master->retries; attempt++) {
+		/* The line must stay silent for t3.5 between frames */
+		modbus_sleep_until(master->idle_ns + (int64_t)master->t35_us * 1000);
+		/* Leftovers of an earlier late response */
+		tcflush(master->uart->fd, TCIFLUSH);
+		if (uart_write(master->uart, (char *)req, length) != 0) {
+			stats_record(&stats->response, 0, -1, expected);
+			return -1;
+		}
+		/* The port sends on its own, the request ends length characters later,
+		 * unless uart_write() already waited for it to drive DE */
+		sent = stats_now();
+		if (master->uart->rs485 != UART_RS485_GPIO) {
+			sent += (int64_t)length * master->char_ns;
+		}
+		master->idle_ns = sent;
+		if (req[0] == 0) {
+			master->idle_ns += (int64_t)master->turnaround_ms * 1000000;
+			return 0;
+		}
+
+		got = modbus_receive(master, rsp, expected,
+				sent + (int64_t)master->timeout_ms * 1000000);
+		if (got < 0) {
+			stats_record(&stats->response, 0, -1, expected);
+			return -1;
+		}
+		status = modbus_check(req, rsp, got, expected, stats);
+		if (status == 0) {
+			now = stats_now();
+			stats_record(&stats->response, sent < now ? sent : now, got, expected);
+			return got;
+		}
+		errno = status;
+		stats_record(&stats->response, 0, -1, expected);
+		if (status == EPROTO) {
+			/* The slave understood and refused, asking again will not help */
+			break;
+		}
+	}
+	errno = status;
+	return -1;
+}
+
+/*
+ *  ======== modbus_read ========
+ */
+uint8_t modbus_read(modbus_master *master, uint8_t slave, MODBUS_FUNCTION function,
+		uint16_t address, uint16_t count, uint16_t *values) {
+	uint8_t req[8], rsp[MODBUS_FRAME_MAX];
+	int bits = (function == MODBUS_READ_COILS || function == MODBUS_READ_DISCRETE);
+	size_t data;
+	int i;
+
+	if (slave == 0 || slave >= MODBUS_SLAVES || function < MODBUS_READ_COILS ||
+			function > MODBUS_READ_INPUT || count == 0 ||
+			count > (bits ? MODBUS_BITS_MAX : MODBUS_REGISTERS_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	data = bits ? (count + 7) / 8 : count * 2;
+	req[0] = slave;
+	req[1] = function;
+	req[2] = address >> 8;
+	req[3] = address & 0xFF;
+	req[4] = count >> 8;
+	req[5] = count & 0xFF;
+	if (modbus_transact(master, req, 6, rsp, 5 + data) < 0) {
+		return -1;
+	}
+	if (rsp[2] != data) {
+		master->stats[slave].crc_errors++;
+		errno = EBADMSG;
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		if (bits) {
+			values[i] = (rsp[3 + i / 8] >> (i % 8)) & 1;
+		} else {
+			values[i] = rsp[3 + 2 * i] << 8 | rsp[4 + 2 * i];
+		}
+	}
+	return 0;
+}
+
+/*
+ *  ======== modbus_write ========
+ */
+uint8_t modbus_write(modbus_master *master, uint8_t slave, uint16_t address,
+		uint16_t count, const uint16_t *values) {
+	uint8_t req[MODBUS_FRAME_MAX], rsp[MODBUS_FRAME_MAX];
+	size_t length;
+	int i;
+
+	/* 123 registers fill the largest request frame */
+	if (slave >= MODBUS_SLAVES || count == 0 || count > 123) {
+		errno = EINVAL;
+		return -1;
+	}
+	req[0] = slave;
+	req[2] = address >> 8;
+	req[3] = address & 0xFF;
+	if (count == 1) {
+		req[1] = MODBUS_WRITE_REGISTER;
+		req[4] = values[0] >> 8;
+		req[5] = values[0] & 0xFF;
+		length = 6;
+	} else {
+		req[1] = MODBUS_WRITE_REGISTERS;
+		req[4] = count >> 8;
+		req[5] = count & 0xFF;
+		req[6] = count * 2;
+		for (i = 0; i < count; i++) {
+			req[7 + 2 * i] = values[i] >> 8;
+			req[8 + 2 * i] = values[i] & 0xFF;
+		}
+		length = 7 + count * 2;
+	}
+	/* Both responses are 8 bytes, an echo of the first 6 of the request */
+	if (modbus_transact(master, req, length, rsp, 8) < 0) {
+		return -1;
+	}
+	if (slave != 0 && memcmp(req, rsp, 6) != 0) {
+		master->stats[slave].crc_errors++;
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== modbus_add_poll ========
+ */
+uint8_t modbus_add_poll(modbus_master *master, modbus_poll *poll) {
+	int bits = (poll->function == MODBUS_READ_COILS || poll->function == MODBUS_READ_DISCRETE);
+	int i;
+
+	if (poll->slave == 0 || poll->slave >= MODBUS_SLAVES ||
+			poll->function < MODBUS_READ_COILS || poll->function > MODBUS_READ_INPUT ||
+			poll->count == 0 || poll->count > (bits ? MODBUS_BITS_MAX : MODBUS_REGISTERS_MAX) ||
+			poll->period_ms == 0 || poll->values == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < MODBUS_POLLS; i++) {
+		if (master->polls[i] == NULL) {
+			poll->due_ns = stats_now();
+			master->polls[i] = poll;
+			master->count++;
+			return 0;
+		}
+	}
+	log_err("modbus_add_poll(): no room for slave %d", poll->slave);
+	errno = ENOSPC;
+	return -1;
+}
+
+/*
+ *  ======== modbus_remove_poll ========
+ */
+uint8_t modbus_remove_poll(modbus_master *master, modbus_poll *poll) {
+	int i;
+
+	for (i = 0; i < MODBUS_POLLS; i++) {
+		if (master->polls[i] == poll) {
+			master->polls[i] = NULL;
+			master->count--;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ *  ======== modbus_next_due ========
+ */
+int64_t modbus_next_due(modbus_master *master) {
+	int64_t first = -1;
+	int64_t now;
+	int i;
+
+	for (i = 0; i < MODBUS_POLLS; i++) {
+		modbus_poll *poll = master->polls[i];
+
+		if (poll != NULL && (first < 0 || poll->due_ns < first)) {
+			first = poll->due_ns;
+		}
+	}
+	if (first < 0) {
+		return -1;
+	}
+	now = stats_now();
+	return first > now ? first - now : 0;
+}
+
+/*
+ *  ======== modbus_poll_once ========
+ */
+int modbus_poll_once(modbus_master *master) {
+	modbus_poll *group[MODBUS_MERGE_MAX];
+	uint16_t values[MODBUS_BITS_MAX];
+	modbus_poll *best = NULL;
+	int64_t now = stats_now();
+	int count, added, limit, status;
+	uint32_t low, high;
+	int i, j;
+
+	for (i = 0; i < MODBUS_POLLS; i++) {
+		modbus_poll *poll = master->polls[i];
+
+		if (poll == NULL || poll->due_ns > now) {
+			continue;
+		}
+		if (best == NULL || poll->priority > best->priority ||
+				(poll->priority == best->priority && poll->due_ns < best->due_ns)) {
+			best = poll;
+		}
+	}
+	if (best == NULL) {
+		return 0;
+	}
+
+	/* Grow the range with the due polls it touches, until nothing else fits */
+	group[0] = best;
+	count = 1;
+	low = best->address;
+	high = best->address + best->count;
+	limit = (best->function == MODBUS_READ_COILS || best->function == MODBUS_READ_DISCRETE) ?
+			MODBUS_BITS_MAX : MODBUS_REGISTERS_MAX;
+	do {
+		added = 0;
+		for (i = 0; i < MODBUS_POLLS && count < MODBUS_MERGE_MAX; i++) {
+			modbus_poll *poll = master->polls[i];
+			uint32_t start, end;
+
+			if (poll == NULL || poll->due_ns > now || poll->slave != best->slave ||
+					poll->function != best->function) {
+				continue;
+			}
+			for (j = 0; j < count; j++) {
+				if (group[j] == poll) {
+					break;
+				}
+			}
+			if (j < count) {
+				continue;
+			}
+			start = poll->address < low ? poll->address : low;
+			end = poll->address + poll->count > high ? poll->address + poll->count : high;
+			if (poll->address > high + master->merge_gap ||
+					poll->address + poll->count + master->merge_gap < low ||
+					end - start > (uint32_t)limit) {
+				continue;
+			}
+			group[count++] = poll;
+			low = start;
+			high = end;
+			added = 1;
+		}
+	} while (added);
+
+	status = modbus_read(master, best->slave, best->function, low, high - low, values) ? errno : 0;
+
+	for (i = 0; i < count; i++) {
+		modbus_poll *poll = group[i];
+
+		if (status == 0) {
+			memcpy(poll->values, values + (poll->address - low), poll->count * sizeof(uint16_t));
+			poll->reads++;
+			poll->merged += (count > 1);
+		} else {
+			poll->failures++;
+		}
+		poll->due_ns += (int64_t)poll->period_ms * 1000000;
+		if (poll->due_ns <= now) {
+			/* Late by a whole period, skip the missed reads */
+			poll->due_ns = now + (int64_t)poll->period_ms * 1000000;
+		}
+		if (poll->fxn != NULL) {
+			poll->fxn(master, poll, status, poll->arg);
+		}
+	}
+	return 1;
+}
+
+/*
+ *  ======== modbus_run ========
+ */
+uint8_t modbus_run(modbus_master *master) {
+	struct timespec wait;
+	int64_t due;
+
+	master->running = 1;
+	while (master->running) {
+		due = modbus_next_due(master);
+		if (due != 0) {
+			/* Wakes up at least every 100 ms to notice modbus_stop() */
+			if (due < 0 || due > 100000000) {
+				due = 100000000;
+			}
+			wait.tv_sec = 0;
+			wait.tv_nsec = due;
+			nanosleep(&wait, NULL);
+			continue;
+		}
+		modbus_poll_once(master);
+	}
+	return 0;
+}
+
+/*
+ *  ======== modbus_stop ========
+ */
+void modbus_stop(modbus_master *master) {
+	master->running = 0;
+}
+
+/*
+ *  ======== modbus_get_stats ========
+ */
+uint8_t modbus_get_stats(modbus_master *master, uint8_t slave,
+		modbus_slave_stats *stats, int reset) {
+	if (slave >= MODBUS_SLAVES) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(stats, &master->stats[slave], sizeof(*stats));
+	if (reset) {
+		memset(&master->stats[slave], 0, sizeof(*stats));
+	}
+	return 0;
+}
+
+/*
+ *  ======== modbus_close ========
+ */
+uint8_t modbus_close(modbus_master *master) {
+	free(master->stats);
+	master->stats = NULL;
+	master->count = 0;
+	return 0;
+}
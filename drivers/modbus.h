@@ -0,0 +1,297 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       modbus.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/17/2018
+ *  @brief      Modbus RTU master
+ *
+ *  The Modbus header file should be included in an application as follows:
+ *  @code
+ *  #include "drivers/modbus.h"
+ *  @endcode
+ *
+ *  # Overview #
+ *  The master talks to Modbus RTU slaves through a UART opened with
+ *  uart_open() in UART_RX_POLL and UART_TX_SYNC modes, with vmin and vtime
+ *  zero: the response timeout starts when uart_write() returns, so the
+ *  request must have been written by then. Frames are separated by 3.5
+ *  character times of silence, computed from the line settings of the
+ *  port; above 19200 bit/s the fixed 1750 us of the specification is used.
+ *
+ *  A request goes out as soon as the line has been silent for t3.5, and a
+ *  response is complete as soon as its expected length has arrived, so
+ *  nothing waits longer than the protocol needs. When the length is not
+ *  known the response ends after gap_us of silence.
+ *
+ *  Polls are reads repeated with a period. modbus_poll_once() runs the
+ *  most urgent due poll, merged with the other due polls of the same slave
+ *  and function whose ranges are adjacent, or apart by at most merge_gap
+ *  addresses, into a single request.
+ *
+ *  Every slave has response time, timeout, CRC error and exception
+ *  counters, see modbus_get_stats().
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  modbus_master master;
+ *  modbus_poll level = { .slave = 3, .function = MODBUS_READ_HOLDING,
+ *          .address = 100, .count = 4, .period_ms = 50, .values = regs };
+ *
+ *  master.uart = uart;
+ *  master.timeout_ms = 100;
+ *  modbus_open(&master);
+ *  modbus_add_poll(&master, &level);
+ *
+ *  // Returns after modbus_stop()
+ *  modbus_run(&master);
+ *  modbus_close(&master);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __MODBUS_H_
+#define __MODBUS_H_
+
+#include <stdint.h>
+#include "stats.h"
+#include "uart.h"
+
+/*!
+ *  @brief      Slave addresses, 0 is the broadcast address
+ */
+#define MODBUS_SLAVES 248
+
+/*!
+ *  @brief      Largest RTU frame
+ */
+#define MODBUS_FRAME_MAX 256
+
+/*!
+ *  @brief      Registers and bits one read request can ask for
+ */
+#define MODBUS_REGISTERS_MAX 125
+#define MODBUS_BITS_MAX 2000
+
+/*!
+ *  @brief      Polls a master can schedule
+ */
+#define MODBUS_POLLS 128
+
+/*!
+ *  @brief      Polls merged into one request
+ */
+#define MODBUS_MERGE_MAX 16
+
+/*!
+ *  @brief      Defaults of the master settings
+ */
+#define MODBUS_TIMEOUT_MS 100
+#define MODBUS_TURNAROUND_MS 100
+
+/*!
+ *  @brief      Function codes
+ */
+typedef enum {
+	MODBUS_READ_COILS = 1,
+	MODBUS_READ_DISCRETE = 2,
+	MODBUS_READ_HOLDING = 3,
+	MODBUS_READ_INPUT = 4,
+	MODBUS_WRITE_REGISTER = 6,
+	MODBUS_WRITE_REGISTERS = 16
+} MODBUS_FUNCTION;
+
+/*!
+ *  @brief      Counters of one slave
+ *
+ *  response.ops counts the transactions, response.errors the failed ones
+ *  and the histogram the time from the end of the request to the end of
+ *  the response.
+ */
+typedef struct {
+	stats_op response;
+	uint64_t timeouts;
+	uint64_t crc_errors;		/*!< @brief also counts malformed responses */
+	uint64_t exceptions;
+	uint8_t last_exception;		/*!< @brief code of the last exception response */
+} modbus_slave_stats;
+
+struct modbus_master;
+struct modbus_poll;
+
+/*!
+ *  @brief      Callback run after every poll
+ *
+ *  \a status is 0 when values were updated, otherwise ETIMEDOUT, EBADMSG
+ *  for a corrupted response, EPROTO for an exception or the errno of a
+ *  failed UART call.
+ */
+typedef void (*modbus_fxn)(struct modbus_master *master, struct modbus_poll *poll,
+		int status, void *arg);
+
+/*!
+ *  @brief      Periodic read
+ *
+ *  The caller fills in the fields up to arg, the rest is kept by the
+ *  scheduler.
+ */
+typedef struct modbus_poll {
+	uint8_t slave;
+	MODBUS_FUNCTION function;	/*!< @brief one of the read functions */
+	uint16_t address;
+	uint16_t count;
+	uint32_t period_ms;
+	uint8_t priority;			/*!< @brief among due polls the highest runs first */
+	uint16_t *values;			/*!< @brief receives count values, bits as 0 or 1 */
+	modbus_fxn fxn;
+	void *arg;
+	int64_t due_ns;				/*!< @brief CLOCK_MONOTONIC time of the next read */
+	uint64_t reads;
+	uint64_t failures;
+	uint64_t merged;			/*!< @brief reads shared with another poll */
+} modbus_poll;
+
+/*!
+ *  @brief      Modbus master structure type definition
+ *
+ *  The caller fills in uart and the settings, zero selects the default.
+ */
+typedef struct modbus_master {
+	uart_properties *uart;
+	uint32_t timeout_ms;		/*!< @brief wait for a response, 0 means MODBUS_TIMEOUT_MS */
+	uint8_t retries;			/*!< @brief extra attempts after a timeout or a bad response */
+	uint16_t merge_gap;			/*!< @brief unused addresses a merged read may span */
+	uint32_t gap_us;			/*!< @brief silence that ends a response of unknown length,
+									0 means t3.5 plus the receive FIFO timeout */
+	uint32_t turnaround_ms;		/*!< @brief wait after a broadcast, 0 means MODBUS_TURNAROUND_MS */
+	uint32_t char_ns;			/*!< @brief time of one character */
+	uint32_t t35_us;			/*!< @brief inter-frame silence */
+	int64_t idle_ns;			/*!< @brief time the line became silent */
+	volatile int running;
+	int count;
+	modbus_poll *polls[MODBUS_POLLS];
+	modbus_slave_stats *stats;	/*!< @brief MODBUS_SLAVES entries */
+} modbus_master;
+
+/*!
+ *  @brief  Prepares a master
+ *
+ *  @pre    uart_open() has been called on uart, without a reader or writer
+ *          thread and with vmin and vtime zero
+ *
+ *  @param  master  A modbus_master structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t modbus_open(modbus_master *master);
+
+/*!
+ *  @brief  Reads registers or bits
+ *
+ *  @param  master      A modbus_master structure
+ *  @param  slave       1 to 247
+ *  @param  function    One of the read functions
+ *  @param  address     First register or bit
+ *  @param  count       Up to MODBUS_REGISTERS_MAX registers or MODBUS_BITS_MAX bits
+ *  @param  values      Receives count values, bits as 0 or 1
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred, with
+ *          errno set as described for modbus_fxn
+ */
+extern uint8_t modbus_read(modbus_master *master, uint8_t slave, MODBUS_FUNCTION function,
+		uint16_t address, uint16_t count, uint16_t *values);
+
+/*!
+ *  @brief  Writes holding registers
+ *
+ *  Uses MODBUS_WRITE_REGISTER for a single register. Slave 0 broadcasts
+ *  the write, no response is expected and the master waits turnaround_ms.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t modbus_write(modbus_master *master, uint8_t slave, uint16_t address,
+		uint16_t count, const uint16_t *values);
+
+/*!
+ *  @brief  Adds a poll to the scheduler, due immediately
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t modbus_add_poll(modbus_master *master, modbus_poll *poll);
+
+/*!
+ *  @brief  Removes a poll from the scheduler
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t modbus_remove_poll(modbus_master *master, modbus_poll *poll);
+
+/*!
+ *  @brief  Returns the time until the next poll is due
+ *
+ *  @return Returns nanoseconds, 0 if a poll is due and -1 if there are no
+ *          polls
+ */
+extern int64_t modbus_next_due(modbus_master *master);
+
+/*!
+ *  @brief  Runs the most urgent due poll, merged with its neighbours
+ *
+ *  Polls that are late by more than one period skip the missed reads.
+ *
+ *  @return Returns 1 if a request was made, 0 if nothing was due
+ */
+extern int modbus_poll_once(modbus_master *master);
+
+/*!
+ *  @brief  Runs polls on time until modbus_stop() is called
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t modbus_run(modbus_master *master);
+
+/*!
+ *  @brief  Makes modbus_run() return after the current request
+ */
+extern void modbus_stop(modbus_master *master);
+
+/*!
+ *  @brief  Copies the counters of a slave
+ *
+ *  @param  master  A modbus_master structure
+ *  @param  slave   Slave address
+ *  @param  stats   Receives the counters
+ *  @param  reset   Non zero clears them after copying
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t modbus_get_stats(modbus_master *master, uint8_t slave,
+		modbus_slave_stats *stats, int reset);
+
+/*!
+ *  @brief  Releases the master, the UART is left open
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t modbus_close(modbus_master *master);
+
+#endif /* __MODBUS_H_ */
@@ -0,0 +1,130 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       ring.c 
+ *	@brief      Lock-free single producer, single consumer ring buffer
+ *	@author     Maximiliano Valencia
+ *	@date       4/12/2018
+ */
+
+#include "driver.h"
+#include "ring.h"
+
+/*
+ *  ======== ring_init ========
+ */
+uint8_t ring_init(ring *r, size_t size, size_t capacity) {
+	size_t rounded = 1;
+
+	while (rounded < capacity) {
+		rounded <<= 1;
+	}
+	memset(r, 0, sizeof(*r));
+	r->data = malloc(rounded * size);
+	if (r->data == NULL) {
+		log_err("ring_init(): could not allocate %zu records", rounded);
+		return -1;
+	}
+	r->size = size;
+	r->capacity = rounded;
+	return 0;
+}
+
+/*
+ *  ======== ring_free ========
+ */
+void ring_free(ring *r) {
+	free(r->data);
+	memset(r, 0, sizeof(*r));
+}
+
+/*
+ *  ======== ring_push ========
+ */
+size_t ring_push(ring *r, const void *records, size_t count) {
+	size_t head = r->head;
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	size_t room = r->capacity - (head - tail);
+	size_t offset;
+	size_t first;
+
+	if (count > room) {
+		__atomic_store_n(&r->overflows, r->overflows + (count - room), __ATOMIC_RELAXED);
+		count = room;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	/* The records may wrap around the end of the buffer */
+	offset = head & (r->capacity - 1);
+	first = r->capacity - offset;
+	if (first > count) {
+		first = count;
+	}
+	memcpy(r->data + offset * r->size, records, first * r->size);
+	memcpy(r->data, (const uint8_t *)records + first * r->size, (count - first) * r->size);
+
+	__atomic_store_n(&r->head, head + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+/*
+ *  ======== ring_pop ========
+ */
+size_t ring_pop(ring *r, void *records, size_t count) {
+	size_t tail = r->tail;
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	size_t offset;
+	size_t first;
+
+	if (count > head - tail) {
+		count = head - tail;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	offset = tail & (r->capacity - 1);
+	first = r->capacity - offset;
+	if (first > count) {
+		first = count;
+	}
+	memcpy(records, r->data + offset * r->size, first * r->size);
+	memcpy((uint8_t *)records + first * r->size, r->data, (count - first) * r->size);
+
+	__atomic_store_n(&r->tail, tail + count, __ATOMIC_RELEASE);
+	return count;
+}
+
+/*
+ *  ======== ring_count ========
+ */
+size_t ring_count(ring *r) {
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+			__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/*
+ *  ======== ring_overflows ========
+ */
+uint64_t ring_overflows(ring *r) {
+	return __atomic_load_n(&r->overflows, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,111 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       ring.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/12/2018
+ *  @brief      Lock-free single producer, single consumer ring buffer
+ *
+ *  # Overview #
+ *  A ring holds fixed size records. One thread pushes records and another
+ *  one pops them, without locks. Records that do not fit when they are
+ *  pushed are dropped and counted in overflows, so the producer never
+ *  blocks.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  ring events;
+ *  gpio_event batch[32];
+ *
+ *  ring_init(&events, sizeof(gpio_event), 1024);
+ *
+ *  // Producer thread
+ *  ring_push(&events, &event, 1);
+ *
+ *  // Consumer thread
+ *  size_t count = ring_pop(&events, batch, 32);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __RING_H_
+#define __RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*!
+ *  @brief      Ring structure type definition
+ *
+ *  head is only written by the producer and tail only by the consumer. They
+ *  are kept on separate cache lines so the two threads do not share one.
+ */
+typedef struct {
+	uint8_t *data;
+	size_t size;				/*!< @brief size of one record */
+	size_t capacity;			/*!< @brief records, a power of two */
+	size_t head __attribute__((aligned(64)));	/*!< @brief records pushed */
+	uint64_t overflows;			/*!< @brief records dropped by ring_push() */
+	size_t tail __attribute__((aligned(64)));	/*!< @brief records popped */
+} ring;
+
+/*!
+ *  @brief  Allocates a ring
+ *
+ *  @param  r           A ring structure
+ *  @param  size        Size of one record
+ *  @param  capacity    Records, rounded up to a power of two
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t ring_init(ring *r, size_t size, size_t capacity);
+
+/*!
+ *  @brief  Releases a ring
+ */
+extern void ring_free(ring *r);
+
+/*!
+ *  @brief  Appends records, producer side
+ *
+ *  @return Returns the number of records stored, the rest were dropped
+ */
+extern size_t ring_push(ring *r, const void *records, size_t count);
+
+/*!
+ *  @brief  Removes up to \a count records, consumer side
+ *
+ *  @return Returns the number of records copied to \a records
+ */
+extern size_t ring_pop(ring *r, void *records, size_t count);
+
+/*!
+ *  @brief  Returns the number of records waiting in the ring
+ */
+extern size_t ring_count(ring *r);
+
+/*!
+ *  @brief  Returns the number of records dropped so far
+ */
+extern uint64_t ring_overflows(ring *r);
+
+#endif /* __RING_H_ */
@@ -24,44 +24,71 @@
  *	@date 4/10/2018
  */
 
+#include <errno.h>
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
 /* SPI Driver Header File */
 #include "driver.h"
 #include "spi.h"
 
+/*!
+ *  @brief      Largest message spidev takes, unless its module says otherwise
+ */
+#define SPI_BUFSIZ 4096
 
+/*!
+ *  @brief      Where spidev publishes its bufsiz module parameter
+ */
+#define SPI_BUFSIZ_PATH "/sys/module/spidev/parameters/bufsiz"
+
+/*
+ *  ======== spi_bufsiz ========
+ */
+static uint32_t spi_bufsiz(void) {
+	unsigned int bufsiz;
+	FILE *file = fopen(SPI_BUFSIZ_PATH, "r");
+
+	if (file == NULL) {
+		return SPI_BUFSIZ;
+	}
+	if (fscanf(file, "%u", &bufsiz) != 1 || bufsiz == 0) {
+		bufsiz = SPI_BUFSIZ;
+	}
+	fclose(file);
+	return bufsiz;
+}
 
 /*
  *  ======== spi_open ========
  */
 uint8_t spi_open(spi_properties *spi) {
-    /* syslog (LOG_INFO, "spi open - spi:%d bits_per_word:%d speed:%d mode:%f", spi, bits_per_word, speed, mode); */
+    /* log_info("spi open - spi:%d bits_per_word:%d speed:%d mode:%f", spi, bits_per_word, speed, mode); */
     char filename[20];
     sprintf(filename, "/dev/spidev1.%d", spi->spi_id);
     spi->fd = open(filename, spi->flags); 
     if (spi->fd < 0) {
-		perror("SPI: Could not open spi.");
+		log_err("SPI: Could not open spi: %m");
 		return -1;
     }
-    printf("[INF] SPI FD: %i", spi->fd);
     if (ioctl(spi->fd, SPI_IOC_WR_MODE, &spi->mode)==-1){
-       perror("SPI: Can't set SPI mode.");
+       log_err("SPI: Can't set SPI mode: %m");
        return -1;
     }
     if (ioctl(spi->fd, SPI_IOC_WR_BITS_PER_WORD, &spi->bits_per_word)==-1){
-       perror("SPI: Can't set bits per word.");
+       log_err("SPI: Can't set bits per word: %m");
        return -1;
     }
     if (ioctl(spi->fd, SPI_IOC_WR_MAX_SPEED_HZ, &spi->speed)==-1){
-       perror("SPI: Can't set max speed HZ");
+       log_err("SPI: Can't set max speed HZ: %m");
        return -1;
     }
+    spi->bufsiz = spi_bufsiz();
     /* Check that the properties have been set */
-    syslog(LOG_INFO,"SPI fd is: %d\n", spi->fd);
-    syslog(LOG_INFO,"SPI Mode is: %d\n", spi->mode);
-    syslog(LOG_INFO,"SPI Bits is: %d\n", spi->bits_per_word);
-    syslog(LOG_INFO,"SPI Speed is: %d\n", spi->speed);
+    log_info("SPI fd is: %d", spi->fd);
+    log_info("SPI Mode is: %d", spi->mode);
+    log_info("SPI Bits is: %d", spi->bits_per_word);
+    log_info("SPI Speed is: %d", spi->speed);
+    log_info("SPI bufsiz is: %u", spi->bufsiz);
     return 0;
 }
 
@@ -69,7 +96,7 @@ uint8_t spi_open(spi_properties *spi) {
  *  ======== spi_close ========
  */
 uint8_t spi_close(spi_properties *spi) {
-	syslog(LOG_INFO, "SPI close - SPI:%d", spi->fd);
+	log_info("SPI close - SPI:%d", spi->fd);
     close(spi->fd);
     return 0;
 }
@@ -78,27 +105,156 @@ uint8_t spi_close(spi_properties *spi) {
  *  ======== spi_write ========
  */
 uint8_t spi_write(spi_properties *spi, unsigned char tx[], int length) {
-	unsigned char rx[length];
-	return spi_transfer(spi, tx, rx, length);
+	return spi_transfer(spi, tx, NULL, length);
+}
+
+/*
+ *  ======== spi_read ========
+ */
+uint8_t spi_read(spi_properties *spi, unsigned char rx[], int length) {
+	return spi_transfer(spi, NULL, rx, length);
 }
 
 /*
  *  ======== spi_transfer ========
  */
 uint8_t spi_transfer(spi_properties *spi, unsigned char tx[], unsigned char rx[], int length) {
-	struct spi_ioc_transfer transfer = {
-		   .tx_buf = (unsigned long)tx,
-		   .rx_buf = (unsigned long)rx,
-		   .len = length,
-		   .delay_usecs = 0,
-		   .speed_hz = spi->speed,
-		   .bits_per_word = spi->bits_per_word,
-   };
-   /* send the SPI message (all of the above fields, inc. buffers) */
-   int status = ioctl(spi->fd, SPI_IOC_MESSAGE(1), &transfer);
-   if (status < 0) {
-      perror("SPI: SPI_IOC_MESSAGE Failed");
-      return -1;
-   }
-   return 0; /* status */;
-}
\ No newline at end of file
+	spi_transaction t;
+
+	if (length < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	spi_begin(&t, spi);
+	spi_add(&t, tx, rx, length);
+	return spi_commit(&t);
+}
+
+/*
+ *  ======== spi_begin ========
+ */
+void spi_begin(spi_transaction *t, spi_properties *spi) {
+	t->spi = spi;
+	t->count = 0;
+	t->length = 0;
+	t->error = 0;
+}
+
+/*
+ *  ======== spi_add ========
+ */
+struct spi_ioc_transfer *spi_add(spi_transaction *t, const void *tx, void *rx,
+		uint32_t length) {
+	struct spi_ioc_transfer *segment;
+
+	if (t->count == SPI_SEGMENTS) {
+		log_err("SPI: more than %i segments in a transaction", SPI_SEGMENTS);
+		t->error = 1;
+		return NULL;
+	}
+	segment = &t->segments[t->count++];
+	memset(segment, 0, sizeof(*segment));
+	segment->tx_buf = (unsigned long)tx;
+	segment->rx_buf = (unsigned long)rx;
+	segment->len = length;
+	segment->speed_hz = t->spi->speed;
+	segment->bits_per_word = t->spi->bits_per_word;
+	t->length += length;
+	return segment;
+}
+
+/*
+ *  ======== spi_message ========
+ *  Sends \a count segments with one ioctl. When \a hold, the message is
+ *  not the last one of the transaction: cs_change of the last segment is
+ *  inverted, so chip select stays as the segment boundary wants it.
+ */
+static int spi_message(spi_properties *spi, struct spi_ioc_transfer *segments, int count,
+		int hold) {
+	if (count == 0) {
+		return 0;
+	}
+	if (hold) {
+		segments[count - 1].cs_change = !segments[count - 1].cs_change;
+	}
+	if (ioctl(spi->fd, SPI_IOC_MESSAGE(count), segments) < 0) {
+		log_err("SPI: SPI_IOC_MESSAGE(%i) Failed: %m", count);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== spi_commit ========
+ *  spidev refuses messages of more than bufsiz bytes, so a larger
+ *  transaction goes out as several, split at bufsiz boundaries with chip
+ *  select held between them. Only the last piece of a split segment gets
+ *  its cs_change and delay_usecs.
+ */
+uint8_t spi_commit(spi_transaction *t) {
+	struct spi_ioc_transfer batch[SPI_SEGMENTS];
+	struct spi_ioc_transfer *segment;
+	int64_t start = stats_now();
+	uint32_t bufsiz = t->spi->bufsiz != 0 ? t->spi->bufsiz : SPI_BUFSIZ;
+	uint32_t length = t->length, room = bufsiz, offset, piece, word;
+	int count = t->count, n = 0, status = 0, i;
+
+	t->count = 0;
+	t->length = 0;
+	if (t->error) {
+		t->error = 0;
+		errno = E2BIG;
+		stats_record(&t->spi->stats, 0, -1, length);
+		return -1;
+	}
+	if (count == 0) {
+		return 0;
+	}
+	if (length <= bufsiz) {
+		status = spi_message(t->spi, t->segments, count, 0);
+	}
+	for (i = 0; length > bufsiz && i < count && status == 0; i++) {
+		segment = &t->segments[i];
+		/* Pieces hold whole words */
+		word = segment->bits_per_word > 16 ? 4 : segment->bits_per_word > 8 ? 2 : 1;
+		offset = 0;
+		for (;;) {
+			piece = segment->len - offset < room ? segment->len - offset : room;
+			if (piece < segment->len - offset) {
+				piece &= ~(word - 1);
+			}
+			if (n == SPI_SEGMENTS || (piece == 0 && segment->len > 0)) {
+				status = spi_message(t->spi, batch, n, 1);
+				n = 0;
+				room = bufsiz;
+				if (status < 0) {
+					break;
+				}
+				continue;
+			}
+			batch[n] = *segment;
+			batch[n].len = piece;
+			if (segment->tx_buf != 0) {
+				batch[n].tx_buf += offset;
+			}
+			if (segment->rx_buf != 0) {
+				batch[n].rx_buf += offset;
+			}
+			if (offset + piece < segment->len) {
+				batch[n].cs_change = 0;
+				batch[n].delay_usecs = 0;
+			}
+			n++;
+			room -= piece;
+			offset += piece;
+			if (offset == segment->len) {
+				break;
+			}
+		}
+	}
+	if (length > bufsiz && status == 0) {
+		status = spi_message(t->spi, batch, n, 0);
+	}
+	stats_record(&t->spi->stats, start, status < 0 ? -1 : (ssize_t)length, length);
+	return status < 0 ? -1 : 0;
+}
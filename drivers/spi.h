@@ -73,6 +73,42 @@
  *  spi_transfer(spi, tx, rx, 1);
  *  @endcode
  *
+ *  ### Transactions #
+ *
+ *  A device access usually takes several segments, such as a command, an
+ *  address and a data phase. A spi_transaction collects them and
+ *  spi_commit() hands them to the kernel in one SPI_IOC_MESSAGE ioctl,
+ *  with chip select held from the first segment to the last. spi_add()
+ *  returns the segment, or NULL once SPI_SEGMENTS are used, and its fields
+ *  can then be changed:
+ *  - cs_change releases chip select after the segment; on the last
+ *    segment it instead keeps chip select asserted after the message,
+ *  - delay_usecs waits after the segment, before chip select changes,
+ *  - speed_hz and bits_per_word override the ones of spi_open().
+ *
+ *  A NULL tx clocks out zeros and a NULL rx discards what is read.
+ *
+ *  spidev refuses messages of more than its bufsiz module parameter, 4096
+ *  bytes by default. spi_open() reads it into bufsiz, and spi_commit(),
+ *  spi_transfer(), spi_write() and spi_read() split larger transfers into
+ *  several messages with chip select held between them, so any length
+ *  works. Raising bufsiz, with spidev.bufsiz= on the kernel command line,
+ *  saves ioctls on long transfers.
+ *
+ *  @code
+ *  spi_transaction t;
+ *  struct spi_ioc_transfer *segment;
+ *  uint8_t cmd[2] = { 0x80 | reg, 0 }, data[6];
+ *
+ *  spi_begin(&t, spi);
+ *  spi_add(&t, cmd, NULL, 1);
+ *  segment = spi_add(&t, NULL, data, sizeof(data));
+ *  if (segment != NULL) {
+ *      segment->delay_usecs = 5;
+ *  }
+ *  spi_commit(&t);		// fails if a segment did not fit
+ *  @endcode
+ *
  */
 
 
@@ -80,6 +116,7 @@
 #define __SPI_H_
 
 #include <linux/spi/spidev.h>
+#include "stats.h"
 
 /*!
  *  @brief      Available SPI peripherals
@@ -99,8 +136,26 @@ typedef struct {
 	uint8_t mode;			/*!< @brief is used to hold the mode of SPI */
 	uint32_t speed; 		/*!< @brief is used to hold the speed of SPI */
 	uint8_t flags;
+	uint32_t bufsiz;		/*!< @brief largest message spidev takes, kept by the driver */
+	stats_op stats;			/*!< @brief transfers, one per spi_commit() */
 } spi_properties;
 
+/*!
+ *  @brief      Segments in one transaction
+ */
+#define SPI_SEGMENTS 32
+
+/*!
+ *  @brief      Transaction structure type definition
+ */
+typedef struct {
+	spi_properties *spi;
+	struct spi_ioc_transfer segments[SPI_SEGMENTS];
+	int count;
+	uint32_t length;		/*!< @brief bytes in all the segments */
+	int error;				/*!< @brief a segment did not fit, spi_commit() fails */
+} spi_transaction;
+
 /*!
  *  @brief  Function to initialize a given SPI peripheral
  *
@@ -120,7 +175,7 @@ extern uint8_t spi_open(spi_properties* spi);
  *
  *  %spi_send() writes data from a memory buffer to the SPI interface.
  *  The source is specified by \a tx and the number of bytes to write
- *  is given by \a length.
+ *  is given by \a length. What the device sends back is discarded.
  *
  *  @warning None.
  *
@@ -137,6 +192,24 @@ extern uint8_t spi_open(spi_properties* spi);
  */
 extern uint8_t spi_write(spi_properties *spi, unsigned char tx[], int length);
 
+/*!
+ *  @brief  Function that reads data from a SPI.
+ *
+ *  Clocks out \a length zero bytes and stores what the device sends in
+ *  \a rx.
+ *
+ *  @pre	spi_open() has been called
+ *
+ *  @param  spi			A spi_properties structure 
+ *
+ *  @param  rx      	A buffer that will contain data to be read from the SPI
+ *
+ *  @param  length      The number of bytes to read
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t spi_read(spi_properties *spi, unsigned char rx[], int length);
+
 /*!
  *  @brief  Function that writes and reads data to a SPI.
  *
@@ -162,6 +235,42 @@ extern uint8_t spi_write(spi_properties *spi, unsigned char tx[], int length);
  */
 extern uint8_t spi_transfer(spi_properties *spi, unsigned char tx[], unsigned char rx[], int length);
 
+/*!
+ *  @brief  Starts an empty transaction
+ *
+ *  @param  t			A spi_transaction structure
+ *  @param  spi			A spi_properties structure, opened
+ */
+extern void spi_begin(spi_transaction *t, spi_properties *spi);
+
+/*!
+ *  @brief  Adds a segment to a transaction
+ *
+ *  The buffers must stay valid until spi_commit() returns.
+ *
+ *  @param  t			A spi_transaction structure
+ *  @param  tx			Data to send, NULL sends zeros
+ *  @param  rx			Receives the data read, can be NULL
+ *  @param  length		Bytes in the segment
+ *
+ *  @return Returns the segment, NULL when the transaction is full. The
+ *          segment is then dropped and spi_commit() fails, so only its
+ *          fields need the check.
+ */
+extern struct spi_ioc_transfer *spi_add(spi_transaction *t, const void *tx, void *rx,
+		uint32_t length);
+
+/*!
+ *  @brief  Runs the segments of a transaction with one ioctl
+ *
+ *  The transaction is empty again afterwards, ready for spi_add().
+ *
+ *  @param  t			A spi_transaction structure
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t spi_commit(spi_transaction *t);
+
 /*!
  *  @brief  Function to close a SPI peripheral specified by the SPI handle
  *
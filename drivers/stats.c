@@ -0,0 +1,116 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       stats.c 
+ *	@brief      Per-handle operation counters and latency histograms
+ *	@author     Maximiliano Valencia
+ *	@date       4/14/2018
+ */
+
+#include "driver.h"
+#include "stats.h"
+
+/*
+ *  ======== stats_upper ========
+ *  Returns the largest latency of a bucket.
+ */
+static uint64_t stats_upper(int bucket) {
+	int msb = bucket / STATS_SUB + 1;
+
+	if (bucket < STATS_SUB) {
+		return bucket;
+	}
+	return ((uint64_t)(STATS_SUB + bucket % STATS_SUB + 1) << (msb - 2)) - 1;
+}
+
+/*
+ *  ======== stats_snapshot ========
+ */
+void stats_snapshot(stats_op *op, stats_op *copy, int reset) {
+	memcpy(copy, op, sizeof(*copy));
+	if (reset) {
+		memset(op, 0, sizeof(*op));
+	}
+}
+
+/*
+ *  ======== stats_percentile ========
+ */
+uint64_t stats_percentile(const stats_op *op, double fraction) {
+	uint64_t timed = 0, rank, seen = 0;
+	int i;
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		timed += op->buckets[i];
+	}
+	if (timed == 0) {
+		return 0;
+	}
+	rank = (uint64_t)(fraction * timed + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += op->buckets[i];
+		if (seen >= rank) {
+			break;
+		}
+	}
+	/* The last bucket is open ended */
+	if (i >= STATS_BUCKETS - 1) {
+		return op->max_ns;
+	}
+	return stats_upper(i) < op->max_ns ? stats_upper(i) : op->max_ns;
+}
+
+/*
+ *  ======== stats_format ========
+ */
+int stats_format(const char *name, const stats_op *op, STATS_FORMAT format,
+		char *buf, size_t size) {
+	uint64_t timed = 0;
+	int i;
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		timed += op->buckets[i];
+	}
+	if (format == STATS_TEXT) {
+		return snprintf(buf, size, "%s: ops %llu bytes %llu errors %llu again %llu partial %llu "
+				"avg %.1f us p50 %.1f us p99 %.1f us p999 %.1f us max %.1f us",
+				name, (unsigned long long)op->ops, (unsigned long long)op->bytes,
+				(unsigned long long)op->errors, (unsigned long long)op->again,
+				(unsigned long long)op->partial,
+				timed ? op->total_ns / 1e3 / timed : 0.0,
+				stats_percentile(op, 0.5) / 1e3, stats_percentile(op, 0.99) / 1e3,
+				stats_percentile(op, 0.999) / 1e3, op->max_ns / 1e3);
+	}
+	return snprintf(buf, size, "{\"name\": \"%s\", \"ops\": %llu, \"bytes\": %llu, "
+			"\"errors\": %llu, \"again\": %llu, \"partial\": %llu, \"timed\": %llu, "
+			"\"total_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+			"\"max_ns\": %llu}",
+			name, (unsigned long long)op->ops, (unsigned long long)op->bytes,
+			(unsigned long long)op->errors, (unsigned long long)op->again,
+			(unsigned long long)op->partial, (unsigned long long)timed,
+			(unsigned long long)op->total_ns,
+			(unsigned long long)stats_percentile(op, 0.5),
+			(unsigned long long)stats_percentile(op, 0.99),
+			(unsigned long long)stats_percentile(op, 0.999),
+			(unsigned long long)op->max_ns);
+}
@@ -0,0 +1,194 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       stats.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/14/2018
+ *  @brief      Per-handle operation counters and latency histograms
+ *
+ *  # Overview #
+ *  The gpio, uart and spi handles embed a stats_op for each kind of
+ *  operation, and the User LEDs module keeps one for all its writes. They
+ *  are always on: recording an operation reads the monotonic clock once
+ *  more and updates a few counters, without locks or system calls.
+ *  Memory mapped GPIO accesses are counted but not timed, as reading the
+ *  clock would cost more than the access itself.
+ *
+ *  Latencies go into a log-linear histogram: every power of two is split
+ *  in STATS_SUB buckets, so percentiles are accurate to within 25% from
+ *  1 ns up to 4 s, in 512 bytes.
+ *
+ *  Counters are updated by the thread doing the operation. A snapshot
+ *  taken from another thread may be a few operations behind, and a reset
+ *  may lose the operations running at that moment.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  stats_op writes;
+ *  char text[512];
+ *
+ *  stats_snapshot(&uart->tx_stats, &writes, 1);
+ *  stats_format("uart1.tx", &writes, STATS_JSON, text, sizeof(text));
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __STATS_H_
+#define __STATS_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*!
+ *  @brief      Buckets per power of two
+ */
+#define STATS_SUB 4
+
+/*!
+ *  @brief      Powers of two covered, 2^32 ns is about 4 s
+ */
+#define STATS_OCTAVES 32
+
+/*!
+ *  @brief      Histogram size, longer latencies go in the last bucket
+ */
+#define STATS_BUCKETS (STATS_SUB * STATS_OCTAVES)
+
+/*!
+ *  @brief      Output formats of stats_format()
+ */
+typedef enum {
+	STATS_TEXT = 0,
+	STATS_JSON = 1
+} STATS_FORMAT;
+
+/*!
+ *  @brief      Counters of one kind of operation
+ */
+typedef struct {
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t again;			/*!< @brief times the device answered EAGAIN */
+	uint64_t partial;		/*!< @brief transfers that moved less than asked */
+	uint64_t total_ns;		/*!< @brief sum of the timed latencies */
+	uint64_t max_ns;
+	uint32_t buckets[STATS_BUCKETS];
+} stats_op;
+
+/*!
+ *  @brief  Returns the monotonic time in nanoseconds, to time an operation
+ */
+static inline int64_t stats_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*!
+ *  @brief  Returns the histogram bucket of a latency
+ */
+static inline int stats_bucket(uint64_t ns) {
+	int msb;
+
+	if (ns < STATS_SUB) {
+		return (int)ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	if (msb >= STATS_OCTAVES + 1) {
+		return STATS_BUCKETS - 1;
+	}
+	return STATS_SUB * (msb - 1) + (int)((ns >> (msb - 2)) & (STATS_SUB - 1));
+}
+
+/*!
+ *  @brief  Records one operation
+ *
+ *  @param  op          The counters of the operation
+ *  @param  start       stats_now() before the operation, 0 to leave it untimed
+ *  @param  result      Bytes transferred, or -1 with errno set
+ *  @param  requested   Bytes asked for
+ */
+static inline void stats_record(stats_op *op, int64_t start, ssize_t result, size_t requested) {
+	op->ops++;
+	if (result < 0) {
+		if (errno == EAGAIN) {
+			op->again++;
+		} else {
+			op->errors++;
+		}
+	} else {
+		op->bytes += result;
+		if ((size_t)result < requested) {
+			op->partial++;
+		}
+	}
+	if (start != 0) {
+		uint64_t ns = stats_now() - start;
+
+		op->total_ns += ns;
+		if (ns > op->max_ns) {
+			op->max_ns = ns;
+		}
+		op->buckets[stats_bucket(ns)]++;
+	}
+}
+
+/*!
+ *  @brief  Copies counters, optionally clearing them
+ *
+ *  @param  op      The counters
+ *  @param  copy    Receives the copy
+ *  @param  reset   Non zero clears \a op after copying it
+ */
+extern void stats_snapshot(stats_op *op, stats_op *copy, int reset);
+
+/*!
+ *  @brief  Returns the latency below which \a fraction of the timed operations fall
+ *
+ *  @param  op          The counters
+ *  @param  fraction    Between 0 and 1, 0.99 for the 99th percentile
+ *
+ *  @return Returns the upper bound of the bucket holding the percentile,
+ *          in nanoseconds, 0 when nothing was timed
+ */
+extern uint64_t stats_percentile(const stats_op *op, double fraction);
+
+/*!
+ *  @brief  Formats counters as one line of text or one JSON object
+ *
+ *  @param  name    Label of the counters
+ *  @param  op      The counters
+ *  @param  format  STATS_TEXT or STATS_JSON
+ *  @param  buf     Output buffer
+ *  @param  size    Size of \a buf
+ *
+ *  @return Returns the length of the output, as snprintf() does
+ */
+extern int stats_format(const char *name, const stats_op *op, STATS_FORMAT format,
+		char *buf, size_t size);
+
+#endif /* __STATS_H_ */
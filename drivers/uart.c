@@ -24,22 +24,836 @@
  *	@date       4/10/2018
  */
 
-
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <linux/serial.h>
 /* UART Driver Header File */
 #include "driver.h"
 #include "uart.h"
+#include "ring.h"
+
+/*!
+ *  @brief      Longest device path
+ */
+#define UART_PATH_MAX 256
+
+/*!
+ *  @brief      Bytes the writer thread hands to write() at once
+ */
+#define UART_TX_CHUNK 512
+
+/*!
+ *  @brief      Segments handed to one writev() call
+ */
+#define UART_IOV_BATCH 64
+
+/*
+ *  Asynchronous transmit state. head and tail count bytes queued and taken
+ *  since the start; the ring is indexed with them modulo size. The writer
+ *  copies a chunk out under the lock, so producers only wait for it while
+ *  the copy runs, never while write() does.
+ */
+struct uart_tx {
+	pthread_mutex_t lock;
+	pthread_cond_t space;		/* signaled when bytes leave the ring */
+	pthread_cond_t drained;		/* signaled when the ring runs empty */
+	uint8_t *data;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t inflight;			/* bytes taken but not yet written */
+	int idle;					/* writer sleeps until wakefd is written */
+	int running;
+	int error;					/* first write() error, reported once */
+	uint64_t dropped;
+	int wakefd;
+	pthread_t thread;
+};
+
+/*!
+ *  @brief      Bytes the reader thread takes with one read()
+ */
+#define UART_RX_CHUNK 512
+
+/*
+ *  Receive state. The reader thread is the ring's producer. Without a
+ *  callback the application pops with uart_read(); with one, the reader
+ *  also pops each completed frame into frame and hands it over.
+ */
+struct uart_rx {
+	ring bytes;
+	uint8_t *frame;
+	size_t pending;				/* bytes of the frame being received */
+	int broken;					/* the ring overflowed during the frame */
+	int64_t last;				/* arrival of the newest byte, ns */
+	uart_rx_stats stats;
+	int stopfd;
+	pthread_t thread;
+};
+
+/*
+ *  Write queued by uart_uring_write(), until its last piece completes.
+ */
+struct uart_uring {
+	const uint8_t *data;
+	size_t length;
+	size_t done;
+	uring_fxn fxn;
+	void *arg;
+	int busy;
+};
+
+/*
+ *  ======== uart_now ========
+ */
+static int64_t uart_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ *  ======== uart_tx_wake ========
+ */
+static void uart_tx_wake(struct uart_tx *tx) {
+	uint64_t one = 1;
+
+	if (write(tx->wakefd, &one, sizeof(one)) < 0) {
+		log_err("uart_tx_wake(): %m");
+	}
+}
+
+/*
+ *  ======== uart_send ========
+ *  Writes every segment with as few writev() calls as the port allows,
+ *  waiting for POLLOUT after short writes and EAGAIN, which are counted in
+ *  tx_stats, or tx_writer_stats when called by the writer thread \a tx.
+ *  What the port accepts is recorded in the capture. The writer thread
+ *  gives up early when it is being stopped.
+ */
+static ssize_t uart_send(uart_properties *uart, struct uart_tx *tx, const struct iovec *iov,
+		int count) {
+	/* Each thread has its own counters */
+	stats_op *stats = tx != NULL ? &uart->tx_writer_stats : &uart->tx_stats;
+	struct iovec batch[UART_IOV_BATCH];
+	struct iovec *cur;
+	struct pollfd fds[2];
+	uint64_t wakeups;
+	ssize_t total = 0, n;
+	size_t pending;
+	int left, i;
+
+	fds[0].fd = uart->fd;
+	fds[0].events = POLLOUT;
+	fds[1].fd = tx != NULL ? tx->wakefd : -1;
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+	while (count > 0) {
+		left = count < UART_IOV_BATCH ? count : UART_IOV_BATCH;
+		memcpy(batch, iov, left * sizeof(struct iovec));
+		iov += left;
+		count -= left;
+		cur = batch;
+		pending = 0;
+		for (i = 0; i < left; i++) {
+			pending += batch[i].iov_len;
+		}
+		n = 0;
+		for (;;) {
+			/* Skip what the last call wrote, including empty segments */
+			while (left > 0 && (size_t)n >= cur->iov_len) {
+				n -= cur->iov_len;
+				cur++;
+				left--;
+			}
+			if (left == 0) {
+				break;
+			}
+			cur->iov_base = (uint8_t *)cur->iov_base + n;
+			cur->iov_len -= n;
+
+			n = writev(uart->fd, cur, left);
+			if (n > 0) {
+				uart_capture_appendv(uart->capture, UART_CAPTURE_TX, uart->uart_id, 0,
+						cur, left, n);
+				total += n;
+				pending -= n;
+				if (pending > 0) {
+					stats->partial++;
+				}
+				continue;
+			}
+			if (n < 0 && errno == EAGAIN) {
+				stats->again++;
+			} else if (n < 0 && errno != EINTR) {
+				return total > 0 ? total : -1;
+			}
+			n = 0;
+			if (poll(fds, tx != NULL ? 2 : 1, -1) < 0 && errno != EINTR) {
+				return total > 0 ? total : -1;
+			}
+			if (fds[1].revents & POLLIN) {
+				if (read(tx->wakefd, &wakeups, sizeof(wakeups)) < 0) {
+					/* Nothing pending, the counter was already reset */
+				}
+				if (!__atomic_load_n(&tx->running, __ATOMIC_ACQUIRE)) {
+					errno = ECANCELED;
+					return -1;
+				}
+			}
+		}
+	}
+	return total;
+}
+
+/*
+ *  ======== uart_tx_thread ========
+ */
+static void *uart_tx_thread(void *arg) {
+	uart_properties *uart = arg;
+	struct uart_tx *tx = uart->tx;
+	uint8_t chunk[UART_TX_CHUNK];
+	struct iovec iov;
+	struct pollfd wake;
+	uint64_t count;
+	size_t length, offset, first;
+	ssize_t written;
+	int64_t start;
+
+	wake.fd = tx->wakefd;
+	wake.events = POLLIN;
+	for (;;) {
+		pthread_mutex_lock(&tx->lock);
+		if (!tx->running) {
+			/* uart_close() already gave the queued data its time */
+			pthread_mutex_unlock(&tx->lock);
+			break;
+		}
+		length = tx->head - tx->tail;
+		if (length == 0) {
+			tx->inflight = 0;
+			pthread_cond_broadcast(&tx->drained);
+			tx->idle = 1;
+			pthread_mutex_unlock(&tx->lock);
+			if (poll(&wake, 1, -1) > 0 && read(tx->wakefd, &count, sizeof(count)) < 0) {
+				/* Nothing pending, the counter was already reset */
+			}
+			continue;
+		}
+		if (length > UART_TX_CHUNK) {
+			length = UART_TX_CHUNK;
+		}
+		offset = tx->tail & (tx->size - 1);
+		first = tx->size - offset < length ? tx->size - offset : length;
+		memcpy(chunk, tx->data + offset, first);
+		memcpy(chunk + first, tx->data, length - first);
+		tx->tail += length;
+		tx->inflight = length;
+		pthread_cond_broadcast(&tx->space);
+		pthread_mutex_unlock(&tx->lock);
+
+		iov.iov_base = chunk;
+		iov.iov_len = length;
+		start = stats_now();
+		written = uart_send(uart, tx, &iov, 1);
+		stats_record(&uart->tx_writer_stats, start, written, length);
+		if (written != (ssize_t)length) {
+			if (errno == ECANCELED) {
+				break;
+			}
+			log_err("Could not write to UART %i: %m", uart->uart_id);
+			pthread_mutex_lock(&tx->lock);
+			if (tx->error == 0) {
+				tx->error = errno;
+			}
+			pthread_mutex_unlock(&tx->lock);
+		}
+	}
+	return NULL;
+}
+
+/*
+ *  ======== uart_tx_open ========
+ */
+static int uart_tx_open(uart_properties *uart) {
+	struct uart_tx *tx;
+	pthread_condattr_t attr;
+	size_t size = uart->tx_size ? uart->tx_size : UART_TX_SIZE;
+	int status;
+
+	tx = calloc(1, sizeof(struct uart_tx));
+	if (tx == NULL) {
+		return -1;
+	}
+	for (tx->size = 1; tx->size < size; tx->size <<= 1);
+	tx->data = malloc(tx->size);
+	tx->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (tx->data == NULL || tx->wakefd < 0) {
+		log_err("uart_tx_open(): %m");
+		if (tx->wakefd >= 0) {
+			close(tx->wakefd);
+		}
+		free(tx->data);
+		free(tx);
+		return -1;
+	}
+	pthread_mutex_init(&tx->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&tx->space, &attr);
+	pthread_cond_init(&tx->drained, &attr);
+	pthread_condattr_destroy(&attr);
+	tx->running = 1;
+	uart->tx = tx;
+
+	status = pthread_create(&tx->thread, NULL, uart_tx_thread, uart);
+	if (status != 0) {
+		log_err("uart_tx_open(): could not create thread: %s", strerror(status));
+		uart->tx = NULL;
+		pthread_cond_destroy(&tx->drained);
+		pthread_cond_destroy(&tx->space);
+		pthread_mutex_destroy(&tx->lock);
+		close(tx->wakefd);
+		free(tx->data);
+		free(tx);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== uart_tx_close ========
+ */
+static void uart_tx_close(uart_properties *uart) {
+	struct uart_tx *tx = uart->tx;
+
+	pthread_mutex_lock(&tx->lock);
+	__atomic_store_n(&tx->running, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&tx->lock);
+	uart_tx_wake(tx);
+	pthread_join(tx->thread, NULL);
+
+	pthread_cond_destroy(&tx->drained);
+	pthread_cond_destroy(&tx->space);
+	pthread_mutex_destroy(&tx->lock);
+	close(tx->wakefd);
+	free(tx->data);
+	free(tx);
+	uart->tx = NULL;
+}
+
+/*
+ *  ======== uart_tx_queue ========
+ */
+static ssize_t uart_tx_queue(uart_properties *uart, const struct iovec *iov, int count) {
+	struct uart_tx *tx = uart->tx;
+	const uint8_t *buf;
+	size_t total = 0, skip = 0, length, room, n, offset, first;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		total += iov[i].iov_len;
+	}
+	pthread_mutex_lock(&tx->lock);
+	if (tx->error != 0) {
+		/* Report a failed background write to the next caller */
+		errno = tx->error;
+		tx->error = 0;
+		pthread_mutex_unlock(&tx->lock);
+		return -1;
+	}
+	if (uart->tx_policy == UART_TX_FAIL && total > tx->size - (tx->head - tx->tail)) {
+		pthread_mutex_unlock(&tx->lock);
+		errno = EAGAIN;
+		return -1;
+	}
+	if (uart->tx_policy == UART_TX_DROP_OLDEST && total > tx->size) {
+		/* Only the newest size bytes can survive, and only they are queued */
+		skip = total - tx->size;
+		tx->dropped += skip;
+		total -= skip;
+	}
+	for (i = 0; i < count; i++) {
+		buf = iov[i].iov_base;
+		length = iov[i].iov_len;
+		n = skip < length ? skip : length;
+		buf += n;
+		length -= n;
+		skip -= n;
+		while (length > 0) {
+			room = tx->size - (tx->head - tx->tail);
+			if (room < length && uart->tx_policy == UART_TX_DROP_OLDEST) {
+				tx->tail += length - room;
+				tx->dropped += length - room;
+				room = length;
+			}
+			if (room == 0) {
+				pthread_cond_wait(&tx->space, &tx->lock);
+				continue;
+			}
+			n = length < room ? length : room;
+			offset = tx->head & (tx->size - 1);
+			first = tx->size - offset < n ? tx->size - offset : n;
+			memcpy(tx->data + offset, buf, first);
+			memcpy(tx->data, buf + first, n - first);
+			tx->head += n;
+			buf += n;
+			length -= n;
+			if (tx->idle) {
+				tx->idle = 0;
+				uart_tx_wake(tx);
+			}
+		}
+	}
+	pthread_mutex_unlock(&tx->lock);
+	return total;
+}
+
+/*
+ *  ======== uart_rx_append ========
+ */
+static void uart_rx_append(struct uart_rx *rx, const uint8_t *buf, size_t length) {
+	size_t stored = ring_push(&rx->bytes, buf, length);
+
+	rx->pending += stored;
+	if (stored < length) {
+		rx->broken = 1;
+	}
+}
+
+/*
+ *  ======== uart_rx_deliver ========
+ *  Pops the frame being received and hands it to the callback. A frame
+ *  that lost bytes to an overflow is dropped rather than delivered.
+ */
+static void uart_rx_deliver(uart_properties *uart, int strip) {
+	struct uart_rx *rx = uart->rx;
+	size_t length = ring_pop(&rx->bytes, rx->frame, rx->pending);
+	int64_t latency;
+
+	rx->pending = 0;
+	if (rx->broken) {
+		rx->broken = 0;
+		__atomic_fetch_add(&rx->stats.dropped_frames, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (strip && length > 0) {
+		length--;
+	}
+	latency = uart_now() - rx->last;
+	__atomic_fetch_add(&rx->stats.frames, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&rx->stats.total_latency_ns, latency, __ATOMIC_RELAXED);
+	if ((uint64_t)latency > rx->stats.max_latency_ns) {
+		__atomic_store_n(&rx->stats.max_latency_ns, latency, __ATOMIC_RELAXED);
+	}
+	uart->rx_callback(uart, rx->frame, length, uart->rx_arg);
+}
+
+/*
+ *  ======== uart_rx_thread ========
+ */
+static void *uart_rx_thread(void *arg) {
+	uart_properties *uart = arg;
+	struct uart_rx *rx = uart->rx;
+	uint8_t chunk[UART_RX_CHUNK];
+	struct pollfd fds[2];
+	int64_t idle_ns = (int64_t)uart->rx_idle_us * 1000;
+	int timeout, ready, end;
+	ssize_t count, start, i;
+
+	if (uart->rx_frame == UART_FRAME_IDLE && idle_ns == 0) {
+		idle_ns = (int64_t)UART_RX_IDLE_US * 1000;
+	}
+	fds[0].fd = uart->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = rx->stopfd;
+	fds[1].events = POLLIN;
+	for (;;) {
+		/* A partial frame ends after an idle gap */
+		timeout = -1;
+		if (rx->pending > 0 && idle_ns > 0) {
+			int64_t left = rx->last + idle_ns - uart_now();
+
+			timeout = left > 0 ? (int)((left + 999999) / 1000000) : 0;
+		}
+		ready = poll(fds, 2, timeout);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_err("UART %i reader: %m", uart->uart_id);
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			break;
+		}
+		if (ready == 0 || !(fds[0].revents & (POLLIN | POLLERR | POLLHUP))) {
+			if (rx->pending > 0 && uart_now() - rx->last >= idle_ns) {
+				uart_rx_deliver(uart, 0);
+			}
+			continue;
+		}
+
+		count = read(uart->fd, chunk, UART_RX_CHUNK);
+		if (count <= 0) {
+			if (count < 0 && (errno == EAGAIN || errno == EINTR)) {
+				continue;
+			}
+			log_err("UART %i reader stopped: %s", uart->uart_id,
+					count == 0 ? "end of file" : strerror(errno));
+			break;
+		}
+		rx->last = uart_now();
+		__atomic_fetch_add(&rx->stats.bytes, count, __ATOMIC_RELAXED);
+		uart_capture_append(uart->capture, UART_CAPTURE_RX, uart->uart_id, rx->last,
+				chunk, count);
+		if (uart->rx_callback == NULL) {
+			ring_push(&rx->bytes, chunk, count);
+			continue;
+		}
+
+		/* Split the chunk at every frame end */
+		start = 0;
+		for (i = 0; i < count; i++) {
+			if (uart->rx_frame == UART_FRAME_DELIMITER) {
+				end = chunk[i] == uart->rx_delimiter;
+			} else if (uart->rx_frame == UART_FRAME_LENGTH) {
+				end = rx->pending + (i + 1 - start) >= uart->rx_length;
+			} else {
+				end = 0;
+			}
+			if (end) {
+				uart_rx_append(rx, chunk + start, i + 1 - start);
+				uart_rx_deliver(uart, uart->rx_frame == UART_FRAME_DELIMITER);
+				start = i + 1;
+			}
+		}
+		uart_rx_append(rx, chunk + start, count - start);
+	}
+	return NULL;
+}
+
+/*
+ *  ======== uart_rx_open ========
+ */
+static int uart_rx_open(uart_properties *uart) {
+	struct uart_rx *rx;
+	size_t size = uart->rx_size ? uart->rx_size : UART_RX_SIZE;
+	int status;
+
+	if (uart->rx_callback != NULL && uart->rx_frame == UART_FRAME_NONE) {
+		log_err("uart_rx_open(): a frame callback needs rx_frame");
+		return -1;
+	}
+	if (uart->rx_frame == UART_FRAME_LENGTH && (uart->rx_length == 0 || uart->rx_length > size)) {
+		log_err("uart_rx_open(): invalid frame length %zu", uart->rx_length);
+		return -1;
+	}
+	rx = calloc(1, sizeof(struct uart_rx));
+	if (rx == NULL) {
+		return -1;
+	}
+	if (ring_init(&rx->bytes, 1, size) != 0) {
+		free(rx);
+		return -1;
+	}
+	rx->frame = malloc(rx->bytes.capacity);
+	rx->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (rx->frame == NULL || rx->stopfd < 0) {
+		log_err("uart_rx_open(): %m");
+		if (rx->stopfd >= 0) {
+			close(rx->stopfd);
+		}
+		free(rx->frame);
+		ring_free(&rx->bytes);
+		free(rx);
+		return -1;
+	}
+	uart->rx = rx;
+
+	status = pthread_create(&rx->thread, NULL, uart_rx_thread, uart);
+	if (status != 0) {
+		log_err("uart_rx_open(): could not create thread: %s", strerror(status));
+		uart->rx = NULL;
+		close(rx->stopfd);
+		free(rx->frame);
+		ring_free(&rx->bytes);
+		free(rx);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== uart_rx_close ========
+ */
+static void uart_rx_close(uart_properties *uart) {
+	struct uart_rx *rx = uart->rx;
+	uint64_t one = 1;
+
+	if (write(rx->stopfd, &one, sizeof(one)) < 0) {
+		log_err("uart_rx_close(): %m");
+	}
+	pthread_join(rx->thread, NULL);
+
+	close(rx->stopfd);
+	free(rx->frame);
+	ring_free(&rx->bytes);
+	free(rx);
+	uart->rx = NULL;
+}
+
+/*!
+ *  @brief      Waits shorter than this are spun, a sleep would overshoot them
+ */
+#define UART_SPIN_US 100
+
+/*!
+ *  @brief      Bytes the AM335x UART FIFO holds after the kernel buffer is empty
+ */
+#define UART_FIFO 64
+
+/*
+ *  ======== uart_delay ========
+ */
+static void uart_delay(uint32_t us) {
+	int64_t end = uart_now() + (int64_t)us * 1000;
+	struct timespec wait;
+
+	if (us > UART_SPIN_US) {
+		wait.tv_sec = (us - UART_SPIN_US) / 1000000;
+		wait.tv_nsec = (long)((us - UART_SPIN_US) % 1000000) * 1000;
+		nanosleep(&wait, NULL);
+	}
+	while (uart_now() < end) {
+		/* Spin through the last microseconds */
+	}
+}
+
+/*
+ *  ======== uart_rs485_open ========
+ */
+static int uart_rs485_open(uart_properties *uart) {
+	struct serial_rs485 conf;
+
+	if (uart->rs485 == UART_RS485_OFF) {
+		return 0;
+	}
+	if (uart->rs485 != UART_RS485_GPIO) {
+		memset(&conf, 0, sizeof(conf));
+		conf.flags = SER_RS485_ENABLED |
+				(uart->rs485_de_low ? SER_RS485_RTS_AFTER_SEND : SER_RS485_RTS_ON_SEND);
+		/* The kernel counts these delays in milliseconds */
+		conf.delay_rts_before_send = (uart->rs485_pre_us + 999) / 1000;
+		conf.delay_rts_after_send = (uart->rs485_post_us + 999) / 1000;
+		if (ioctl(uart->fd, TIOCSRS485, &conf) == 0) {
+			uart->rs485 = UART_RS485_KERNEL;
+			return 0;
+		}
+		if (uart->rs485 == UART_RS485_KERNEL) {
+			log_err("UART %i: TIOCSRS485: %m", uart->uart_id);
+			return -1;
+		}
+		log_info("UART %i: no kernel RS-485, DE driven from GPIO", uart->uart_id);
+	}
+	if (uart->rs485_de == NULL || uart->tx_mode != UART_TX_SYNC) {
+		log_err("UART %i: RS-485 over GPIO needs rs485_de and UART_TX_SYNC", uart->uart_id);
+		errno = EINVAL;
+		return -1;
+	}
+	uart->rs485 = UART_RS485_GPIO;
+	uart->rs485_lsr = 1;
+	/* Listen until the first write */
+	return gpio_write(uart->rs485_de, uart->rs485_de_low ? 1 : 0) ? -1 : 0;
+}
+
+/*
+ *  ======== uart_rs485_drain ========
+ *  Waits until the last stop bit has left the shift register, returns when
+ *  that was seen. Sleeps while the kernel still holds bytes, then checks
+ *  the transmitter every quarter of a character.
+ */
+static int64_t uart_rs485_drain(uart_properties *uart) {
+	uint32_t char_ns = uart_char_ns(uart);
+	unsigned int lsr;
+	int64_t deadline = 0;
+	int queued;
+
+	while (uart->rs485_lsr) {
+		if (ioctl(uart->fd, TIOCOUTQ, &queued) < 0) {
+			queued = 0;
+		}
+		if (deadline == 0) {
+			/* Past this the line is stalled, leave it to tcdrain() */
+			deadline = uart_now() + (int64_t)(queued + UART_FIFO + 1) * char_ns * 2;
+		}
+		if (queued > 0) {
+			uart_delay((uint32_t)((int64_t)queued * char_ns / 1000));
+			continue;
+		}
+		if (ioctl(uart->fd, TIOCSERGETLSR, &lsr) < 0) {
+			log_info("UART %i: no TIOCSERGETLSR, draining with tcdrain()", uart->uart_id);
+			uart->rs485_lsr = 0;
+			break;
+		}
+		if (lsr & TIOCSER_TEMT) {
+			return uart_now();
+		}
+		if (uart_now() > deadline) {
+			break;
+		}
+		uart_delay(char_ns / 4000);
+	}
+	tcdrain(uart->fd);
+	return uart_now();
+}
+
+/*
+ *  ======== uart_rs485_send ========
+ *  Writes with DE asserted, and releases it once the data is on the line.
+ */
+static ssize_t uart_rs485_send(uart_properties *uart, const struct iovec *iov, int count) {
+	int active = uart->rs485_de_low ? 0 : 1;
+	int64_t empty;
+	ssize_t total;
+
+	if (gpio_write(uart->rs485_de, active) != 0) {
+		return -1;
+	}
+	uart_delay(uart->rs485_pre_us);
+	total = uart_send(uart, NULL, iov, count);
+	empty = uart_rs485_drain(uart);
+	uart_delay(uart->rs485_post_us);
+	if (gpio_write(uart->rs485_de, !active) != 0) {
+		log_err("UART %i: could not release DE", uart->uart_id);
+	}
+	stats_record(&uart->rs485_stats, empty, 0, 0);
+	return total;
+}
+
+/*
+ *  ======== uart_configure ========
+ */
+static int uart_configure(uart_properties *uart) {
+	struct termios options;
+	struct serial_struct serial;
+	static const tcflag_t sizes[] = { CS5, CS6, CS7, CS8 };
+	uint8_t data_bits = uart->data_bits ? uart->data_bits : 8;
+
+	if (data_bits < 5 || data_bits > 8) {
+		log_err("UART %i: invalid data bits %u", uart->uart_id, data_bits);
+		return -1;
+	}
+	if (tcgetattr(uart->fd, &options) != 0) {
+		log_err("UART %i: tcgetattr: %m", uart->uart_id);
+		return -1;
+	}
+	options.c_cflag = (uart->baudrate ? uart->baudrate : B9600) | sizes[data_bits - 5] |
+			CLOCAL | CREAD;
+	options.c_iflag = IGNPAR;
+	if (uart->parity != UART_PARITY_NONE) {
+		options.c_cflag |= PARENB | (uart->parity == UART_PARITY_ODD ? PARODD : 0);
+		options.c_iflag |= INPCK;
+	}
+	if (uart->stop_bits == 2) {
+		options.c_cflag |= CSTOPB;
+	}
+	if (uart->text_mode) {
+		options.c_iflag |= ICRNL;
+	}
+	options.c_oflag = 0;
+	options.c_lflag = 0;
+	options.c_cc[VMIN] = uart->vmin;
+	options.c_cc[VTIME] = uart->vtime;
+	/* clean the line and set the attributes */
+	tcflush(uart->fd, TCIFLUSH);
+	if (tcsetattr(uart->fd, TCSANOW, &options) != 0) {
+		log_err("UART %i: tcsetattr: %m", uart->uart_id);
+		return -1;
+	}
+	if (uart->custom_baud != 0 && uart_set_custom_baud(uart->fd, uart->custom_baud) != 0) {
+		return -1;
+	}
+
+	/* VMIN and VTIME only apply to blocking reads */
+	if (uart->vmin != 0 || uart->vtime != 0) {
+		fcntl(uart->fd, F_SETFL, fcntl(uart->fd, F_GETFL) & ~O_NONBLOCK);
+	}
+
+	if (uart->low_latency) {
+		if (ioctl(uart->fd, TIOCGSERIAL, &serial) == 0) {
+			serial.flags |= ASYNC_LOW_LATENCY;
+			if (ioctl(uart->fd, TIOCSSERIAL, &serial) != 0) {
+				log_info("UART %i: low latency refused: %m", uart->uart_id);
+			}
+		} else {
+			log_info("UART %i: low latency not supported", uart->uart_id);
+		}
+	}
+	return 0;
+}
+
+/*
+ *  ======== uart_char_ns ========
+ */
+uint32_t uart_char_ns(uart_properties *uart) {
+	static const struct {
+		int constant;
+		uint32_t rate;
+	} rates[] = {
+		{ B1200, 1200 }, { B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 },
+		{ B19200, 19200 }, { B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 },
+		{ B230400, 230400 }, { B460800, 460800 }, { B500000, 500000 },
+		{ B576000, 576000 }, { B921600, 921600 }, { B1000000, 1000000 },
+		{ B1152000, 1152000 }, { B1500000, 1500000 }, { B2000000, 2000000 },
+		{ B2500000, 2500000 }, { B3000000, 3000000 }, { B3500000, 3500000 },
+		{ B4000000, 4000000 }
+	};
+	uint32_t rate = 9600;
+	uint32_t bits;
+	size_t i;
+
+	if (uart->custom_baud != 0) {
+		rate = uart->custom_baud;
+	} else {
+		for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+			if (rates[i].constant == uart->baudrate) {
+				rate = rates[i].rate;
+				break;
+			}
+		}
+	}
+	bits = 1 + (uart->data_bits ? uart->data_bits : 8) +
+			(uart->parity != UART_PARITY_NONE ? 1 : 0) + (uart->stop_bits == 2 ? 2 : 1);
+	return (uint32_t)(((uint64_t)bits * 1000000000 + rate - 1) / rate);
+}
 
 /*
  *  ======== uart_open ========
  */
 int uart_open(uart_properties *uart) {
-	char buf[30] = "/dev/ttyO";
-	char port_nr[2];
-	struct termios options;
+	char buf[UART_PATH_MAX];
 	
-	/* Set UART peripheral number */
-	sprintf(port_nr, "%d", uart->uart_id);
-	strcat(buf,port_nr);
+	/* The threads rely on non blocking I/O to be stopped */
+	if ((uart->vmin != 0 || uart->vtime != 0)
+			&& (uart->tx_mode == UART_TX_ASYNC || uart->rx_mode == UART_RX_THREAD)) {
+		log_err("UART %i: vmin and vtime need UART_TX_SYNC and UART_RX_POLL", uart->uart_id);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Set UART peripheral number, unless another device was given */
+	if (uart->path != NULL) {
+		snprintf(buf, sizeof(buf), "%s", uart->path);
+	} else {
+		snprintf(buf, sizeof(buf), "/dev/ttyO%d", uart->uart_id);
+	}
     /* OPEN THE UART
      * The flags (defined in fcntl.h):
      *	Access modes (use 1 of these):
@@ -55,10 +869,10 @@ int uart_open(uart_properties *uart) {
      */
     uart->fd = open(buf, O_RDWR | O_NOCTTY | O_NDELAY);	/* Open in non blocking read/write mode */
     if (uart->fd < 0) { /* ERROR - CAN'T OPEN SERIAL PORT */
-    	syslog(LOG_ERR, "Unable to open UART %i (%s)", uart->uart_id, buf);
-    	exit(1);
+    	log_err("Unable to open UART %i (%s): %m", uart->uart_id, buf);
+    	return -1;
     }
-    syslog(LOG_ERR, "UART %i (%s) opened", uart->uart_id, buf);
+    log_info("UART %i (%s) opened", uart->uart_id, buf);
 	/* CONFIGURE THE UART
      * The flags (defined in /usr/include/termios.h - see http://pubs.opengroup.org/onlinepubs/007908799/xsh/termios.h.html):
      *	Baud rate:- B1200, B2400, B4800, B9600, B19200, B38400, B57600, B115200, B230400, B460800, B500000, B576000, B921600, B1000000, B1152000, B1500000, B2000000, B2500000, B3000000, B3500000, B4000000
@@ -66,19 +880,37 @@ int uart_open(uart_properties *uart) {
      *	CLOCAL - Ignore modem status lines
      *	CREAD - Enable receiver
      *	IGNPAR = Ignore characters with parity errors
+     *	INPCK - Check the parity of received characters
      *	ICRNL - Map CR to NL on input (Use for ASCII comms where you want to auto correct end of line characters - don't use for binary comms!)
      *	PARENB - Parity enable
      *	PARODD - Odd parity (else even)
+     *	CSTOPB - Two stop bits (else one)
+     *	VMIN / VTIME - Bytes and tenths of a second a blocking read waits for
      */
-    tcgetattr(uart->fd, &options);
-    options.c_cflag = uart->baudrate | CS8 | CLOCAL | CREAD;
-    options.c_iflag = IGNPAR | ICRNL;
-    options.c_oflag = 0;
-    options.c_lflag = 0;
-    /* clean the line and set the attributes */
-    tcflush(uart->fd, TCIFLUSH);
-    tcsetattr(uart->fd, TCSANOW, &options);
+    if (uart_configure(uart) != 0) {
+    	close(uart->fd);
+    	return -1;
+    }
+
+	if (uart_rs485_open(uart) != 0) {
+		close(uart->fd);
+		return -1;
+	}
 
+	uart->tx = NULL;
+	uart->rx = NULL;
+	uart->uring_tx = NULL;
+	if (uart->tx_mode == UART_TX_ASYNC && uart_tx_open(uart) != 0) {
+		close(uart->fd);
+		return -1;
+	}
+	if (uart->rx_mode == UART_RX_THREAD && uart_rx_open(uart) != 0) {
+		if (uart->tx != NULL) {
+			uart_tx_close(uart);
+		}
+		close(uart->fd);
+		return -1;
+	}
 	return 0;
 }
 
@@ -86,24 +918,224 @@ int uart_open(uart_properties *uart) {
  *  ======== uart_write ========
  */
 int uart_write(uart_properties *uart, char *tx, int length) {
-	if (write(uart->fd, tx, length) == -1) {
-		syslog(LOG_ERR, "Could not write %s to UART %i", tx, uart->uart_id);
+	struct iovec iov;
+	ssize_t total;
+
+	iov.iov_base = tx;
+	iov.iov_len = length;
+	total = uart_writev(uart, &iov, 1);
+	if (total < 0) {
+		return -1;
+	}
+	/* Dropping what does not fit is the policy, not an error */
+	if (total != length && !(uart->tx != NULL && uart->tx_policy == UART_TX_DROP_OLDEST)) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== uart_writev ========
+ */
+ssize_t uart_writev(uart_properties *uart, const struct iovec *iov, int count) {
+	int64_t start = stats_now();
+	size_t requested = 0;
+	ssize_t total;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		requested += iov[i].iov_len;
+	}
+	if (uart->tx != NULL) {
+		/* Times the queueing, the writer thread counts EAGAIN and short writes */
+		total = uart_tx_queue(uart, iov, count);
+		stats_record(&uart->tx_stats, start, total, requested);
+		return total;
+	}
+	if (uart->rs485 == UART_RS485_GPIO) {
+		total = uart_rs485_send(uart, iov, count);
+	} else {
+		total = uart_send(uart, NULL, iov, count);
+	}
+	stats_record(&uart->tx_stats, start, total, requested);
+	if (total < 0) {
+		log_err("Could not write to UART %i: %m", uart->uart_id);
+		return -1;
+	}
+	log_debug("Wrote %zd bytes to UART %i", total, uart->uart_id);
+	return total;
+}
+
+/*
+ *  ======== uart_flush ========
+ */
+int uart_flush(uart_properties *uart, int timeout) {
+	struct uart_tx *tx = uart->tx;
+	struct timespec deadline;
+	int status = 0;
+
+	if (tx == NULL) {
+		return tcdrain(uart->fd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&tx->lock);
+	while (status == 0 && (tx->head != tx->tail || tx->inflight != 0)) {
+		if (timeout < 0) {
+			status = pthread_cond_wait(&tx->drained, &tx->lock);
+		} else {
+			status = pthread_cond_timedwait(&tx->drained, &tx->lock, &deadline);
+		}
+	}
+	pthread_mutex_unlock(&tx->lock);
+	if (status != 0) {
+		errno = status;
 		return -1;
 	}
-	syslog(LOG_INFO, "Wrote %s to UART %i", tx, uart->uart_id);
 	return 0;
 }
 
+/*
+ *  ======== uart_tx_dropped ========
+ */
+uint64_t uart_tx_dropped(uart_properties *uart) {
+	uint64_t dropped;
+
+	if (uart->tx == NULL) {
+		return 0;
+	}
+	pthread_mutex_lock(&uart->tx->lock);
+	dropped = uart->tx->dropped;
+	pthread_mutex_unlock(&uart->tx->lock);
+	return dropped;
+}
+
 /*
  *  ======== uart_read ========
  */
 int uart_read(uart_properties *uart,unsigned char *rx, int length) {
+	int64_t start = stats_now();
 	int count;
-	if( (count = read(uart->fd,(void*)rx,length)) > 0) {
-		syslog(LOG_ERR, "Could not read from UART %i", uart->uart_id);
+
+	if (uart->rx != NULL) {
+		if (uart->rx_callback != NULL) {
+			/* The reader thread is the ring's only consumer */
+			errno = EBUSY;
+			return -1;
+		}
+		count = ring_pop(&uart->rx->bytes, rx, length);
+		stats_record(&uart->rx_stats, start, count, length);
 		return count;
 	}
-	syslog(LOG_INFO, "Read %s from UART %i", rx, uart->uart_id);
+	count = read(uart->fd, rx, length);
+	stats_record(&uart->rx_stats, start, count, length);
+	if (count > 0) {
+		uart_capture_append(uart->capture, UART_CAPTURE_RX, uart->uart_id, 0, rx, count);
+	}
+	if (count < 0) {
+		if (errno == EAGAIN) {
+			return 0;
+		}
+		log_err("Could not read from UART %i: %m", uart->uart_id);
+		return -1;
+	}
+	log_debug("Read %i bytes from UART %i", count, uart->uart_id);
+	return count;
+}
+
+/*
+ *  ======== uart_uring_sent ========
+ *  Completion of a UART write on a uring. The rest of a short write is
+ *  queued again before anything else can be, so the byte stream stays in
+ *  order; the caller hears back once all is written, or the port is full.
+ */
+static void uart_uring_sent(uring *u, ssize_t result, void *arg) {
+	uart_properties *uart = arg;
+	struct uart_uring *tx = uart->uring_tx;
+
+	if (result > 0) {
+		tx->done += result;
+		if (tx->done < tx->length && uring_write(u, uart->fd, tx->data + tx->done,
+				tx->length - tx->done, -1, &uart->tx_stats, uart_uring_sent, uart) == 0) {
+			return;
+		}
+	}
+	if (tx->done > 0) {
+		result = tx->done;
+	}
+	tx->busy = 0;
+	if (tx->fxn != NULL) {
+		(*tx->fxn)(u, result, tx->arg);
+	}
+}
+
+/*
+ *  ======== uart_uring_write ========
+ */
+uint8_t uart_uring_write(uring *u, uart_properties *uart, const void *tx, size_t length,
+		uring_fxn fxn, void *arg) {
+	struct uart_uring *state = uart->uring_tx;
+
+	if (uart->tx != NULL || uart->rs485 == UART_RS485_GPIO || (state != NULL && state->busy)) {
+		/* Would overtake the writer thread or the write in flight, or go out without DE */
+		errno = EBUSY;
+		return -1;
+	}
+	if (state == NULL) {
+		state = calloc(1, sizeof(*state));
+		if (state == NULL) {
+			return -1;
+		}
+		uart->uring_tx = state;
+	}
+	state->data = tx;
+	state->length = length;
+	state->done = 0;
+	state->fxn = fxn;
+	state->arg = arg;
+	if (uring_write(u, uart->fd, tx, length, -1, &uart->tx_stats, uart_uring_sent, uart) != 0) {
+		return -1;
+	}
+	state->busy = 1;
+	return 0;
+}
+
+/*
+ *  ======== uart_uring_read ========
+ */
+uint8_t uart_uring_read(uring *u, uart_properties *uart, void *rx, size_t length,
+		uring_fxn fxn, void *arg) {
+	if (uart->rx != NULL) {
+		/* The reader thread is the only reader of the port */
+		errno = EBUSY;
+		return -1;
+	}
+	return uring_read(u, uart->fd, rx, length, -1, &uart->rx_stats, fxn, arg);
+}
+
+/*
+ *  ======== uart_rx_get_stats ========
+ */
+int uart_rx_get_stats(uart_properties *uart, uart_rx_stats *stats) {
+	struct uart_rx *rx = uart->rx;
+
+	if (rx == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	stats->bytes = __atomic_load_n(&rx->stats.bytes, __ATOMIC_RELAXED);
+	stats->frames = __atomic_load_n(&rx->stats.frames, __ATOMIC_RELAXED);
+	stats->dropped_frames = __atomic_load_n(&rx->stats.dropped_frames, __ATOMIC_RELAXED);
+	stats->overflows = ring_overflows(&rx->bytes);
+	stats->max_latency_ns = __atomic_load_n(&rx->stats.max_latency_ns, __ATOMIC_RELAXED);
+	stats->total_latency_ns = __atomic_load_n(&rx->stats.total_latency_ns, __ATOMIC_RELAXED);
 	return 0;
 }
 
@@ -111,6 +1143,18 @@ int uart_read(uart_properties *uart,unsigned char *rx, int length) {
  *  ======== uart_close ========
  */
 int uart_close(uart_properties *uart) {
+	if (uart->rx != NULL) {
+		uart_rx_close(uart);
+	}
+	if (uart->tx != NULL) {
+		if (uart_flush(uart, UART_TX_CLOSE_TIMEOUT) != 0) {
+			log_err("UART %i closed with data still queued", uart->uart_id);
+		}
+		uart_tx_close(uart);
+	}
+	/* A uring write still in flight would use it, see uart_uring_write() */
+	free(uart->uring_tx);
+	uart->uring_tx = NULL;
 	close(uart->fd);
 	return 0;
 }
\ No newline at end of file
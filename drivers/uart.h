@@ -60,6 +60,48 @@
  *  3.  Call uart_open(), passing the uart_properties structure.
  *  4.  Check that the uint8_t returned by uart_open() is zero.
  *
+ *  path opens another device instead of the one of uart_id, such as a USB
+ *  adapter or one end of a pseudo terminal.
+ *
+ *  ### Line configuration #
+ *
+ *  The port is opened in raw mode: bytes are passed through untouched, so
+ *  binary protocols are safe. Set text_mode to map received CR to NL.
+ *  data_bits, parity and stop_bits default to 8N1 when zero.
+ *
+ *  custom_baud sets any rate, like 250000 for DMX, through termios2 and
+ *  BOTHER; the driver rounds it to what its clock allows.
+ *
+ *  By default reads never block. A non zero vmin or vtime switches the
+ *  port to blocking mode, where a read returns after vmin bytes or when
+ *  the line stays idle for vtime tenths of a second after the first one.
+ *  Blocking mode cannot be combined with UART_TX_ASYNC, UART_RX_THREAD or
+ *  modbus_open(), whose threads and timeouts need reads and writes that
+ *  return at once.
+ *
+ *  low_latency asks the serial driver to push received bytes to the
+ *  application immediately instead of batching them, the main cost in
+ *  request/response round trips. Drivers that do not support it are left
+ *  as they are.
+ *
+ *  ### RS-485 #
+ *
+ *  rs485 lets the port drive the DE (driver enable) line of an RS-485
+ *  transceiver, asserted rs485_pre_us before the first bit and released
+ *  rs485_post_us after the last stop bit:
+ *  - UART_RS485_KERNEL has the serial driver switch RTS, with TIOCSRS485.
+ *    The kernel takes the delays in milliseconds, they are rounded up.
+ *  - UART_RS485_GPIO has uart_write() switch the rs485_de pin. After
+ *    writing, it sleeps for the time the queued bytes need to go out and
+ *    then polls TIOCSERGETLSR until the shift register is empty, so the
+ *    line is released within microseconds of the last stop bit. Ports
+ *    without TIOCSERGETLSR use tcdrain(). Needs UART_TX_SYNC.
+ *  - UART_RS485_AUTO tries the kernel first and falls back to the GPIO.
+ *
+ *  uart_open() changes rs485 to the method in use. With the GPIO, the time
+ *  from the empty shift register to the release of DE, rs485_post_us
+ *  included, is recorded in rs485_stats.
+ *
  *  ### Reading and Writing data #
  *
  *  The example code reads one byte frome the UART instance, and then writes
@@ -72,6 +114,68 @@
  *  uart_read(uart, rx, 100);
  *  @endcode
  *
+ *  ### Asynchronous transmit #
+ *
+ *  With tx_mode set to UART_TX_ASYNC, uart_open() starts a writer thread
+ *  and uart_write() only copies the data into a per UART ring of tx_size
+ *  bytes. The thread drains the ring whenever the port accepts more data,
+ *  so a slow link never stalls the caller. tx_policy decides what happens
+ *  when the ring is full:
+ *  - UART_TX_BLOCK waits for room,
+ *  - UART_TX_DROP_OLDEST discards the oldest queued bytes,
+ *  - UART_TX_FAIL queues nothing and returns an error.
+ *
+ *  uart_flush() waits until everything queued has been written.
+ *  tx_stats then counts the calls queueing data, and tx_writer_stats the
+ *  chunks the thread writes, with their EAGAIN and short writes.
+ *
+ *  ### Receive thread #
+ *
+ *  With rx_mode set to UART_RX_THREAD, uart_open() starts a reader thread
+ *  that blocks in poll() and moves incoming bytes into a lock-free ring of
+ *  rx_size bytes, so nothing is lost while the application is busy.
+ *  uart_read() then takes bytes from the ring without a system call.
+ *
+ *  When rx_callback is set, the reader thread instead splits the stream
+ *  into frames and calls it once per complete frame, from the reader
+ *  thread. rx_frame chooses where a frame ends:
+ *  - UART_FRAME_DELIMITER after the byte rx_delimiter, which is removed,
+ *  - UART_FRAME_LENGTH after rx_length bytes,
+ *  - UART_FRAME_IDLE when the line stays quiet for rx_idle_us.
+ *
+ *  A non zero rx_idle_us also ends a partial delimited or fixed length
+ *  frame. Frames that lost bytes because the ring was full are dropped and
+ *  counted, see uart_rx_get_stats().
+ *
+ *  @code
+ *  void on_frame(uart_properties *uart, const uint8_t *frame, size_t length, void *arg);
+ *
+ *  uart->rx_mode = UART_RX_THREAD;
+ *  uart->rx_frame = UART_FRAME_DELIMITER;
+ *  uart->rx_delimiter = '\n';
+ *  uart->rx_callback = on_frame;
+ *  uart_open(uart);
+ *  @endcode
+ *
+ *  @code
+ *  uart_properties *uart = calloc(1, sizeof(uart_properties));
+ *  uart->uart_id = uart1;
+ *  uart->baudrate = B9600;
+ *  uart->tx_mode = UART_TX_ASYNC;
+ *  uart->tx_policy = UART_TX_DROP_OLDEST;
+ *  uart_open(uart);
+ *
+ *  uart_write(uart, tx, strlen(tx));
+ *  uart_flush(uart, 100);
+ *  @endcode
+ *
+ *  ### Capture #
+ *
+ *  Pointing capture at a uart_capture opened with uart_capture_open()
+ *  records every received and sent chunk with its time, see
+ *  uart_capture.h. Recording is a copy into a memory mapped file, cheap
+ *  enough to leave on in production.
+ *
  */
 
 
@@ -79,7 +183,34 @@
 #define __UART_H_
 
 #include <stdio.h>
+#include <stdint.h>
 #include <termios.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "gpio.h"
+#include "stats.h"
+#include "uring.h"
+#include "uart_capture.h"
+
+/*!
+ *  @brief      Default size of the asynchronous transmit ring, in bytes
+ */
+#define UART_TX_SIZE 4096
+
+/*!
+ *  @brief      Time uart_close() waits for queued data, in milliseconds
+ */
+#define UART_TX_CLOSE_TIMEOUT 1000
+
+/*!
+ *  @brief      Default size of the receive ring, in bytes
+ */
+#define UART_RX_SIZE 16384
+
+/*!
+ *  @brief      Default idle gap ending a UART_FRAME_IDLE frame, in microseconds
+ */
+#define UART_RX_IDLE_US 2000
 
 /*!
  *  @brief      Available UART peripherals
@@ -92,12 +223,124 @@ typedef enum {
 } uart;
 
 /*!
- *  @brief      UART properties structure type definition
+ *  @brief      Parity settings
+ */
+typedef enum {
+	UART_PARITY_NONE = 0,
+	UART_PARITY_ODD = 1,
+	UART_PARITY_EVEN = 2
+} UART_PARITY;
+
+/*!
+ *  @brief      RS-485 driver enable control
+ */
+typedef enum {
+	UART_RS485_OFF = 0,
+	UART_RS485_KERNEL = 1,	/*!< @brief the serial driver switches RTS */
+	UART_RS485_GPIO = 2,	/*!< @brief uart_write() switches rs485_de */
+	UART_RS485_AUTO = 3		/*!< @brief the kernel when it can, else the GPIO */
+} UART_RS485;
+
+/*!
+ *  @brief      Transmit modes
+ */
+typedef enum {
+	UART_TX_SYNC = 0,		/*!< @brief uart_write() writes to the port */
+	UART_TX_ASYNC = 1		/*!< @brief uart_write() queues for the writer thread */
+} UART_TX_MODE;
+
+/*!
+ *  @brief      What an asynchronous uart_write() does when the ring is full
+ */
+typedef enum {
+	UART_TX_BLOCK = 0,
+	UART_TX_DROP_OLDEST = 1,
+	UART_TX_FAIL = 2
+} UART_TX_POLICY;
+
+/*!
+ *  @brief      Receive modes
+ */
+typedef enum {
+	UART_RX_POLL = 0,		/*!< @brief uart_read() reads the port */
+	UART_RX_THREAD = 1		/*!< @brief a reader thread fills a ring */
+} UART_RX_MODE;
+
+/*!
+ *  @brief      How the reader thread finds the end of a frame
+ */
+typedef enum {
+	UART_FRAME_NONE = 0,
+	UART_FRAME_DELIMITER = 1,
+	UART_FRAME_LENGTH = 2,
+	UART_FRAME_IDLE = 3
+} UART_FRAME;
+
+/*!
+ *  @brief      Receive statistics
  */
 typedef struct {
+	uint64_t bytes;				/*!< @brief bytes read from the port */
+	uint64_t frames;			/*!< @brief frames delivered */
+	uint64_t dropped_frames;	/*!< @brief frames dropped after an overflow */
+	uint64_t overflows;			/*!< @brief bytes lost because the ring was full */
+	uint64_t max_latency_ns;	/*!< @brief worst time from last byte to callback */
+	uint64_t total_latency_ns;	/*!< @brief divide by frames for the average */
+} uart_rx_stats;
+
+struct uart_properties;
+
+/*!
+ *  @brief      Frame callback, called from the reader thread
+ *
+ *  \a frame is only valid until the callback returns.
+ */
+typedef void (*uart_rx_fxn)(struct uart_properties *uart, const uint8_t *frame,
+		size_t length, void *arg);
+
+/*!
+ *  @brief      UART properties structure type definition
+ *
+ *  Fields the caller does not use must be zero.
+ */
+typedef struct uart_properties {
 	int fd;
 	uart uart_id;
-	int baudrate;
+	const char *path;		/*!< @brief device, NULL means /dev/ttyO<uart_id> */
+	int baudrate;			/*!< @brief a Bxxxx constant, 0 means B9600 */
+	uint32_t custom_baud;	/*!< @brief any rate in bits/s, overrides baudrate */
+	uint8_t data_bits;		/*!< @brief 5 to 8, 0 means 8 */
+	UART_PARITY parity;
+	uint8_t stop_bits;		/*!< @brief 1 or 2, 0 means 1 */
+	uint8_t text_mode;		/*!< @brief map received CR to NL */
+	uint8_t vmin;			/*!< @brief bytes a blocking read waits for */
+	uint8_t vtime;			/*!< @brief inter-byte timeout, in tenths of a second */
+	uint8_t low_latency;	/*!< @brief ask the driver for ASYNC_LOW_LATENCY */
+	UART_TX_MODE tx_mode;
+	UART_TX_POLICY tx_policy;
+	size_t tx_size;			/*!< @brief ring size, 0 means UART_TX_SIZE */
+	struct uart_tx *tx;		/*!< @brief writer state, owned by the driver */
+	UART_RX_MODE rx_mode;
+	size_t rx_size;			/*!< @brief ring size, 0 means UART_RX_SIZE */
+	UART_FRAME rx_frame;
+	uint8_t rx_delimiter;
+	size_t rx_length;
+	uint32_t rx_idle_us;
+	uart_rx_fxn rx_callback;
+	void *rx_arg;
+	struct uart_rx *rx;		/*!< @brief reader state, owned by the driver */
+	UART_RS485 rs485;
+	gpio_properties *rs485_de;	/*!< @brief DE pin, opened as an output by the caller */
+	uint8_t rs485_de_low;	/*!< @brief DE is active low */
+	uint32_t rs485_pre_us;	/*!< @brief DE asserted before the first bit */
+	uint32_t rs485_post_us;	/*!< @brief DE held after the last stop bit */
+	int8_t rs485_lsr;		/*!< @brief TIOCSERGETLSR works, kept by the driver */
+	stats_op rs485_stats;	/*!< @brief DE turnaround, UART_RS485_GPIO only */
+	stats_op tx_stats;		/*!< @brief uart_write() and uart_writev() calls */
+	stats_op tx_writer_stats;	/*!< @brief chunks written by the UART_TX_ASYNC writer */
+	struct uart_uring *uring_tx;	/*!< @brief write in flight on a uring, owned by the driver */
+	stats_op rx_stats;		/*!< @brief uart_read() calls */
+	uart_capture *capture;	/*!< @brief records the traffic, NULL for none */
 } uart_properties;
 
 /*!
@@ -123,6 +366,10 @@ extern int uart_open(uart_properties *uart);
  *
  *  @warning None.
  *
+ *  In UART_TX_ASYNC mode with UART_TX_DROP_OLDEST, a buffer larger than
+ *  the ring is not an error: its last tx_size bytes are queued, as with
+ *  uart_writev(), and the rest is counted by uart_tx_dropped().
+ *
  *  @pre	uart_open() has been called
  *
  *  @param  uart		A uart_properties structure 
@@ -136,6 +383,79 @@ extern int uart_open(uart_properties *uart);
  */
 extern int uart_write(uart_properties *uart, char *tx, int length);
 
+/*!
+ *  @brief  Function that writes several buffers to a UART as one stream.
+ *
+ *  %uart_writev() sends the \a count segments of \a iov in order, as
+ *  few writev() calls as the port allows. Short writes and EAGAIN are
+ *  resumed after waiting for the port, so the whole stream is written
+ *  unless an error occurs. Header, payload and CRC can be sent without
+ *  copying them together, and many small frames with a single call.
+ *
+ *  In UART_TX_ASYNC mode the segments are queued as one unit under the
+ *  configured tx_policy. With UART_TX_DROP_OLDEST, a call larger than the
+ *  ring queues only its last tx_size bytes and returns that count.
+ *
+ *  @pre	uart_open() has been called
+ *
+ *  @param  uart		A uart_properties structure 
+ *
+ *  @param  iov     	The segments to send
+ *
+ *  @param  count       The number of segments in \a iov
+ *
+ *  @return Returns the number of bytes written or queued, -1 on error.
+ *          After a synchronous error, the bytes already written are
+ *          returned instead.
+ */
+extern ssize_t uart_writev(uart_properties *uart, const struct iovec *iov, int count);
+
+/*!
+ *  @brief  Sets an arbitrary baud rate with termios2 and BOTHER
+ *
+ *  Called by uart_open() for custom_baud, can also change the rate of an
+ *  open port.
+ *
+ *  @param  fd          File descriptor of the port
+ *
+ *  @param  baud        Rate in bits/s
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern int uart_set_custom_baud(int fd, uint32_t baud);
+
+/*!
+ *  @brief  Returns the time one character takes on the line
+ *
+ *  Counts the start bit, the data bits, the parity bit and the stop bits
+ *  as configured in \a uart, at baudrate or custom_baud.
+ *
+ *  @param  uart		A uart_properties structure
+ *
+ *  @return Returns the character time in nanoseconds
+ */
+extern uint32_t uart_char_ns(uart_properties *uart);
+
+/*!
+ *  @brief  Waits until all the queued data has been written to the port
+ *
+ *  In UART_TX_SYNC mode it waits for the port to send its output.
+ *
+ *  @pre	uart_open() has been called
+ *
+ *  @param  uart		A uart_properties structure 
+ *
+ *  @param  timeout     Maximum wait in milliseconds, -1 waits forever
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern int uart_flush(uart_properties *uart, int timeout);
+
+/*!
+ *  @brief  Returns the number of bytes discarded by UART_TX_DROP_OLDEST
+ */
+extern uint64_t uart_tx_dropped(uart_properties *uart);
+
 /*!
  *  @brief  Function that reads data from a UART.
  *
@@ -154,13 +474,70 @@ extern int uart_write(uart_properties *uart, char *tx, int length);
  *  @param  length      The number of bytes in the buffer that should be read
  *                      from the UART
  *
- *  @return Returns if an error ocurred, 0 means no error ocurred
+ *  With a reader thread the bytes come from its ring. It cannot be used
+ *  together with rx_callback.
+ *
+ *  @return Returns the number of bytes read, 0 if none were waiting, -1 on
+ *          error
  */
 extern int uart_read(uart_properties *uart,unsigned char *rx, int length);
 
+/*!
+ *  @brief  Copies the receive statistics of a UART with a reader thread
+ *
+ *  @param  uart		A uart_properties structure 
+ *
+ *  @param  stats       Receives the counters
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern int uart_rx_get_stats(uart_properties *uart, uart_rx_stats *stats);
+
+/*!
+ *  @brief  Queues a write on a uring
+ *
+ *  The write reaches the port at the next uring_submit(), batched with the
+ *  other queued operations, and is counted in tx_stats at completion.
+ *
+ *  A port has one write in flight at a time, so bytes never overtake each
+ *  other: another call fails with EBUSY until \a fxn has run. When the
+ *  port takes part of the data, the rest is queued again by the driver
+ *  and \a fxn only runs once everything is written, or when the port is
+ *  full. It then gets the bytes written, or -EAGAIN when there were none,
+ *  and the caller queues the rest later.
+ *
+ *  Not available with tx_mode UART_TX_ASYNC or UART_RS485_GPIO. The data is
+ *  not recorded in capture. Reap the completion before uart_close().
+ *
+ *  @param  u           A uring structure
+ *  @param  uart        A uart_properties structure
+ *  @param  tx          Data, valid until the completion
+ *  @param  length      Bytes to write
+ *  @param  fxn         Completion callback, can be NULL
+ *  @param  arg         Passed to fxn
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uart_uring_write(uring *u, uart_properties *uart, const void *tx, size_t length,
+		uring_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Queues a read on a uring
+ *
+ *  Completes with -EAGAIN when nothing was waiting. Not available with
+ *  rx_mode UART_RX_THREAD. The data is not recorded in capture.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uart_uring_read(uring *u, uart_properties *uart, void *rx, size_t length,
+		uring_fxn fxn, void *arg);
+
 /*!
  *  @brief  Function to close a UART peripheral specified by the UART handle
  *
+ *  Data still queued for asynchronous transmission gets up to
+ *  UART_TX_CLOSE_TIMEOUT milliseconds to go out.
+ *
  *  @warning None.
  *
  *  @pre	uart_open() has been called
@@ -0,0 +1,62 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       uart_baud.c 
+ *	@brief      Arbitrary UART baud rates
+ *	@author     Maximiliano Valencia
+ *	@date       4/13/2018
+ *
+ *  struct termios2 and BOTHER come from the kernel headers, which clash
+ *  with the libc termios.h included by driver.h and uart.h. This file is
+ *  kept apart so it can use them.
+ */
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include "log.h"
+
+/*
+ *  ======== uart_set_custom_baud ========
+ */
+int uart_set_custom_baud(int fd, uint32_t baud) {
+	struct termios2 options;
+
+	if (ioctl(fd, TCGETS2, &options) < 0) {
+		log_err("uart_set_custom_baud(): TCGETS2: %m");
+		return -1;
+	}
+	options.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	options.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	options.c_ispeed = baud;
+	options.c_ospeed = baud;
+	if (ioctl(fd, TCSETS2, &options) < 0) {
+		log_err("uart_set_custom_baud(): TCSETS2: %m");
+		return -1;
+	}
+
+	/* The driver rounds to what its clock divider can produce */
+	if (ioctl(fd, TCGETS2, &options) == 0 && options.c_ospeed != baud) {
+		log_info("UART baud rate %u set as %u", baud, options.c_ospeed);
+	}
+	return 0;
+}
@@ -0,0 +1,338 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       uart_capture.c 
+ *	@brief      Binary capture of UART traffic
+ *	@author     Maximiliano Valencia
+ *	@date       4/18/2018
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+/* UART Capture Header File */
+#include "driver.h"
+#include "uart_capture.h"
+#include "stats.h"
+
+/*!
+ *  @brief      File format version
+ */
+#define UART_CAPTURE_VERSION 1
+
+/*!
+ *  @brief      Offset of the ring in the file, room for the header to grow
+ */
+#define UART_CAPTURE_HEADER 128
+
+/*!
+ *  @brief      Smallest ring accepted
+ */
+#define UART_CAPTURE_MIN 4096
+
+#define UART_CAPTURE_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/*
+ *  ======== uart_capture_map ========
+ */
+static uint8_t uart_capture_map(uart_capture *capture, int prot) {
+	capture->map = mmap(NULL, capture->map_size, prot, MAP_SHARED | MAP_POPULATE,
+			capture->fd, 0);
+	if (capture->map == MAP_FAILED) {
+		log_err("uart_capture_map(): mmap: %m");
+		close(capture->fd);
+		capture->fd = -1;
+		capture->map = NULL;
+		return -1;
+	}
+	capture->header = capture->map;
+	capture->ring = (uint8_t *)capture->map + capture->header->header_size;
+	return 0;
+}
+
+/*
+ *  ======== uart_capture_open ========
+ */
+uint8_t uart_capture_open(uart_capture *capture, const char *path, size_t size) {
+	uart_capture_header header;
+	struct timespec wall;
+	int status;
+
+	size = UART_CAPTURE_ALIGN(size);
+	if (size < UART_CAPTURE_MIN) {
+		log_err("uart_capture_open(): %zu bytes is less than %i", size, UART_CAPTURE_MIN);
+		errno = EINVAL;
+		return -1;
+	}
+	capture->writable = 1;
+	capture->map_size = UART_CAPTURE_HEADER + size;
+	capture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (capture->fd < 0) {
+		log_err("uart_capture_open(): %s: %m", path);
+		return -1;
+	}
+	/* Allocate the blocks now, a full disk must not fault a store later */
+	status = posix_fallocate(capture->fd, 0, capture->map_size);
+	if (status == EOPNOTSUPP || status == EINVAL) {
+		status = ftruncate(capture->fd, capture->map_size) < 0 ? errno : 0;
+	}
+	if (status != 0) {
+		errno = status;
+		log_err("uart_capture_open(): %s: %m", path);
+		close(capture->fd);
+		capture->fd = -1;
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, UART_CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = UART_CAPTURE_VERSION;
+	header.header_size = UART_CAPTURE_HEADER;
+	header.size = size;
+	header.start_ns = stats_now();
+	clock_gettime(CLOCK_REALTIME, &wall);
+	header.start_realtime_ns = (int64_t)wall.tv_sec * 1000000000 + wall.tv_nsec;
+	if (pwrite(capture->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+		log_err("uart_capture_open(): %s: %m", path);
+		close(capture->fd);
+		capture->fd = -1;
+		return -1;
+	}
+	if (uart_capture_map(capture, PROT_READ | PROT_WRITE) != 0) {
+		return -1;
+	}
+	pthread_mutex_init(&capture->lock, NULL);
+	log_info("Capturing UART traffic to %s, %zu bytes", path, size);
+	return 0;
+}
+
+/*
+ *  ======== uart_capture_load ========
+ */
+uint8_t uart_capture_load(uart_capture *capture, const char *path) {
+	uart_capture_header header;
+	struct stat st;
+
+	capture->writable = 0;
+	capture->map = NULL;
+	capture->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (capture->fd < 0) {
+		log_err("uart_capture_load(): %s: %m", path);
+		return -1;
+	}
+	if (pread(capture->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+			|| fstat(capture->fd, &st) < 0
+			|| memcmp(header.magic, UART_CAPTURE_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != UART_CAPTURE_VERSION
+			|| header.header_size < sizeof(header) || header.size < UART_CAPTURE_MIN
+			|| (uint64_t)st.st_size < header.header_size + header.size) {
+		log_err("uart_capture_load(): %s is not a capture", path);
+		close(capture->fd);
+		capture->fd = -1;
+		errno = EINVAL;
+		return -1;
+	}
+	capture->map_size = header.header_size + header.size;
+	if (uart_capture_map(capture, PROT_READ) != 0) {
+		return -1;
+	}
+	pthread_mutex_init(&capture->lock, NULL);
+	return 0;
+}
+
+/*
+ *  ======== uart_capture_record_size ========
+ *  Bytes the record at \a position takes, wrapping included.
+ */
+static uint64_t uart_capture_record_size(uart_capture *capture, uint64_t position) {
+	uint64_t offset = position % capture->header->size;
+	const uart_capture_record *record;
+
+	if (capture->header->size - offset < sizeof(uart_capture_record)) {
+		return capture->header->size - offset;
+	}
+	record = (const uart_capture_record *)(capture->ring + offset);
+	return sizeof(uart_capture_record) + UART_CAPTURE_ALIGN(record->length);
+}
+
+/*
+ *  ======== uart_capture_reserve ========
+ *  Returns where \a length bytes of record fit without wrapping, putting
+ *  a pad record before the end of the ring when needed, and drops the
+ *  oldest records to make room. Called with the lock held.
+ */
+static uint8_t *uart_capture_reserve(uart_capture *capture, size_t length) {
+	uart_capture_header *header = capture->header;
+	uint64_t head = header->head, tail = header->tail, end;
+	uint64_t offset = head % header->size, room = header->size - offset;
+	uart_capture_record *pad;
+
+	end = head + (room < length ? room : 0) + length;
+	while (end - tail > header->size) {
+		if (header->size - tail % header->size >= sizeof(uart_capture_record)
+				&& ((uart_capture_record *)(capture->ring + tail % header->size))->direction
+				!= UART_CAPTURE_PAD) {
+			header->dropped++;
+		}
+		tail += uart_capture_record_size(capture, tail);
+	}
+	__atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+
+	if (room < length) {
+		if (room >= sizeof(uart_capture_record)) {
+			pad = (uart_capture_record *)(capture->ring + offset);
+			memset(pad, 0, sizeof(*pad));
+			pad->length = room - sizeof(uart_capture_record);
+			pad->direction = UART_CAPTURE_PAD;
+		}
+		head += room;
+		__atomic_store_n(&header->head, head, __ATOMIC_RELEASE);
+		offset = 0;
+	}
+	return capture->ring + offset;
+}
+
+/*
+ *  ======== uart_capture_appendv ========
+ */
+void uart_capture_appendv(uart_capture *capture, UART_CAPTURE_DIR direction, int port,
+		int64_t timestamp, const struct iovec *iov, int count, size_t length) {
+	uart_capture_record *record;
+	size_t limit, chunk, copied, take, skip = 0;
+	uint8_t *data;
+
+	if (capture == NULL || !capture->writable || length == 0) {
+		return;
+	}
+	if (timestamp == 0) {
+		timestamp = stats_now();
+	}
+	/* A record never takes more than half of the ring */
+	limit = capture->header->size / 2 - sizeof(uart_capture_record);
+	if (limit > UART_CAPTURE_RECORD_MAX) {
+		limit = UART_CAPTURE_RECORD_MAX;
+	}
+
+	pthread_mutex_lock(&capture->lock);
+	while (length > 0) {
+		chunk = length < limit ? length : limit;
+		record = (uart_capture_record *)uart_capture_reserve(capture,
+				sizeof(uart_capture_record) + UART_CAPTURE_ALIGN(chunk));
+		record->timestamp_ns = timestamp;
+		record->length = chunk;
+		record->direction = direction;
+		record->port = port;
+		record->reserved = 0;
+		data = (uint8_t *)(record + 1);
+		for (copied = 0; copied < chunk; ) {
+			take = iov->iov_len - skip;
+			if (take > chunk - copied) {
+				take = chunk - copied;
+			}
+			memcpy(data + copied, (const uint8_t *)iov->iov_base + skip, take);
+			copied += take;
+			skip += take;
+			if (skip == iov->iov_len && count > 1) {
+				iov++;
+				count--;
+				skip = 0;
+			}
+		}
+		length -= chunk;
+		capture->header->records++;
+		/* Readers of the live file see the record once head covers it */
+		__atomic_store_n(&capture->header->head, capture->header->head
+				+ sizeof(uart_capture_record) + UART_CAPTURE_ALIGN(chunk), __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&capture->lock);
+}
+
+/*
+ *  ======== uart_capture_append ========
+ */
+void uart_capture_append(uart_capture *capture, UART_CAPTURE_DIR direction, int port,
+		int64_t timestamp, const void *data, size_t length) {
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = length;
+	uart_capture_appendv(capture, direction, port, timestamp, &iov, 1, length);
+}
+
+/*
+ *  ======== uart_capture_next ========
+ */
+int uart_capture_next(uart_capture *capture, uint64_t *position,
+		const uart_capture_record **record, const uint8_t **data) {
+	uint64_t head = __atomic_load_n(&capture->header->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = __atomic_load_n(&capture->header->tail, __ATOMIC_ACQUIRE);
+	uint64_t offset;
+	const uart_capture_record *current;
+
+	if (*position < tail) {
+		*position = tail;
+	}
+	while (*position < head) {
+		offset = *position % capture->header->size;
+		*position += uart_capture_record_size(capture, *position);
+		if (capture->header->size - offset < sizeof(uart_capture_record)) {
+			continue;
+		}
+		current = (const uart_capture_record *)(capture->ring + offset);
+		if (current->direction == UART_CAPTURE_PAD) {
+			continue;
+		}
+		*record = current;
+		*data = (const uint8_t *)(current + 1);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== uart_capture_close ========
+ */
+uint8_t uart_capture_close(uart_capture *capture) {
+	uint8_t status = 0;
+
+	if (capture->map == NULL) {
+		return 0;
+	}
+	if (capture->writable) {
+		log_info("UART capture closed, %llu records, %llu dropped",
+				(unsigned long long)capture->header->records,
+				(unsigned long long)capture->header->dropped);
+		/* Not needed for the file to be complete, only to have it on disk */
+		if (msync(capture->map, capture->map_size, MS_SYNC) < 0) {
+			log_err("uart_capture_close(): msync: %m");
+			status = -1;
+		}
+	}
+	munmap(capture->map, capture->map_size);
+	close(capture->fd);
+	pthread_mutex_destroy(&capture->lock);
+	capture->map = NULL;
+	capture->header = NULL;
+	capture->ring = NULL;
+	capture->fd = -1;
+	return status;
+}
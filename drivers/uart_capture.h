@@ -0,0 +1,190 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       uart_capture.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/18/2018
+ *  @brief      Binary capture of UART traffic
+ *
+ *  # Overview #
+ *  A capture records every chunk a UART receives and sends, with its
+ *  CLOCK_MONOTONIC time and direction, into a ring kept in a memory mapped
+ *  file. The file is allocated when the capture is opened; appending a
+ *  record is a copy into the mapping under an uncontended mutex, without
+ *  system calls or formatting. When the ring is full the oldest records
+ *  are overwritten and counted in dropped. The kernel writes the pages
+ *  back on its own, so the file survives a crash of the application.
+ *
+ *  Set uart_properties.capture to record a port. Received chunks are
+ *  recorded as they are read from the port, by the reader thread when
+ *  there is one, and sent chunks as the port accepts them. Operations
+ *  queued on a uring are not recorded.
+ *
+ *  tools/uart_replay.c plays a capture back through a pseudo terminal,
+ *  see "make replay".
+ *
+ *  # File format #
+ *  A uart_capture_header, then size bytes of ring. Records are a
+ *  uart_capture_record followed by length bytes, padded to 8 bytes, and
+ *  never wrap: a UART_CAPTURE_PAD record, or less than a record header of
+ *  room, fills the end of the ring. Records go from tail to head, both
+ *  counted in bytes since the capture was created.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  uart_capture capture;
+ *
+ *  uart_capture_open(&capture, "/var/log/uart1.cap", 16 << 20);
+ *  uart->capture = &capture;
+ *  uart_open(uart);
+ *  ...
+ *  uart_close(uart);
+ *  uart_capture_close(&capture);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __UART_CAPTURE_H_
+#define __UART_CAPTURE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*!
+ *  @brief      First bytes of a capture file
+ */
+#define UART_CAPTURE_MAGIC "BBDLCAP1"
+
+/*!
+ *  @brief      Longest record, larger chunks are split
+ */
+#define UART_CAPTURE_RECORD_MAX 0xFFFF
+
+/*!
+ *  @brief      Record directions
+ */
+typedef enum {
+	UART_CAPTURE_RX = 0,		/*!< @brief received by the port */
+	UART_CAPTURE_TX = 1,		/*!< @brief sent by the port */
+	UART_CAPTURE_PAD = 0xFF		/*!< @brief fills the end of the ring */
+} UART_CAPTURE_DIR;
+
+/*!
+ *  @brief      File header
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;		/*!< @brief offset of the ring in the file */
+	uint64_t size;				/*!< @brief ring size in bytes */
+	uint64_t head;				/*!< @brief where the next record goes */
+	uint64_t tail;				/*!< @brief where the oldest record starts */
+	uint64_t records;			/*!< @brief records appended */
+	uint64_t dropped;			/*!< @brief records overwritten */
+	int64_t start_ns;			/*!< @brief CLOCK_MONOTONIC when the capture was opened */
+	int64_t start_realtime_ns;	/*!< @brief CLOCK_REALTIME at the same moment */
+} uart_capture_header;
+
+/*!
+ *  @brief      Record header
+ */
+typedef struct {
+	int64_t timestamp_ns;		/*!< @brief CLOCK_MONOTONIC */
+	uint16_t length;			/*!< @brief data bytes that follow */
+	uint8_t direction;			/*!< @brief a UART_CAPTURE_DIR */
+	uint8_t port;				/*!< @brief uart_id of the port */
+	uint32_t reserved;
+} uart_capture_record;
+
+/*!
+ *  @brief      Capture structure type definition
+ */
+typedef struct uart_capture {
+	int fd;
+	void *map;
+	size_t map_size;
+	uart_capture_header *header;
+	uint8_t *ring;
+	int writable;
+	pthread_mutex_t lock;
+} uart_capture;
+
+/*!
+ *  @brief  Creates a capture file, replacing an existing one
+ *
+ *  @param  capture A uart_capture structure
+ *  @param  path    File to create
+ *  @param  size    Ring size in bytes, rounded up to a multiple of 8
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uart_capture_open(uart_capture *capture, const char *path, size_t size);
+
+/*!
+ *  @brief  Opens an existing capture file for reading
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uart_capture_load(uart_capture *capture, const char *path);
+
+/*!
+ *  @brief  Appends a chunk
+ *
+ *  @param  capture     A uart_capture structure
+ *  @param  direction   UART_CAPTURE_RX or UART_CAPTURE_TX
+ *  @param  port        Port number stored with the record
+ *  @param  timestamp   CLOCK_MONOTONIC nanoseconds, 0 reads the clock
+ *  @param  data        The chunk
+ *  @param  length      Bytes in the chunk
+ */
+extern void uart_capture_append(uart_capture *capture, UART_CAPTURE_DIR direction, int port,
+		int64_t timestamp, const void *data, size_t length);
+
+/*!
+ *  @brief  Appends the first \a length bytes of a list of segments as one chunk
+ */
+extern void uart_capture_appendv(uart_capture *capture, UART_CAPTURE_DIR direction, int port,
+		int64_t timestamp, const struct iovec *iov, int count, size_t length);
+
+/*!
+ *  @brief  Walks the records from the oldest one
+ *
+ *  @param  capture     A uart_capture structure
+ *  @param  position    0 to start, then passed back unchanged
+ *  @param  record      Receives the record header
+ *  @param  data        Receives the record data, inside the mapping
+ *
+ *  @return Returns 1 when a record was returned, 0 at the end
+ */
+extern int uart_capture_next(uart_capture *capture, uint64_t *position,
+		const uart_capture_record **record, const uint8_t **data);
+
+/*!
+ *  @brief  Unmaps and closes a capture
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uart_capture_close(uart_capture *capture);
+
+#endif /* __UART_CAPTURE_H_ */
@@ -0,0 +1,592 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       uart_frame.c 
+ *	@brief      Framing codecs and CRCs for UART streams
+ *	@author     Maximiliano Valencia
+ *	@date       4/13/2018
+ */
+
+#include <pthread.h>
+/* UART Driver Header File */
+#include "driver.h"
+#include "uart_frame.h"
+
+#define COBS_BLOCK 0xFF
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+/* Reflected polynomials */
+#define CRC16_POLY 0xA001
+#define CRC32_POLY 0xEDB88320
+
+static uint16_t crc16_table[8][256];
+static uint32_t crc32_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/*
+ *  ======== crc_tables ========
+ *  Table k gives the effect of a byte followed by k zero bytes, so eight
+ *  bytes can be folded in with eight independent lookups.
+ */
+static void crc_tables(void) {
+	uint32_t crc16, crc32;
+	int i, j, k;
+
+	for (i = 0; i < 256; i++) {
+		crc16 = i;
+		crc32 = i;
+		for (j = 0; j < 8; j++) {
+			crc16 = (crc16 >> 1) ^ ((crc16 & 1) ? CRC16_POLY : 0);
+			crc32 = (crc32 >> 1) ^ ((crc32 & 1) ? CRC32_POLY : 0);
+		}
+		crc16_table[0][i] = crc16;
+		crc32_table[0][i] = crc32;
+	}
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			crc16 = crc16_table[k - 1][i];
+			crc32 = crc32_table[k - 1][i];
+			crc16_table[k][i] = (crc16 >> 8) ^ crc16_table[0][crc16 & 0xFF];
+			crc32_table[k][i] = (crc32 >> 8) ^ crc32_table[0][crc32 & 0xFF];
+		}
+	}
+}
+
+/*
+ *  ======== uart_crc16 ========
+ */
+uint16_t uart_crc16(uint16_t crc, const void *data, size_t length) {
+	const uint8_t *p = data;
+	uint32_t a, b;
+
+	pthread_once(&crc_once, crc_tables);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (length >= 8) {
+		memcpy(&a, p, 4);
+		memcpy(&b, p + 4, 4);
+		a ^= crc;
+		crc = crc16_table[7][a & 0xFF] ^ crc16_table[6][(a >> 8) & 0xFF] ^
+				crc16_table[5][(a >> 16) & 0xFF] ^ crc16_table[4][a >> 24] ^
+				crc16_table[3][b & 0xFF] ^ crc16_table[2][(b >> 8) & 0xFF] ^
+				crc16_table[1][(b >> 16) & 0xFF] ^ crc16_table[0][b >> 24];
+		p += 8;
+		length -= 8;
+	}
+#endif
+	while (length-- > 0) {
+		crc = (crc >> 8) ^ crc16_table[0][(crc ^ *p++) & 0xFF];
+	}
+	return crc;
+}
+
+/*
+ *  ======== uart_crc32 ========
+ */
+uint32_t uart_crc32(uint32_t crc, const void *data, size_t length) {
+	const uint8_t *p = data;
+	uint32_t a, b;
+
+	pthread_once(&crc_once, crc_tables);
+	crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (length >= 8) {
+		memcpy(&a, p, 4);
+		memcpy(&b, p + 4, 4);
+		a ^= crc;
+		crc = crc32_table[7][a & 0xFF] ^ crc32_table[6][(a >> 8) & 0xFF] ^
+				crc32_table[5][(a >> 16) & 0xFF] ^ crc32_table[4][a >> 24] ^
+				crc32_table[3][b & 0xFF] ^ crc32_table[2][(b >> 8) & 0xFF] ^
+				crc32_table[1][(b >> 16) & 0xFF] ^ crc32_table[0][b >> 24];
+		p += 8;
+		length -= 8;
+	}
+#endif
+	while (length-- > 0) {
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xFF];
+	}
+	return ~crc;
+}
+
+/*
+ *  ======== uart_frame_bound ========
+ */
+size_t uart_frame_bound(UART_FRAMING framing, size_t length) {
+	switch (framing) {
+	case UART_FRAMING_COBS:
+		return length + length / (COBS_BLOCK - 1) + 2;
+	case UART_FRAMING_SLIP:
+		return 2 * length + 2;
+	case UART_FRAMING_LP_CRC16:
+		return length + 4;
+	default:
+		return length + 6;
+	}
+}
+
+/*
+ *  ======== cobs_encode ========
+ *  Copies the runs between zeros with memcpy and back-patches the code
+ *  byte of each block once its length is known.
+ */
+static size_t cobs_encode(const struct iovec *iov, int count, uint8_t *dst, size_t size) {
+	const uint8_t *p, *zero;
+	size_t code_at = 0, o = 1, n, run;
+	uint8_t code = 1;
+	int i;
+
+	if (size < 2) {
+		return 0;
+	}
+	for (i = 0; i < count; i++) {
+		p = iov[i].iov_base;
+		n = iov[i].iov_len;
+		while (n > 0) {
+			if (*p == 0) {
+				if (o >= size) {
+					return 0;
+				}
+				dst[code_at] = code;
+				code_at = o++;
+				code = 1;
+				p++;
+				n--;
+				continue;
+			}
+			run = n < (size_t)(COBS_BLOCK - code) ? n : (size_t)(COBS_BLOCK - code);
+			zero = memchr(p, 0, run);
+			if (zero != NULL) {
+				run = zero - p;
+			}
+			if (o + run > size) {
+				return 0;
+			}
+			memcpy(dst + o, p, run);
+			o += run;
+			code += run;
+			p += run;
+			n -= run;
+			if (code == COBS_BLOCK) {
+				if (o >= size) {
+					return 0;
+				}
+				dst[code_at] = code;
+				code_at = o++;
+				code = 1;
+			}
+		}
+	}
+	if (o >= size) {
+		return 0;
+	}
+	dst[code_at] = code;
+	dst[o++] = 0;
+	return o;
+}
+
+/*
+ *  ======== slip_encode ========
+ */
+static size_t slip_encode(const struct iovec *iov, int count, uint8_t *dst, size_t size) {
+	const uint8_t *p;
+	size_t o = 0, n, run;
+	int i;
+
+	if (size < 2) {
+		return 0;
+	}
+	/* A leading END flushes any line noise received before the frame */
+	dst[o++] = SLIP_END;
+	for (i = 0; i < count; i++) {
+		p = iov[i].iov_base;
+		n = iov[i].iov_len;
+		while (n > 0) {
+			for (run = 0; run < n && p[run] != SLIP_END && p[run] != SLIP_ESC; run++);
+			if (o + run + 2 > size) {
+				return 0;
+			}
+			memcpy(dst + o, p, run);
+			o += run;
+			p += run;
+			n -= run;
+			if (n > 0) {
+				dst[o++] = SLIP_ESC;
+				dst[o++] = *p == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC;
+				p++;
+				n--;
+			}
+		}
+	}
+	if (o >= size) {
+		return 0;
+	}
+	dst[o++] = SLIP_END;
+	return o;
+}
+
+/*
+ *  ======== lp_trailer ========
+ *  Stores the CRC of the header and payload, returns its size.
+ */
+static size_t lp_trailer(UART_FRAMING framing, const uint8_t *header,
+		const struct iovec *iov, int count, uint8_t *trailer) {
+	uint32_t crc32;
+	uint16_t crc16;
+	int i;
+
+	if (framing == UART_FRAMING_LP_CRC16) {
+		crc16 = uart_crc16(UART_CRC16_INIT, header, 2);
+		for (i = 0; i < count; i++) {
+			crc16 = uart_crc16(crc16, iov[i].iov_base, iov[i].iov_len);
+		}
+		trailer[0] = crc16 & 0xFF;
+		trailer[1] = crc16 >> 8;
+		return 2;
+	}
+	crc32 = uart_crc32(0, header, 2);
+	for (i = 0; i < count; i++) {
+		crc32 = uart_crc32(crc32, iov[i].iov_base, iov[i].iov_len);
+	}
+	trailer[0] = crc32 & 0xFF;
+	trailer[1] = (crc32 >> 8) & 0xFF;
+	trailer[2] = (crc32 >> 16) & 0xFF;
+	trailer[3] = crc32 >> 24;
+	return 4;
+}
+
+/*
+ *  ======== lp_encode ========
+ */
+static size_t lp_encode(UART_FRAMING framing, const struct iovec *iov, int count,
+		uint8_t *dst, size_t size) {
+	size_t length = 0, o = 2;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		length += iov[i].iov_len;
+	}
+	if (length > UART_FRAME_LP_MAX || uart_frame_bound(framing, length) > size) {
+		return 0;
+	}
+	dst[0] = length & 0xFF;
+	dst[1] = length >> 8;
+	for (i = 0; i < count; i++) {
+		memcpy(dst + o, iov[i].iov_base, iov[i].iov_len);
+		o += iov[i].iov_len;
+	}
+	return o + lp_trailer(framing, dst, iov, count, dst + o);
+}
+
+/*
+ *  ======== uart_frame_encode ========
+ */
+size_t uart_frame_encode(UART_FRAMING framing, const struct iovec *iov, int count,
+		uint8_t *dst, size_t size) {
+	switch (framing) {
+	case UART_FRAMING_COBS:
+		return cobs_encode(iov, count, dst, size);
+	case UART_FRAMING_SLIP:
+		return slip_encode(iov, count, dst, size);
+	default:
+		return lp_encode(framing, iov, count, dst, size);
+	}
+}
+
+/*
+ *  ======== uart_frame_lp_iov ========
+ */
+uint8_t uart_frame_lp_iov(UART_FRAMING framing, const void *payload, size_t length,
+		uint8_t header[2], uint8_t trailer[4], struct iovec iov[3]) {
+	if ((framing != UART_FRAMING_LP_CRC16 && framing != UART_FRAMING_LP_CRC32) ||
+			length > UART_FRAME_LP_MAX) {
+		return -1;
+	}
+	header[0] = length & 0xFF;
+	header[1] = length >> 8;
+	iov[0].iov_base = header;
+	iov[0].iov_len = 2;
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = length;
+	iov[2].iov_base = trailer;
+	iov[2].iov_len = lp_trailer(framing, header, &iov[1], 1, trailer);
+	return 0;
+}
+
+/*
+ *  ======== uart_frame_decoder_init ========
+ */
+void uart_frame_decoder_init(uart_frame_decoder *decoder, UART_FRAMING framing,
+		uint8_t *buf, size_t size) {
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->framing = framing;
+	decoder->buf = buf;
+	decoder->size = size;
+}
+
+/*
+ *  ======== uart_frame_space ========
+ */
+uint8_t *uart_frame_space(uart_frame_decoder *decoder, size_t *room) {
+	uart_frame_decoder *d = decoder;
+	size_t raw = d->end - d->in;
+
+	/* Close the gaps left by returned frames and by decoding */
+	if (d->start > 0 || d->out < d->in) {
+		memmove(d->buf, d->buf + d->start, d->out - d->start);
+		d->out -= d->start;
+		d->start = 0;
+		memmove(d->buf + d->out, d->buf + d->in, raw);
+		d->in = d->out;
+		d->end = d->in + raw;
+	}
+	if (d->end == d->size) {
+		/* The frame can not fit, drop it and resynchronize */
+		d->overflows++;
+		d->start = d->out = d->in = d->end = 0;
+		d->code = 0;
+		d->last = 0;
+		d->skip = 1;
+	}
+	*room = d->size - d->end;
+	return d->buf + d->end;
+}
+
+/*
+ *  ======== uart_frame_feed ========
+ */
+void uart_frame_feed(uart_frame_decoder *decoder, size_t count) {
+	decoder->end += count;
+}
+
+/*
+ *  ======== uart_frame_push ========
+ */
+size_t uart_frame_push(uart_frame_decoder *decoder, const void *data, size_t length) {
+	size_t room;
+	uint8_t *space = uart_frame_space(decoder, &room);
+
+	if (length > room) {
+		length = room;
+	}
+	memcpy(space, data, length);
+	uart_frame_feed(decoder, length);
+	return length;
+}
+
+/*
+ *  ======== frame_return ========
+ */
+static int frame_return(uart_frame_decoder *d, uart_frame_view *frame) {
+	frame->data = d->buf + d->start;
+	frame->length = d->out - d->start;
+	d->start = d->out = d->in;
+	d->code = 0;
+	d->last = 0;
+	d->frames++;
+	return 1;
+}
+
+/*
+ *  ======== frame_drop ========
+ */
+static void frame_drop(uart_frame_decoder *d) {
+	d->start = d->out = d->in;
+	d->code = 0;
+	d->last = 0;
+}
+
+/*
+ *  ======== cobs_next ========
+ *  Decoding never grows the data, so it is written back over the input.
+ */
+static int cobs_next(uart_frame_decoder *d, uart_frame_view *frame) {
+	uint8_t *zero, b;
+	size_t run;
+
+	while (d->in < d->end) {
+		b = d->buf[d->in];
+		if (d->skip) {
+			zero = memchr(d->buf + d->in, 0, d->end - d->in);
+			if (zero == NULL) {
+				d->in = d->end;
+				break;
+			}
+			d->in = zero - d->buf + 1;
+			d->skip = 0;
+			frame_drop(d);
+			continue;
+		}
+		if (b == 0) {
+			d->in++;
+			if (d->code != 0) {
+				/* Delimiter inside a block, the frame is truncated */
+				d->errors++;
+				frame_drop(d);
+			} else if (d->last == 0) {
+				/* Back to back delimiters */
+				frame_drop(d);
+			} else {
+				return frame_return(d, frame);
+			}
+			continue;
+		}
+		if (d->code == 0) {
+			/* Code byte, the previous block ended with an implicit zero */
+			if (d->last != 0 && d->last != COBS_BLOCK) {
+				d->buf[d->out++] = 0;
+			}
+			d->code = b - 1;
+			d->last = b;
+			d->in++;
+			continue;
+		}
+		run = d->end - d->in < d->code ? d->end - d->in : d->code;
+		zero = memchr(d->buf + d->in, 0, run);
+		if (zero != NULL) {
+			run = zero - (d->buf + d->in);
+		}
+		memmove(d->buf + d->out, d->buf + d->in, run);
+		d->out += run;
+		d->in += run;
+		d->code -= run;
+	}
+	return 0;
+}
+
+/*
+ *  ======== slip_next ========
+ */
+static int slip_next(uart_frame_decoder *d, uart_frame_view *frame) {
+	uint8_t b;
+	size_t run;
+
+	while (d->in < d->end) {
+		b = d->buf[d->in++];
+		if (d->skip) {
+			if (b == SLIP_END) {
+				d->skip = 0;
+				frame_drop(d);
+			}
+			continue;
+		}
+		if (d->last) {
+			d->last = 0;
+			if (b == SLIP_ESC_END) {
+				d->buf[d->out++] = SLIP_END;
+			} else if (b == SLIP_ESC_ESC) {
+				d->buf[d->out++] = SLIP_ESC;
+			} else {
+				d->errors++;
+				d->skip = b != SLIP_END;
+				frame_drop(d);
+			}
+			continue;
+		}
+		if (b == SLIP_END) {
+			if (d->out == d->start) {
+				/* Empty frame, or the leading END of the next one */
+				frame_drop(d);
+				continue;
+			}
+			return frame_return(d, frame);
+		}
+		if (b == SLIP_ESC) {
+			d->last = 1;
+			continue;
+		}
+		d->in--;
+		for (run = 0; d->in + run < d->end && d->buf[d->in + run] != SLIP_END &&
+				d->buf[d->in + run] != SLIP_ESC; run++);
+		memmove(d->buf + d->out, d->buf + d->in, run);
+		d->out += run;
+		d->in += run;
+	}
+	return 0;
+}
+
+/*
+ *  ======== lp_next ========
+ *  The payload is returned where it was received. After a bad length or
+ *  CRC the decoder slides by one byte to find the next frame, counting a
+ *  single error until it finds one.
+ */
+static int lp_next(uart_frame_decoder *d, uart_frame_view *frame) {
+	size_t length, total, crc_size;
+	const uint8_t *p;
+	int valid;
+
+	crc_size = d->framing == UART_FRAMING_LP_CRC16 ? 2 : 4;
+	while (d->end - d->in >= 2) {
+		p = d->buf + d->in;
+		length = p[0] | (p[1] << 8);
+		total = 2 + length + crc_size;
+		if (total > d->size) {
+			d->errors += !d->skip;
+			d->skip = 1;
+			d->in++;
+			frame_drop(d);
+			continue;
+		}
+		if (d->end - d->in < total) {
+			return 0;
+		}
+		if (crc_size == 2) {
+			uint16_t crc = uart_crc16(UART_CRC16_INIT, p, 2 + length);
+
+			valid = p[2 + length] == (crc & 0xFF) && p[3 + length] == (crc >> 8);
+		} else {
+			uint32_t crc = uart_crc32(0, p, 2 + length);
+
+			valid = p[2 + length] == (crc & 0xFF) && p[3 + length] == ((crc >> 8) & 0xFF) &&
+					p[4 + length] == ((crc >> 16) & 0xFF) && p[5 + length] == (crc >> 24);
+		}
+		if (!valid) {
+			d->errors += !d->skip;
+			d->skip = 1;
+			d->in++;
+			frame_drop(d);
+			continue;
+		}
+		frame->data = d->buf + d->in + 2;
+		frame->length = length;
+		d->in += total;
+		d->start = d->out = d->in;
+		d->skip = 0;
+		d->frames++;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== uart_frame_next ========
+ */
+int uart_frame_next(uart_frame_decoder *decoder, uart_frame_view *frame) {
+	switch (decoder->framing) {
+	case UART_FRAMING_COBS:
+		return cobs_next(decoder, frame);
+	case UART_FRAMING_SLIP:
+		return slip_next(decoder, frame);
+	default:
+		return lp_next(decoder, frame);
+	}
+}
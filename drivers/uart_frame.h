@@ -0,0 +1,241 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       uart_frame.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/13/2018
+ *  @brief      Framing codecs and CRCs for UART streams
+ *
+ *  The framing header file should be included in an application as
+ *  follows:
+ *  @code
+ *  #include "drivers/uart_frame.h"
+ *  @endcode
+ *
+ *  # Overview #
+ *  Three framings are supported:
+ *
+ *  - UART_FRAMING_COBS: Consistent Overhead Byte Stuffing, every frame
+ *    ends with a 0x00 byte that never appears inside it.
+ *  - UART_FRAMING_SLIP: RFC 1055, frames are wrapped in 0xC0 bytes and
+ *    0xC0 and 0xDB are escaped.
+ *  - UART_FRAMING_LP_CRC16 and UART_FRAMING_LP_CRC32: a 16 bit little
+ *    endian payload length, the payload, and a little endian CRC of both.
+ *
+ *  Encoders gather the payload from an iovec array and write the frame
+ *  straight into the caller's transmit buffer. Length-prefixed frames can
+ *  also be sent without copying the payload at all: uart_frame_lp_iov()
+ *  fills a header and a trailer and returns the iovec for uart_writev().
+ *
+ *  The decoder works in place on the caller's receive buffer. Data is read
+ *  into the space it offers, then frames are decoded inside the same
+ *  buffer and returned as views. Chunks may split frames anywhere. Frames
+ *  that are corrupt or too long for the buffer are dropped and counted.
+ *  SLIP can not carry empty frames, they are skipped like line noise.
+ *
+ *  The CRCs are CRC-16/MODBUS and the CRC-32 of zlib and Ethernet, both
+ *  computed eight bytes at a time with slicing-by-8 tables.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  uint8_t rxbuf[4096];
+ *  uart_frame_decoder decoder;
+ *  uart_frame_view frame;
+ *  size_t room;
+ *
+ *  uart_frame_decoder_init(&decoder, UART_FRAMING_COBS, rxbuf, sizeof(rxbuf));
+ *  while (running) {
+ *      uint8_t *space = uart_frame_space(&decoder, &room);
+ *      int count = uart_read(uart, space, room);
+ *
+ *      uart_frame_feed(&decoder, count > 0 ? count : 0);
+ *      while (uart_frame_next(&decoder, &frame)) {
+ *          handle(frame.data, frame.length);
+ *      }
+ *  }
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __UART_FRAME_H_
+#define __UART_FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/*!
+ *  @brief      Initial value of a CRC-16/MODBUS
+ */
+#define UART_CRC16_INIT 0xFFFF
+
+/*!
+ *  @brief      Largest payload of a length-prefixed frame
+ */
+#define UART_FRAME_LP_MAX 0xFFFF
+
+/*!
+ *  @brief      Available framings
+ */
+typedef enum {
+	UART_FRAMING_COBS = 0,
+	UART_FRAMING_SLIP = 1,
+	UART_FRAMING_LP_CRC16 = 2,
+	UART_FRAMING_LP_CRC32 = 3
+} UART_FRAMING;
+
+/*!
+ *  @brief      A decoded frame inside the decoder buffer
+ */
+typedef struct {
+	uint8_t *data;
+	size_t length;
+} uart_frame_view;
+
+/*!
+ *  @brief      Decoder structure type definition
+ *
+ *  The buffer holds, in order: frames already returned, the decoded part
+ *  of the current frame (start to out), raw input not decoded yet (in to
+ *  end), and free space.
+ */
+typedef struct {
+	UART_FRAMING framing;
+	uint8_t *buf;
+	size_t size;
+	size_t start;			/*!< @brief first byte of the current frame */
+	size_t out;				/*!< @brief end of its decoded bytes */
+	size_t in;				/*!< @brief next raw byte to decode */
+	size_t end;				/*!< @brief end of the raw bytes */
+	uint8_t code;			/*!< @brief COBS bytes left in the block */
+	uint8_t last;			/*!< @brief COBS code of the block, SLIP escape */
+	uint8_t skip;			/*!< @brief resynchronizing after an error */
+	uint64_t frames;		/*!< @brief frames returned */
+	uint64_t errors;		/*!< @brief corrupt frames dropped */
+	uint64_t overflows;		/*!< @brief frames dropped for not fitting */
+} uart_frame_decoder;
+
+/*!
+ *  @brief  Updates a CRC-16/MODBUS
+ *
+ *  @param  crc     UART_CRC16_INIT, or the result of the previous call
+ *  @param  data    Bytes to add
+ *  @param  length  Number of bytes
+ *
+ *  @return Returns the updated CRC
+ */
+extern uint16_t uart_crc16(uint16_t crc, const void *data, size_t length);
+
+/*!
+ *  @brief  Updates a CRC-32
+ *
+ *  @param  crc     0, or the result of the previous call
+ *  @param  data    Bytes to add
+ *  @param  length  Number of bytes
+ *
+ *  @return Returns the updated CRC
+ */
+extern uint32_t uart_crc32(uint32_t crc, const void *data, size_t length);
+
+/*!
+ *  @brief  Returns the largest encoded size of a \a length byte payload
+ */
+extern size_t uart_frame_bound(UART_FRAMING framing, size_t length);
+
+/*!
+ *  @brief  Encodes one frame into a buffer
+ *
+ *  @param  framing One of UART_FRAMING
+ *  @param  iov     The segments making up the payload
+ *  @param  count   The number of segments in \a iov
+ *  @param  dst     Transmit buffer
+ *  @param  size    Size of \a dst, uart_frame_bound() is always enough
+ *
+ *  @return Returns the frame length, 0 if it did not fit
+ */
+extern size_t uart_frame_encode(UART_FRAMING framing, const struct iovec *iov, int count,
+		uint8_t *dst, size_t size);
+
+/*!
+ *  @brief  Prepares a length-prefixed frame without copying the payload
+ *
+ *  @param  framing UART_FRAMING_LP_CRC16 or UART_FRAMING_LP_CRC32
+ *  @param  payload The payload
+ *  @param  length  Payload length, at most UART_FRAME_LP_MAX
+ *  @param  header  Receives the 2 header bytes
+ *  @param  trailer Receives the 2 or 4 CRC bytes
+ *  @param  iov     Receives the 3 segments to pass to uart_writev()
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uart_frame_lp_iov(UART_FRAMING framing, const void *payload, size_t length,
+		uint8_t header[2], uint8_t trailer[4], struct iovec iov[3]);
+
+/*!
+ *  @brief  Initializes a decoder
+ *
+ *  @param  decoder A uart_frame_decoder structure
+ *  @param  framing One of UART_FRAMING
+ *  @param  buf     Receive buffer, larger than the longest encoded frame
+ *  @param  size    Size of \a buf
+ */
+extern void uart_frame_decoder_init(uart_frame_decoder *decoder, UART_FRAMING framing,
+		uint8_t *buf, size_t size);
+
+/*!
+ *  @brief  Returns where the next received bytes must be stored
+ *
+ *  Views returned by uart_frame_next() become invalid, since the pending
+ *  bytes are moved to the front of the buffer to make room.
+ *
+ *  @param  decoder A uart_frame_decoder structure
+ *  @param  room    Receives the free space
+ *
+ *  @return Returns the free space
+ */
+extern uint8_t *uart_frame_space(uart_frame_decoder *decoder, size_t *room);
+
+/*!
+ *  @brief  Accounts for \a count bytes stored at uart_frame_space()
+ */
+extern void uart_frame_feed(uart_frame_decoder *decoder, size_t count);
+
+/*!
+ *  @brief  Copies bytes into the decoder, for data that is already in memory
+ *
+ *  @return Returns the number of bytes taken, less than \a length when the
+ *          frames decoded so far have not been consumed
+ */
+extern size_t uart_frame_push(uart_frame_decoder *decoder, const void *data, size_t length);
+
+/*!
+ *  @brief  Decodes the next complete frame
+ *
+ *  @param  decoder A uart_frame_decoder structure
+ *  @param  frame   Receives a view of the frame, valid until the next
+ *                  uart_frame_space() or uart_frame_push()
+ *
+ *  @return Returns 1 when a frame was decoded, 0 when more data is needed
+ */
+extern int uart_frame_next(uart_frame_decoder *decoder, uart_frame_view *frame);
+
+#endif /* __UART_FRAME_H_ */
@@ -0,0 +1,562 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       uring.c 
+ *	@brief      Batched I/O through io_uring
+ *	@author     Maximiliano Valencia
+ *	@date       4/16/2018
+ */
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+/* io_uring Header File */
+#include "driver.h"
+#include "uring.h"
+
+/*
+ *  ======== uring_setup ========
+ *  The system calls have no glibc wrappers.
+ */
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned count) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/*
+ *  ======== uring_supported ========
+ *  Checks that the kernel has every opcode used by the driver.
+ */
+static int uring_supported(int fd) {
+	static const uint8_t needed[] = {
+		IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED
+	};
+	struct io_uring_probe *probe;
+	size_t i;
+	int ok = 1;
+
+	probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+	if (probe == NULL) {
+		return 0;
+	}
+	/* Kernels older than 5.6 have no probe, nor IORING_OP_READ */
+	if (uring_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		ok = 0;
+	}
+	for (i = 0; ok && i < sizeof(needed); i++) {
+		if (needed[i] > probe->last_op ||
+				!(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+			ok = 0;
+		}
+	}
+	free(probe);
+	return ok;
+}
+
+/*
+ *  ======== uring_map ========
+ */
+static int uring_map(uring *u, struct io_uring_params *params) {
+	u->sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+	u->cq_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+	if (params->features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_size > u->sq_size) {
+			u->sq_size = u->cq_size;
+		}
+		u->cq_size = u->sq_size;
+	}
+	u->sq_ring = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED) {
+		u->sq_ring = NULL;
+		return -1;
+	}
+	if (params->features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ring = u->sq_ring;
+	} else {
+		u->cq_ring = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED) {
+			u->cq_ring = NULL;
+			return -1;
+		}
+	}
+	u->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		return -1;
+	}
+
+	u->sq_head = (unsigned *)((uint8_t *)u->sq_ring + params->sq_off.head);
+	u->sq_tail = (unsigned *)((uint8_t *)u->sq_ring + params->sq_off.tail);
+	u->sq_mask = (unsigned *)((uint8_t *)u->sq_ring + params->sq_off.ring_mask);
+	u->sq_array = (unsigned *)((uint8_t *)u->sq_ring + params->sq_off.array);
+	u->cq_head = (unsigned *)((uint8_t *)u->cq_ring + params->cq_off.head);
+	u->cq_tail = (unsigned *)((uint8_t *)u->cq_ring + params->cq_off.tail);
+	u->cq_mask = (unsigned *)((uint8_t *)u->cq_ring + params->cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((uint8_t *)u->cq_ring + params->cq_off.cqes);
+	return 0;
+}
+
+/*
+ *  ======== uring_open ========
+ */
+uint8_t uring_open(uring *u, unsigned entries) {
+	struct io_uring_params params;
+	unsigned i;
+
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+	u->eventfd = -1;
+	for (i = 0; i < URING_FILES; i++) {
+		u->files[i] = -1;
+	}
+
+	memset(&params, 0, sizeof(params));
+	u->fd = uring_setup(entries != 0 ? entries : URING_ENTRIES, &params);
+	if (u->fd >= 0 && !uring_supported(u->fd)) {
+		close(u->fd);
+		u->fd = -1;
+		errno = ENOSYS;
+	}
+	if (u->fd < 0) {
+		log_notice("uring_open(): io_uring not available, using system calls: %m");
+		u->entries = entries != 0 ? entries : URING_ENTRIES;
+		u->capacity = u->entries * 2;
+	} else {
+		u->entries = params.sq_entries;
+		u->capacity = params.cq_entries;
+		if (uring_map(u, &params) < 0) {
+			log_err("uring_open(): mmap: %m");
+			uring_close(u);
+			return -1;
+		}
+		/* A sparse table, so descriptors can be added one by one */
+		u->fixed_files = uring_register(u->fd, IORING_REGISTER_FILES,
+				u->files, URING_FILES) == 0;
+	}
+
+	u->ops = calloc(u->capacity, sizeof(struct uring_op));
+	u->pending = calloc(u->capacity, sizeof(int));
+	u->done = calloc(u->capacity, sizeof(int));
+	if (u->ops == NULL || u->pending == NULL || u->done == NULL) {
+		log_err("uring_open(): out of memory");
+		uring_close(u);
+		return -1;
+	}
+	for (i = 0; i < u->capacity; i++) {
+		u->ops[i].next = (i + 1 < u->capacity) ? (int)i + 1 : -1;
+	}
+	u->free = 0;
+
+	u->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (u->eventfd < 0 ||
+			(u->fd >= 0 && uring_register(u->fd, IORING_REGISTER_EVENTFD, &u->eventfd, 1) < 0)) {
+		log_err("uring_open(): eventfd: %m");
+		uring_close(u);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== uring_available ========
+ */
+int uring_available(uring *u) {
+	return u->fd >= 0;
+}
+
+/*
+ *  ======== uring_update_file ========
+ */
+static uint8_t uring_update_file(uring *u, int slot, int fd) {
+	struct io_uring_files_update update;
+
+	if (u->fixed_files) {
+		memset(&update, 0, sizeof(update));
+		update.offset = slot;
+		update.fds = (uintptr_t)&fd;
+		if (uring_register(u->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0) {
+			log_err("uring_update_file(): %m");
+			return -1;
+		}
+	}
+	u->files[slot] = fd;
+	return 0;
+}
+
+/*
+ *  ======== uring_register_file ========
+ */
+uint8_t uring_register_file(uring *u, int fd) {
+	int i;
+
+	for (i = 0; i < URING_FILES; i++) {
+		if (u->files[i] == fd) {
+			return 0;
+		}
+	}
+	for (i = 0; i < URING_FILES; i++) {
+		if (u->files[i] < 0) {
+			return uring_update_file(u, i, fd);
+		}
+	}
+	errno = ENOSPC;
+	return -1;
+}
+
+/*
+ *  ======== uring_unregister_file ========
+ */
+uint8_t uring_unregister_file(uring *u, int fd) {
+	int i;
+
+	for (i = 0; i < URING_FILES; i++) {
+		if (u->files[i] == fd) {
+			return uring_update_file(u, i, -1);
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+ *  ======== uring_register_buffers ========
+ */
+uint8_t uring_register_buffers(uring *u, const struct iovec *iov, int count) {
+	if (u->buffers != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (u->fd >= 0 && uring_register(u->fd, IORING_REGISTER_BUFFERS, iov, count) < 0) {
+		log_err("uring_register_buffers(): %m");
+		return -1;
+	}
+	u->buffers = iov;
+	u->nbuffers = count;
+	return 0;
+}
+
+/*
+ *  ======== uring_alloc ========
+ */
+static struct uring_op *uring_alloc(uring *u) {
+	struct uring_op *op;
+
+	if (u->free < 0) {
+		errno = EAGAIN;
+		return NULL;
+	}
+	op = &u->ops[u->free];
+	u->free = op->next;
+	return op;
+}
+
+/*
+ *  ======== uring_queue ========
+ */
+static uint8_t uring_queue(uring *u, uint8_t opcode, int fd, void *buf, size_t length,
+		off_t offset, stats_op *stats, uring_fxn fxn, void *arg) {
+	struct uring_op *op;
+
+	if (u->npending == u->entries && uring_submit(u, 0) < 0) {
+		return -1;
+	}
+	op = uring_alloc(u);
+	if (op == NULL) {
+		return -1;
+	}
+	op->opcode = opcode;
+	op->fd = fd;
+	op->buf = buf;
+	op->length = length;
+	op->offset = offset;
+	op->stats = stats;
+	op->start = stats != NULL ? stats_now() : 0;
+	op->fxn = fxn;
+	op->arg = arg;
+	op->result = 0;
+	u->pending[u->npending++] = op - u->ops;
+	return 0;
+}
+
+/*
+ *  ======== uring_read ========
+ */
+uint8_t uring_read(uring *u, int fd, void *buf, size_t length, off_t offset,
+		stats_op *stats, uring_fxn fxn, void *arg) {
+	return uring_queue(u, IORING_OP_READ, fd, buf, length, offset, stats, fxn, arg);
+}
+
+/*
+ *  ======== uring_write ========
+ */
+uint8_t uring_write(uring *u, int fd, const void *buf, size_t length, off_t offset,
+		stats_op *stats, uring_fxn fxn, void *arg) {
+	return uring_queue(u, IORING_OP_WRITE, fd, (void *)buf, length, offset, stats, fxn, arg);
+}
+
+/*
+ *  ======== uring_complete ========
+ */
+uint8_t uring_complete(uring *u, ssize_t result, uring_fxn fxn, void *arg) {
+	struct uring_op *op = uring_alloc(u);
+	uint64_t one = 1;
+
+	if (op == NULL) {
+		return -1;
+	}
+	op->stats = NULL;
+	op->fxn = fxn;
+	op->arg = arg;
+	op->result = result;
+	u->done[u->ndone++] = op - u->ops;
+	if (write(u->eventfd, &one, sizeof(one)) < 0) {
+		/* The counter is already non zero */
+	}
+	return 0;
+}
+
+/*
+ *  ======== uring_prepare ========
+ *  Fills the submission entry of an operation.
+ */
+static void uring_prepare(uring *u, struct io_uring_sqe *sqe, int index) {
+	struct uring_op *op = &u->ops[index];
+	int i;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op->opcode;
+	sqe->fd = op->fd;
+	sqe->addr = (uintptr_t)op->buf;
+	sqe->len = op->length;
+	sqe->off = (uint64_t)op->offset;
+	sqe->user_data = index;
+	for (i = 0; u->fixed_files && i < URING_FILES; i++) {
+		if (u->files[i] == op->fd) {
+			sqe->fd = i;
+			sqe->flags |= IOSQE_FIXED_FILE;
+			break;
+		}
+	}
+	for (i = 0; i < u->nbuffers; i++) {
+		uint8_t *base = u->buffers[i].iov_base;
+
+		if ((uint8_t *)op->buf >= base &&
+				(uint8_t *)op->buf + op->length <= base + u->buffers[i].iov_len) {
+			sqe->opcode = (op->opcode == IORING_OP_READ) ?
+					IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+			sqe->buf_index = i;
+			break;
+		}
+	}
+}
+
+/*
+ *  ======== uring_fallback ========
+ *  Runs the queued operations with plain system calls.
+ */
+static int uring_fallback(uring *u) {
+	uint64_t one = 1;
+	unsigned i;
+
+	for (i = 0; i < u->npending; i++) {
+		struct uring_op *op = &u->ops[u->pending[i]];
+		ssize_t n;
+
+		if (op->opcode == IORING_OP_READ) {
+			n = op->offset < 0 ? read(op->fd, op->buf, op->length) :
+					pread(op->fd, op->buf, op->length, op->offset);
+		} else {
+			n = op->offset < 0 ? write(op->fd, op->buf, op->length) :
+					pwrite(op->fd, op->buf, op->length, op->offset);
+		}
+		op->result = n < 0 ? -errno : n;
+		u->done[u->ndone++] = u->pending[i];
+	}
+	if (u->npending > 0 && write(u->eventfd, &one, sizeof(one)) < 0) {
+		/* The counter is already non zero */
+	}
+	i = u->npending;
+	u->npending = 0;
+	return i;
+}
+
+/*
+ *  ======== uring_submit ========
+ */
+int uring_submit(uring *u, unsigned wait) {
+	unsigned tail, index, count, room, i;
+	int status;
+
+	if (u->fd < 0) {
+		return uring_fallback(u);
+	}
+
+	/* Only this thread writes the tail, the kernel moves the head. Entries
+	 * the kernel has not consumed yet are never overwritten, operations
+	 * that do not fit stay pending for the next call */
+	tail = *u->sq_tail;
+	room = u->entries - (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE));
+	count = u->npending < room ? u->npending : room;
+	for (i = 0; i < count; i++) {
+		index = tail & *u->sq_mask;
+		uring_prepare(u, &u->sqes[index], u->pending[i]);
+		u->sq_array[index] = index;
+		tail++;
+	}
+	__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+	/* In the ring now, the kernel completes them even if it takes them later */
+	u->inflight += count;
+	u->npending -= count;
+	memmove(u->pending, u->pending + count, u->npending * sizeof(int));
+
+	/* Entries left over by an interrupted or failed call are submitted again */
+	count = tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (count == 0 && wait == 0) {
+		return 0;
+	}
+	do {
+		status = uring_enter(u->fd, count, wait, wait != 0 ? IORING_ENTER_GETEVENTS : 0);
+	} while (status < 0 && errno == EINTR && count != 0);
+	if (status < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		log_err("uring_submit(): io_uring_enter: %m");
+		return -1;
+	}
+	if (status > 0) {
+		u->submits++;
+		u->submitted += status;
+	}
+	return status;
+}
+
+/*
+ *  ======== uring_finish ========
+ *  Frees the operation and runs its callback, which may queue new ones.
+ */
+static void uring_finish(uring *u, int index) {
+	struct uring_op *op = &u->ops[index];
+	uring_fxn fxn = op->fxn;
+	void *arg = op->arg;
+	ssize_t result = op->result;
+
+	if (op->stats != NULL) {
+		if (result < 0) {
+			errno = -result;
+		}
+		stats_record(op->stats, op->start, result < 0 ? -1 : result, op->length);
+	}
+	op->next = u->free;
+	u->free = index;
+	u->completed++;
+	if (fxn != NULL) {
+		fxn(u, result, arg);
+	}
+}
+
+/*
+ *  ======== uring_reap ========
+ */
+int uring_reap(uring *u) {
+	uint64_t wakeups;
+	unsigned head, count = 0, i, ndone;
+	int index;
+
+	if (read(u->eventfd, &wakeups, sizeof(wakeups)) < 0) {
+		/* Nothing new since the last call */
+	}
+
+	/* Operations done without the ring. Callbacks may append more, they
+	 * are kept for the next call */
+	ndone = u->ndone;
+	for (i = 0; i < ndone; i++) {
+		uring_finish(u, u->done[i]);
+		count++;
+	}
+	memmove(u->done, u->done + ndone, (u->ndone - ndone) * sizeof(int));
+	u->ndone -= ndone;
+
+	if (u->fd < 0) {
+		return count;
+	}
+	head = *u->cq_head;
+	while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+
+		index = (int)cqe->user_data;
+		u->ops[index].result = cqe->res;
+		head++;
+		/* Released before the callback, which may reap or submit again */
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+		u->inflight--;
+		uring_finish(u, index);
+		count++;
+	}
+	return count;
+}
+
+/*
+ *  ======== uring_eventfd ========
+ */
+int uring_eventfd(uring *u) {
+	return u->eventfd;
+}
+
+/*
+ *  ======== uring_close ========
+ */
+uint8_t uring_close(uring *u) {
+	if (u->sqes != NULL) {
+		munmap(u->sqes, u->sqes_size);
+	}
+	if (u->cq_ring != NULL && u->cq_ring != u->sq_ring) {
+		munmap(u->cq_ring, u->cq_size);
+	}
+	if (u->sq_ring != NULL) {
+		munmap(u->sq_ring, u->sq_size);
+	}
+	if (u->fd >= 0) {
+		close(u->fd);
+	}
+	if (u->eventfd >= 0) {
+		close(u->eventfd);
+	}
+	free(u->ops);
+	free(u->pending);
+	free(u->done);
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+	u->eventfd = -1;
+	return 0;
+}
@@ -0,0 +1,298 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+ 
+/*!
+ *  @file       uring.h
+ *	@author 	Maximiliano Valencia
+ *	@date		4/16/2018
+ *  @brief      Batched I/O through io_uring
+ *
+ *  The io_uring header file should be included in an application as
+ *  follows:
+ *  @code
+ *  #include "drivers/uring.h"
+ *  @endcode
+ *
+ *  # Overview #
+ *  Small reads and writes on ttys and sysfs files cost far more in system
+ *  call entry and exit than in the transfer itself. A uring queues them and
+ *  hands the whole batch to the kernel with one io_uring_enter() call, then
+ *  delivers the results from the completion queue to per operation
+ *  callbacks.
+ *
+ *  Descriptors registered with uring_register_file() and buffers
+ *  registered with uring_register_buffers() are used automatically, which
+ *  saves the kernel a file lookup and a page pinning per operation.
+ *
+ *  The kernel interface is used directly through its system calls, no
+ *  library is needed. When io_uring is not available (old kernel, seccomp,
+ *  kernel.io_uring_disabled) uring_open() still succeeds and every queued
+ *  operation is done with the plain system call at uring_submit() time, so
+ *  callers see the same behavior, only without the batching.
+ *
+ *  Operations behave like the plain calls on the same descriptor: a UART
+ *  opened by uart_open() is non blocking, so a read with no data completes
+ *  with -EAGAIN and a write may complete short; uart_uring_write() keeps
+ *  one write per port in flight and sends the rest of a short one before
+ *  the next, so the stream is not reordered. Non blocking descriptors
+ *  such as ttys are serviced in queue order during uring_submit(). Others,
+ *  like the sysfs value files, may be handed to kernel workers and finish
+ *  in any order, so queue at most one write per pin and batch.
+ *
+ *  A uring is used from one thread. The usual pattern is one
+ *  uring_submit() and one uring_reap() per iteration of an event loop,
+ *  with uring_eventfd() added to the loop to wake it on completions.
+ *
+ *  Operations still in flight hold their descriptor and buffer. Reap them,
+ *  or close the uring, before closing a descriptor with a pending read.
+ *
+ *  # Usage #
+ *
+ *  @code
+ *  uring u;
+ *
+ *  uring_open(&u, 64);
+ *  uring_register_file(&u, uart->fd);
+ *
+ *  uart_uring_write(&u, uart, "ping", 4, sentFxn, NULL);
+ *  gpio_uring_write(&u, led, 1, NULL, NULL);
+ *
+ *  // One system call for both
+ *  uring_submit(&u, 0);
+ *  uring_reap(&u);
+ *  @endcode
+ *
+ *  ============================================================================
+ */
+ 
+#ifndef __URING_H_
+#define __URING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "stats.h"
+
+/*!
+ *  @brief      Default submission queue size
+ */
+#define URING_ENTRIES 64
+
+/*!
+ *  @brief      Slots of the registered file table
+ */
+#define URING_FILES 32
+
+struct uring;
+
+/*!
+ *  @brief      Completion callback
+ *
+ *  \a result is the number of bytes transferred or a negative errno value.
+ */
+typedef void (*uring_fxn)(struct uring *u, ssize_t result, void *arg);
+
+/*!
+ *  @brief      Queued operation, private to the driver
+ */
+struct uring_op {
+	uint8_t opcode;
+	int fd;
+	void *buf;
+	size_t length;
+	off_t offset;			/*!< @brief -1 uses the file position */
+	stats_op *stats;		/*!< @brief counters updated at completion, NULL for none */
+	int64_t start;
+	uring_fxn fxn;
+	void *arg;
+	ssize_t result;
+	int next;				/*!< @brief next free operation */
+};
+
+/*!
+ *  @brief      uring structure type definition
+ */
+typedef struct uring {
+	int fd;					/*!< @brief ring descriptor, -1 when io_uring is not available */
+	int eventfd;			/*!< @brief signaled on completions */
+	unsigned entries;		/*!< @brief submission queue size */
+	unsigned capacity;		/*!< @brief operations in flight, the completion queue size */
+	/* Shared with the kernel */
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* Operations */
+	struct uring_op *ops;
+	int free;				/*!< @brief first free operation, -1 when all are used */
+	int *pending;			/*!< @brief queued and not submitted yet, in order */
+	unsigned npending;
+	int *done;				/*!< @brief completed without the ring, in order */
+	unsigned ndone;
+	unsigned inflight;
+	uint8_t fixed_files;	/*!< @brief the kernel holds a file table */
+	int files[URING_FILES];	/*!< @brief registered descriptors, -1 for a free slot */
+	const struct iovec *buffers;
+	int nbuffers;
+	/* Counters */
+	uint64_t submits;		/*!< @brief io_uring_enter() calls that submitted */
+	uint64_t submitted;		/*!< @brief operations submitted */
+	uint64_t completed;
+} uring;
+
+/*!
+ *  @brief  Creates a uring
+ *
+ *  Falls back to plain system calls when io_uring is not available, see
+ *  uring_available().
+ *
+ *  @param  u       A uring structure
+ *  @param  entries Submission queue size, 0 means URING_ENTRIES
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uring_open(uring *u, unsigned entries);
+
+/*!
+ *  @brief  Returns 1 when operations go through io_uring, 0 in fallback mode
+ */
+extern int uring_available(uring *u);
+
+/*!
+ *  @brief  Registers a descriptor, so operations on it skip the file lookup
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uring_register_file(uring *u, int fd);
+
+/*!
+ *  @brief  Unregisters a descriptor, before closing it
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uring_unregister_file(uring *u, int fd);
+
+/*!
+ *  @brief  Registers the buffers used for transfers
+ *
+ *  Operations whose data lies inside one of the buffers use the fixed
+ *  buffer opcodes. Can only be done once per uring, and \a iov must stay
+ *  valid until uring_close().
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uring_register_buffers(uring *u, const struct iovec *iov, int count);
+
+/*!
+ *  @brief  Queues a read
+ *
+ *  Nothing reaches the kernel before uring_submit(), unless the
+ *  submission queue is full.
+ *
+ *  @param  u       A uring structure
+ *  @param  fd      Descriptor to read
+ *  @param  buf     Destination, valid until the completion
+ *  @param  length  Bytes to read
+ *  @param  offset  File offset, -1 for ttys and other streams
+ *  @param  stats   Counters updated at completion, can be NULL
+ *  @param  fxn     Completion callback, can be NULL
+ *  @param  arg     Passed to fxn
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred. Fails
+ *          with EAGAIN when capacity operations are already in flight.
+ */
+extern uint8_t uring_read(uring *u, int fd, void *buf, size_t length, off_t offset,
+		stats_op *stats, uring_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Queues a write
+ *
+ *  Same as uring_read(), \a buf must stay valid until the completion.
+ */
+extern uint8_t uring_write(uring *u, int fd, const void *buf, size_t length, off_t offset,
+		stats_op *stats, uring_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Reports an operation done without the ring
+ *
+ *  For drivers whose operation has no io_uring equivalent, so that its
+ *  callback still runs from uring_reap(). Operations reported this way
+ *  run in the order they were reported, before the ring completions
+ *  collected by the same uring_reap(); they are not ordered with respect
+ *  to the operations submitted through the ring.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uring_complete(uring *u, ssize_t result, uring_fxn fxn, void *arg);
+
+/*!
+ *  @brief  Submits every queued operation with one system call
+ *
+ *  Operations that do not fit in the free entries of the submission queue
+ *  stay queued and go with a later call, once the kernel has consumed
+ *  entries. Entries a failed or interrupted call left in the queue are
+ *  submitted again.
+ *
+ *  @param  u       A uring structure
+ *  @param  wait    Completions to wait for, 0 does not block
+ *
+ *  @return Returns the number of operations submitted, -1 if an error
+ *          ocurred
+ */
+extern int uring_submit(uring *u, unsigned wait);
+
+/*!
+ *  @brief  Runs the callbacks of the completed operations
+ *
+ *  Does not enter the kernel.
+ *
+ *  @return Returns the number of callbacks run
+ */
+extern int uring_reap(uring *u);
+
+/*!
+ *  @brief  Returns an eventfd signaled on completions, to add to an event loop
+ *
+ *  The counter is read by uring_reap(). In fallback mode it is signaled by
+ *  uring_submit().
+ */
+extern int uring_eventfd(uring *u);
+
+/*!
+ *  @brief  Destroys a uring
+ *
+ *  Operations still in flight are canceled by the kernel, their callbacks
+ *  are not run.
+ *
+ *  @return Returns if an error ocurred, 0 means no error ocurred
+ */
+extern uint8_t uring_close(uring *u);
+
+#endif /* __URING_H_ */
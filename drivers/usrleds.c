@@ -28,14 +28,36 @@
 #include "driver.h"
 #include "usrleds.h"
 
+/* Every sysfs write of the module, LED writes are rare enough to share it */
+static stats_op usrleds_counters;
 
 /*
  *  ======== writeToFile ========
  */
 static void writeToFile(char* filename, char* text) {
+    int64_t start = stats_now();
+    size_t length = strlen(text);
     FILE* file = fopen(filename, "w");
+
+    if (file == NULL) {
+        stats_record(&usrleds_counters, start, -1, length);
+        log_err("Could not open %s: %m", filename);
+        return;
+    }
     fprintf(file, "%s", text);
-    fclose(file);
+    if (fclose(file) != 0) {
+        stats_record(&usrleds_counters, start, -1, length);
+        log_err("Could not write to %s: %m", filename);
+        return;
+    }
+    stats_record(&usrleds_counters, start, length, length);
+}
+
+/*
+ *  ======== usrleds_stats ========
+ */
+void usrleds_stats(stats_op *copy, int reset) {
+    stats_snapshot(&usrleds_counters, copy, reset);
 }
 
 /*
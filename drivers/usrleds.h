@@ -66,6 +66,8 @@
 #ifndef __USRLEDS_H_
 #define __USRLEDS_H_
 
+#include "stats.h"
+
 /*!
  *  @brief      USR LEDS file descriptor location 
  */
@@ -97,4 +99,12 @@ void usrleds_write(char *led, int value);
  */
 void usrleds_flash(char *led);
 
+/*!
+ *  @brief      Copies the counters of the sysfs writes done by the module
+ *
+ *  @param      copy    Receives the counters
+ *  @param      reset   Non zero clears them after copying
+ */
+void usrleds_stats(stats_op *copy, int reset);
+
 #endif /* __USRLEDS_H_ */
\ No newline at end of file
@@ -32,22 +32,45 @@
 #include "drivers/gpio.h"
 /* UART Driver Header File */
 #include "drivers/uart.h"
+/* Event Loop Header File */
+#include "drivers/loop.h"
 
-int keepRunning = 1;
+static char buf[30];
+static int ledOn = 0;
 
-void closeHandler(void) {
-    keepRunning = 0;
-    printf("[INFO] CTRL-C catched!\n");
+/* Runs in the loop thread, not in a signal handler, so it may print */
+void closeFxn(loop *l, loop_source *source, void *arg) {
+    printf("[INFO] Signal %d catched!\n", source->signo);
+    loop_stop(l);
+}
+
+void blinkFxn(loop *l, loop_source *source, void *arg) {
+    uart_properties *uart = arg;
+
+    ledOn = !ledOn;
+    usrleds_write(LED1, ledOn);
+    if (!ledOn && uart_write(uart, buf, strlen(buf) + 1) < 0) {
+        printf("Could not send data to UART peripheral\n");
+        loop_stop(l);
+    }
 }
 
 int main(void) {
-    char buf[30];
+    loop events;
     
-    drivers_init(&closeHandler);
+    drivers_init(NULL);
+    
+    if (loop_open(&events, 8) != 0) {
+        printf("Could not create the event loop\n");
+        return -1;
+    }
+    /* Before any driver thread is started, see loop.h */
+    loop_add_signal(&events, SIGINT, closeFxn, NULL);
+    loop_add_signal(&events, SIGTERM, closeFxn, NULL);
     
     usrleds_init();
     
-    gpio_properties *gpio = malloc(sizeof(gpio_properties));
+    gpio_properties *gpio = calloc(1, sizeof(gpio_properties));
     gpio->nr = 60;
     gpio->direction = OUTPUT_PIN;
     if(gpio_open(gpio) < 0) {
@@ -55,7 +78,7 @@ int main(void) {
     }
     gpio_write(gpio, 1);
     
-	uart_properties *uart = malloc(sizeof(uart_properties));
+	uart_properties *uart = calloc(1, sizeof(uart_properties));
 	uart->uart_id = uart1;
     uart->baudrate = B9600;
     if(uart_open(uart) < 0) {
@@ -63,20 +86,14 @@ int main(void) {
     }
     sprintf(buf, "Hello!\n");
     
-    while(keepRunning) {
-        usrleds_write(LED1, 1);
-        sleep(1);
-        usrleds_write(LED1, 0);
-        sleep(1);
-        if (uart_write(uart, buf, strlen(buf) + 1) < 0) {
-			printf("Could not send data to UART peripheral\n");
-			return -1;
-        }
-    }
+    /* Toggles LED1 every second and greets on the UART every other tick */
+    loop_add_timer(&events, 1000000, blinkFxn, uart);
+    loop_run(&events);
+    loop_close(&events);
+
     gpio_close(gpio);
     free(gpio);
     uart_close(uart);
     printf("[INFO] Process finished!\n");
     return 0;
 }
-
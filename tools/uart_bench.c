@@ -0,0 +1,374 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       uart_bench.c 
+ *	@brief      UART throughput and latency benchmark over a pseudo terminal
+ *	@author     Maximiliano Valencia
+ *	@date       4/13/2018
+ *
+ *  One end of an openpty() pair is opened with uart_open() and driven
+ *  through uart_write() and uart_read(); a peer thread on the other end
+ *  sinks or echoes the data. No hardware is needed, so results measure the
+ *  library and the kernel tty layer, not the wire.
+ *
+ *  The binary is linked with -Wl,--wrap for the I/O calls so the system
+ *  calls made on the UART descriptor can be counted per message. Results
+ *  are printed as one JSON document on stdout.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/uio.h>
+/* UART Driver Header File */
+#include "driver.h"
+#include "uart.h"
+
+/* Bytes sent per throughput run */
+#define BENCH_BYTES (4 << 20)
+/* Round trips per latency run */
+#define BENCH_ROUND_TRIPS 5000
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, 4096 };
+#define BENCH_SIZES (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+/* Descriptor whose system calls are counted, -1 for none */
+static int counted_fd = -1;
+static uint64_t syscalls;
+static uint64_t log_calls;
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_writev(int fd, const struct iovec *iov, int count);
+int __real_poll(struct pollfd *fds, nfds_t count, int timeout);
+
+/*
+ *  ======== __wrap_read ========
+ */
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+	if (fd == counted_fd) {
+		__atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+	}
+	return __real_read(fd, buf, count);
+}
+
+/*
+ *  ======== __wrap_write ========
+ */
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+	if (fd == counted_fd) {
+		__atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+	}
+	return __real_write(fd, buf, count);
+}
+
+/*
+ *  ======== __wrap_writev ========
+ */
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int count) {
+	if (fd == counted_fd) {
+		__atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+	}
+	return __real_writev(fd, iov, count);
+}
+
+/*
+ *  ======== __wrap_poll ========
+ */
+int __wrap_poll(struct pollfd *fds, nfds_t count, int timeout) {
+	if (count > 0 && fds[0].fd == counted_fd) {
+		__atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+	}
+	return __real_poll(fds, count, timeout);
+}
+
+/*
+ *  ======== __wrap_syslog ========
+ *  Every syslog() costs at least one more system call on the log socket.
+ */
+void __wrap_syslog(int priority, const char *format, ...) {
+	va_list args;
+
+	__atomic_fetch_add(&log_calls, 1, __ATOMIC_RELAXED);
+	va_start(args, format);
+	vsyslog(priority, format, args);
+	va_end(args);
+}
+
+/* Entries printed in the current JSON array */
+static int bench_entries;
+
+/*
+ *  ======== bench_separator ========
+ *  Returns what goes before the next entry of the current array.
+ */
+static const char *bench_separator(void) {
+	return bench_entries++ == 0 ? "" : ",\n";
+}
+
+/*
+ *  Peer end of the pseudo terminal
+ */
+typedef struct {
+	int fd;
+	size_t expected;		/* bytes to sink, 0 echoes until hangup */
+	int64_t done;			/* time the last byte arrived */
+} bench_peer;
+
+/*
+ *  ======== bench_sink ========
+ */
+static void *bench_sink(void *arg) {
+	bench_peer *peer = arg;
+	uint8_t buf[4096];
+	size_t total = 0;
+	ssize_t count;
+
+	while (total < peer->expected) {
+		count = __real_read(peer->fd, buf, sizeof(buf));
+		if (count <= 0) {
+			break;
+		}
+		total += count;
+	}
+	peer->done = stats_now();
+	return NULL;
+}
+
+/*
+ *  ======== bench_echo ========
+ */
+static void *bench_echo(void *arg) {
+	bench_peer *peer = arg;
+	uint8_t buf[4096];
+	ssize_t count, sent, n;
+
+	for (;;) {
+		count = __real_read(peer->fd, buf, sizeof(buf));
+		if (count <= 0) {
+			break;
+		}
+		for (sent = 0; sent < count; sent += n) {
+			n = __real_write(peer->fd, buf + sent, count - sent);
+			if (n <= 0) {
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ *  ======== bench_open ========
+ *  Opens a pseudo terminal pair, the slave through uart_open().
+ */
+static int bench_open(uart_properties *uart, int *master, UART_TX_MODE mode) {
+	struct termios options;
+	char name[64];
+	int slave;
+
+	if (openpty(master, &slave, name, NULL, NULL) != 0) {
+		perror("openpty");
+		return -1;
+	}
+	close(slave);
+	tcgetattr(*master, &options);
+	cfmakeraw(&options);
+	tcsetattr(*master, TCSANOW, &options);
+
+	memset(uart, 0, sizeof(*uart));
+	uart->path = name;
+	uart->baudrate = B4000000;
+	uart->tx_mode = mode;
+	uart->tx_policy = UART_TX_BLOCK;
+	uart->tx_size = 65536;
+	if (uart_open(uart) != 0) {
+		close(*master);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *  ======== bench_throughput ========
+ */
+static int bench_throughput(size_t size, UART_TX_MODE mode) {
+	uart_properties uart;
+	bench_peer peer;
+	pthread_t thread;
+	char *message;
+	size_t count = BENCH_BYTES / size, i;
+	uint64_t calls, logs;
+	int64_t start;
+
+	if (bench_open(&uart, &peer.fd, mode) != 0) {
+		return -1;
+	}
+	message = malloc(size);
+	if (message == NULL) {
+		perror("malloc");
+		uart_close(&uart);
+		close(peer.fd);
+		return -1;
+	}
+	memset(message, 0x55, size);
+	peer.expected = count * size;
+	pthread_create(&thread, NULL, bench_sink, &peer);
+
+	counted_fd = uart.fd;
+	syscalls = 0;
+	log_calls = 0;
+	start = stats_now();
+	for (i = 0; i < count; i++) {
+		if (uart_write(&uart, message, size) != 0) {
+			break;
+		}
+	}
+	uart_flush(&uart, -1);
+	pthread_join(thread, NULL);
+	calls = syscalls;
+	logs = log_calls;
+	counted_fd = -1;
+
+	printf("%s    {\"size\": %zu, \"tx_mode\": \"%s\", \"messages\": %zu, "
+			"\"bytes_per_sec\": %.0f, \"syscalls_per_message\": %.3f, "
+			"\"log_calls_per_message\": %.3f}",
+			bench_separator(), size, mode == UART_TX_ASYNC ? "async" : "sync", i,
+			(double)(i * size) * 1e9 / (peer.done - start),
+			(double)calls / count, (double)logs / count);
+
+	uart_close(&uart);
+	close(peer.fd);
+	free(message);
+	return 0;
+}
+
+/*
+ *  ======== bench_compare ========
+ */
+static int bench_compare(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ *  ======== bench_latency ========
+ */
+static int bench_latency(size_t size) {
+	uart_properties uart;
+	bench_peer peer;
+	pthread_t thread;
+	struct pollfd fds;
+	unsigned char *reply;
+	char *message;
+	int64_t *samples, start;
+	uint64_t calls, logs;
+	size_t i, got;
+	int count;
+
+	if (bench_open(&uart, &peer.fd, UART_TX_SYNC) != 0) {
+		return -1;
+	}
+	message = malloc(size);
+	reply = malloc(size);
+	samples = malloc(BENCH_ROUND_TRIPS * sizeof(int64_t));
+	if (message == NULL || reply == NULL || samples == NULL) {
+		perror("malloc");
+		uart_close(&uart);
+		close(peer.fd);
+		free(samples);
+		free(reply);
+		free(message);
+		return -1;
+	}
+	memset(message, 0xAA, size);
+	peer.expected = 0;
+	pthread_create(&thread, NULL, bench_echo, &peer);
+
+	fds.fd = uart.fd;
+	fds.events = POLLIN;
+	counted_fd = uart.fd;
+	syscalls = 0;
+	log_calls = 0;
+	for (i = 0; i < BENCH_ROUND_TRIPS; i++) {
+		start = stats_now();
+		if (uart_write(&uart, message, size) != 0) {
+			break;
+		}
+		for (got = 0; got < size; got += count) {
+			poll(&fds, 1, -1);
+			count = uart_read(&uart, reply + got, size - got);
+			if (count < 0) {
+				break;
+			}
+		}
+		samples[i] = stats_now() - start;
+	}
+	calls = syscalls;
+	logs = log_calls;
+	counted_fd = -1;
+
+	/* Nothing to report when the first round trip already failed */
+	if (i > 0) {
+		qsort(samples, i, sizeof(int64_t), bench_compare);
+		printf("%s    {\"size\": %zu, \"round_trips\": %zu, \"p50_us\": %.1f, \"p99_us\": %.1f, "
+				"\"p999_us\": %.1f, \"max_us\": %.1f, \"syscalls_per_message\": %.3f, "
+				"\"log_calls_per_message\": %.3f}",
+				bench_separator(), size, i,
+				samples[i / 2] / 1e3, samples[i * 99 / 100] / 1e3, samples[i * 999 / 1000] / 1e3,
+				samples[i - 1] / 1e3, (double)calls / i, (double)logs / i);
+	}
+
+	/* The peer sees a hangup once the slave is closed */
+	uart_close(&uart);
+	pthread_join(thread, NULL);
+	close(peer.fd);
+	free(samples);
+	free(reply);
+	free(message);
+	return 0;
+}
+
+/*
+ *  ======== main ========
+ */
+int main(void) {
+	size_t i;
+
+	printf("{\n  \"benchmark\": \"uart\",\n  \"version\": 1,\n  \"throughput\": [\n");
+	bench_entries = 0;
+	for (i = 0; i < BENCH_SIZES; i++) {
+		bench_throughput(bench_sizes[i], UART_TX_SYNC);
+	}
+	for (i = 0; i < BENCH_SIZES; i++) {
+		bench_throughput(bench_sizes[i], UART_TX_ASYNC);
+	}
+	printf("\n  ],\n  \"latency\": [\n");
+	bench_entries = 0;
+	for (i = 0; i < BENCH_SIZES; i++) {
+		bench_latency(bench_sizes[i]);
+	}
+	printf("\n  ]\n}\n");
+	return 0;
+}
@@ -0,0 +1,275 @@
+/****************************************************************************
+ * Copyright (C) 2018 by Maximiliano Valencia                               *
+ *                                                                          *
+ * This file is part of BeagleBone Black Drivers Library (BBDL).            *
+ *                                                                          *
+ *   BBDL is free software: you can redistribute it and/or modify it        *
+ *   under the terms of the GNU Lesser General Public License as published  *
+ *   by the Free Software Foundation, either version 3 of the License, or   *
+ *   (at your option) any later version.                                    *
+ *                                                                          *
+ *   BBDL is distributed in the hope that it will be useful,                *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the          *
+ *   GNU Lesser General Public License for more details.                    *
+ *                                                                          *
+ *   You should have received a copy of the GNU Lesser General Public       *
+ *   License along with BBDL.  If not, see <http://www.gnu.org/licenses/>.  *
+ ****************************************************************************/
+
+/** 
+ *  @file       uart_replay.c 
+ *	@brief      Plays a UART capture back through a pseudo terminal
+ *	@author     Maximiliano Valencia
+ *	@date       4/18/2018
+ *
+ *  Creates an openpty() pair and waits for the application under test to
+ *  open the slave end, given to it as uart_properties.path or through the
+ *  symlink made with -l. The received (RX) records of the capture are
+ *  then written to it at their original pace, divided by -s; -s 0 writes
+ *  them back to back. With -c, what the application sends is compared
+ *  with the sent (TX) records.
+ *
+ *  uart_replay [-s speed] [-p port] [-l link] [-c] capture
+ *
+ *  Prints a summary line and exits with 1 when the output did not match.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pty.h>
+#include <time.h>
+/* UART Capture Header File */
+#include "driver.h"
+#include "uart_capture.h"
+#include "stats.h"
+
+/* Time the application gets to send what is still expected at the end */
+#define REPLAY_TAIL_MS 1000
+
+/* Bytes taken from the application with one read() */
+#define REPLAY_CHUNK 4096
+
+struct replay {
+	int master;
+	int compare;
+	uint8_t *expected;			/* TX records, concatenated */
+	uint64_t expected_bytes;
+	uint64_t received;			/* bytes read from the application */
+	uint64_t mismatches;
+	int closed;					/* the application closed the port */
+};
+
+/*
+ *  ======== replay_output ========
+ *  Reads what the application sent for up to \a timeout milliseconds, or
+ *  until the master is also ready for \a events.
+ */
+static void replay_output(struct replay *replay, int timeout, short events) {
+	uint8_t chunk[REPLAY_CHUNK];
+	struct pollfd fds;
+	ssize_t count, i;
+
+	fds.fd = replay->master;
+	fds.events = POLLIN | events;
+	if (poll(&fds, 1, timeout) <= 0) {
+		return;
+	}
+	count = (fds.revents & POLLIN) ? read(replay->master, chunk, sizeof(chunk)) : -1;
+	if (count <= 0 && (fds.revents & POLLHUP)) {
+		replay->closed = 1;
+		return;
+	}
+	for (i = 0; i < count; i++, replay->received++) {
+		if (replay->compare && (replay->received >= replay->expected_bytes
+				|| replay->expected[replay->received] != chunk[i])) {
+			replay->mismatches++;
+		}
+	}
+}
+
+/*
+ *  ======== replay_write ========
+ */
+static int replay_write(struct replay *replay, const uint8_t *data, size_t length) {
+	ssize_t n;
+
+	while (length > 0) {
+		if (replay->closed) {
+			errno = EPIPE;
+			return -1;
+		}
+		n = write(replay->master, data, length);
+		if (n < 0) {
+			if (errno != EINTR && errno != EAGAIN) {
+				return -1;
+			}
+			/* The application may be blocked writing, keep draining its output */
+			replay_output(replay, -1, POLLOUT);
+			continue;
+		}
+		data += n;
+		length -= n;
+	}
+	return 0;
+}
+
+/*
+ *  ======== replay_wait_open ========
+ *  The master reports POLLHUP until somebody opens the slave.
+ */
+static void replay_wait_open(int master) {
+	struct pollfd fds;
+
+	fds.fd = master;
+	fds.events = POLLIN;
+	for (;;) {
+		fds.revents = 0;
+		if (poll(&fds, 1, 100) >= 0 && !(fds.revents & POLLHUP)) {
+			return;
+		}
+		usleep(10000);
+	}
+}
+
+/*
+ *  ======== main ========
+ */
+int main(int argc, char *argv[]) {
+	struct replay replay;
+	uart_capture capture;
+	const uart_capture_record *record;
+	const uint8_t *data;
+	struct termios raw;
+	const char *link = NULL;
+	char name[64];
+	double speed = 1;
+	int port = -1, slave, opt;
+	uint64_t position, records = 0, written = 0;
+	int64_t base = 0, start, due, now, late, max_late = 0;
+
+	memset(&replay, 0, sizeof(replay));
+	while ((opt = getopt(argc, argv, "s:p:l:c")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = strtod(optarg, NULL);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'l':
+			link = optarg;
+			break;
+		case 'c':
+			replay.compare = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s speed] [-p port] [-l link] [-c] capture\n",
+					argv[0]);
+			return 2;
+		}
+	}
+	if (optind != argc - 1 || speed < 0) {
+		fprintf(stderr, "usage: %s [-s speed] [-p port] [-l link] [-c] capture\n", argv[0]);
+		return 2;
+	}
+	if (uart_capture_load(&capture, argv[optind]) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 2;
+	}
+
+	/* Everything the application is expected to send, in order */
+	for (position = 0; uart_capture_next(&capture, &position, &record, &data); ) {
+		if (record->direction == UART_CAPTURE_TX && (port < 0 || record->port == port)) {
+			replay.expected_bytes += record->length;
+		}
+	}
+	replay.expected = malloc(replay.expected_bytes + 1);
+	if (replay.expected == NULL) {
+		perror("malloc");
+		return 2;
+	}
+	replay.expected_bytes = 0;
+	for (position = 0; uart_capture_next(&capture, &position, &record, &data); ) {
+		if (record->direction == UART_CAPTURE_TX && (port < 0 || record->port == port)) {
+			memcpy(replay.expected + replay.expected_bytes, data, record->length);
+			replay.expected_bytes += record->length;
+		}
+	}
+
+	cfmakeraw(&raw);
+	if (openpty(&replay.master, &slave, name, &raw, NULL) < 0) {
+		perror("openpty");
+		return 2;
+	}
+	close(slave);
+	/* Never block on a full tty while the application blocks writing back */
+	if (fcntl(replay.master, F_SETFL, fcntl(replay.master, F_GETFL) | O_NONBLOCK) < 0) {
+		perror("fcntl");
+		return 2;
+	}
+	if (link != NULL) {
+		unlink(link);
+		if (symlink(name, link) < 0) {
+			perror(link);
+			return 2;
+		}
+	}
+	fprintf(stderr, "Replaying %s on %s, waiting for it to be opened\n", argv[optind], name);
+	replay_wait_open(replay.master);
+
+	start = stats_now();
+	for (position = 0; uart_capture_next(&capture, &position, &record, &data); ) {
+		if (record->direction != UART_CAPTURE_RX || (port >= 0 && record->port != port)) {
+			continue;
+		}
+		if (records == 0) {
+			base = record->timestamp_ns;
+		}
+		due = speed > 0 ? start + (int64_t)((record->timestamp_ns - base) / speed) : 0;
+		while ((now = stats_now()) < due && !replay.closed) {
+			replay_output(&replay, (int)((due - now) / 1000000), 0);
+		}
+		if (replay.closed) {
+			break;
+		}
+		late = due > 0 ? stats_now() - due : 0;
+		if (late > max_late) {
+			max_late = late;
+		}
+		if (replay_write(&replay, data, record->length) < 0) {
+			if (!replay.closed) {
+				perror("write");
+			}
+			break;
+		}
+		records++;
+		written += record->length;
+	}
+
+	/* Give the application time for its last answers */
+	due = stats_now() + (int64_t)REPLAY_TAIL_MS * 1000000;
+	while (!replay.closed && (now = stats_now()) < due
+			&& (!replay.compare || replay.received < replay.expected_bytes)) {
+		replay_output(&replay, (int)((due - now) / 1000000) + 1, 0);
+	}
+	if (replay.compare && replay.received < replay.expected_bytes) {
+		replay.mismatches += replay.expected_bytes - replay.received;
+	}
+
+	printf("records %llu, written %llu bytes in %.3f s, max late %lld us, "
+			"received %llu of %llu expected bytes, %llu mismatched\n",
+			(unsigned long long)records, (unsigned long long)written,
+			(stats_now() - start) / 1e9, (long long)(max_late / 1000),
+			(unsigned long long)replay.received, (unsigned long long)replay.expected_bytes,
+			(unsigned long long)replay.mismatches);
+
+	if (link != NULL) {
+		unlink(link);
+	}
+	close(replay.master);
+	free(replay.expected);
+	uart_capture_close(&capture);
+	return replay.compare && replay.mismatches > 0 ? 1 : 0;
+}